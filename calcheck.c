@@ -0,0 +1,126 @@
+/*
+ * Calendar check of the clock methods of main.c, run by the calcheck
+ * command on the board and by host/calcheck on every host build.
+ *
+ * The reference is days_from_civil / civil_from_days of hbnrec.c; month
+ * lengths are taken from the day before the first of the next month,
+ * not from month_days, which the clock itself uses.
+ * For every day of the years checked:
+ *   clock_init at 23:59:59 gives the date, yday, leap flag and the days
+ *   of every month
+ *   one more second carries to 00:00:00 of the next day
+ * and on the first and last day of every month:
+ *   clock_button_increase by +1 and -1 in every edit position moves
+ *   only the field edited, the day clamped to the new month
+ *   clock_set_date takes the day and refuses the day after the last
+ * Failures go to the fail function of the check, which reports them.
+ */
+
+#include "hbnrec.h"
+#include "calcheck.h"
+
+/* Days of a month, the reference */
+int calcheck_mdays(int month, int year)
+{
+    int y, m, d;
+    civil_from_days(days_from_civil(year, month + 1, 1) - 1, &y, &m, &d);
+    return d;
+}
+void calcheck_begin(calcheck_t *cc, void (*fail)(const char *, int, int, int, int))
+{
+    cc->mdays_year = -1;
+    cc->fail = fail;
+}
+
+/* true - the clock is at the given time of day of the given day */
+static bool calcheck_is(calcheck_t *cc, const dgtclock_t *c, int sec, int min, int hour,
+                        uint32_t days)
+{
+    int year, month, mday, m;
+
+    civil_from_days(days, &year, &month, &mday);
+    if (cc->mdays_year != year)
+    {
+        for (m = 0; m <= MONTH_DEC; m++)
+            cc->mdays[m] = calcheck_mdays(m, year);
+        cc->mdays_year = year;
+    }
+    if (c->sec != sec || c->min != min || c->hour != hour || c->mday != mday ||
+        c->month != month || c->year != year ||
+        c->yday != (int)(days - days_from_civil(year, MONTH_JAN, 1)) ||
+        c->isleap != (cc->mdays[MONTH_FEB] == 29))
+        return false;
+    for (m = 0; m <= MONTH_DEC; m++)
+        if (c->days[m] != cc->mdays[m])
+            return false;
+    return true;
+}
+static void calcheck_edits(calcheck_t *cc, int year, int month, int mday)
+{
+    int ptr, incr, sec, min, hour, y, m, d;
+
+    for (ptr = 1; ptr <= 6; ptr++)
+        for (incr = -1; incr <= 1; incr += 2)
+        {
+            sec = min = hour = 0;
+            y = year, m = month, d = mday;
+            switch (ptr)
+            {
+            case 1:
+                hour = (incr + 24) % 24;
+                break;
+            case 2:
+                min = (incr + 60) % 60;
+                break;
+            case 3:
+                sec = (incr + 60) % 60;
+                break;
+            case 4:
+                y = (year + incr + 10000) % 10000;
+                break;
+            case 5:
+                m = (month + incr + 12) % 12;
+                break;
+            default:
+                d = (mday - 1 + incr + calcheck_mdays(month, year)) % calcheck_mdays(month, year) + 1;
+                break;
+            }
+            if (d > calcheck_mdays(m, y))
+                d = calcheck_mdays(m, y);
+            clock_init(&cc->e, 0, 0, 0, mday, month, year);
+            clock_button_increase(&cc->e, incr, ptr);
+            if (!calcheck_is(cc, &cc->e, sec, min, hour, days_from_civil(y, m, d)))
+                cc->fail("edit", year, month, mday, ptr * incr);
+        }
+}
+/* Every day of the years from ~ to
+ * return: days checked */
+uint32_t calcheck_years(calcheck_t *cc, int from, int to)
+{
+    dgtclock_t *c = &cc->c;
+    uint32_t d, end, n = 0;
+    int year, month, mday, last;
+
+    end = days_from_civil(to + 1, MONTH_JAN, 1);
+    for (d = days_from_civil(from, MONTH_JAN, 1); d < end; d++, n++)
+    {
+        civil_from_days(d, &year, &month, &mday);
+        clock_init(c, 59, 59, 23, mday, month, year);
+        if (!calcheck_is(cc, c, 59, 59, 23, d))
+            cc->fail("init", year, month, mday, 0);
+        c->sec++;
+        clock_update(c);
+        if (!calcheck_is(cc, c, 0, 0, 0, d + 1))
+            cc->fail("carry", year, month, mday, 0);
+        last = calcheck_mdays(month, year);
+        if (mday == 1 || mday == last)
+        {
+            calcheck_edits(cc, year, month, mday);
+            if (clock_set_date(c, last + 1, month, year) == 0)
+                cc->fail("set_date", year, month, last + 1, 0);
+            if (clock_set_date(c, mday, month, year) != 0 || !calcheck_is(cc, c, 0, 0, 0, d))
+                cc->fail("set_date", year, month, mday, 0);
+        }
+    }
+    return n;
+}
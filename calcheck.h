@@ -0,0 +1,20 @@
+#ifndef _CALCHECK_H
+#define _CALCHECK_H
+
+#include "dgtclock.h"
+
+/* A calendar check under way; the clocks are kept here rather than on
+ * the stack, which is small on the board */
+typedef struct
+{
+    dgtclock_t c, e; /* the clock of the day and the one edited */
+    int mdays_year;  /* year of mdays, -1 none */
+    int mdays[12];   /* reference month lengths of that year */
+    void (*fail)(const char *what, int year, int month, int mday, int arg);
+} calcheck_t;
+
+int calcheck_mdays(int month, int year);
+void calcheck_begin(calcheck_t *cc, void (*fail)(const char *, int, int, int, int));
+uint32_t calcheck_years(calcheck_t *cc, int from, int to);
+
+#endif
@@ -0,0 +1,28 @@
+#ifndef _DGTCLOCK_H
+#define _DGTCLOCK_H
+
+#include "headers.h"
+
+/* Digital clock type */
+typedef struct
+{
+    int sec;      /* second, range 0~59 */
+    int min;      /* minute, range 0~59 */
+    int hour;     /* hour, range 0~23*/
+    int mday;     /* which day in this month, range 1~31 */
+    int month;    /* month range 0~11 */
+    int year;     /* year */
+    int yday;     /* which day in this year, 0~365 */
+    int isleap;   /* whether leap year or not */
+    int days[12]; /* built-in calendar */
+} dgtclock_t;
+
+/* Calendar methods of the clock, in main.c */
+void clock_init(dgtclock_t *clock, int ss, int mm, int hh, int mday, int month, int year);
+void clock_update(dgtclock_t *clock);
+int clock_set_date(dgtclock_t *clock, int mday, int month, int year);
+int clock_set_time(dgtclock_t *clock, int sec, int min, int hour);
+void clock_button_increase(dgtclock_t *clock, int incr, int ptr);
+int month_days(int month, int year);
+
+#endif
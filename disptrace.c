@@ -0,0 +1,197 @@
+/*
+ * Display trace: the segment (port 1) and digit select (port 2) writes
+ * to the TCA6424 are kept with their cycle count, and the decoder
+ * replays them to rebuild what every digit showed. The replay is a
+ * function of the records alone; disp dump prints them for the host
+ * decoder of host/dispdec.c.
+ *
+ * A digit is lit while its select bit is set in port 2, showing the
+ * segments in port 1. Per digit the decoder reports the character,
+ * mapped back through font7 / font7_flip (digits first, then letters,
+ * as most glyphs are shared), the refresh rate (select rising
+ * edges per second), the duty cycle (lit time over the trace span)
+ * and ghosting: port 1 written while the select of the digit is still
+ * active, so the segments meant for one digit flash on another.
+ */
+
+#include "initialize.h"
+#include "prof.h"
+#include "disptrace.h"
+#include "text7.h"
+
+volatile bool disptrace_on;
+
+static disptrace_rec_t trace[DISPTRACE_SIZE];
+static volatile int trace_head, trace_len;
+
+void disptrace_start()
+{
+    bool masked = IntMasterDisable();
+    trace_head = trace_len = 0;
+    disptrace_on = true;
+    if (!masked)
+        IntMasterEnable();
+}
+void disptrace_stop()
+{
+    disptrace_on = false;
+}
+/* Called by I2C0_WriteByte for TCA6424 writes while tracing */
+void disptrace_write(uint8_t reg, uint8_t val)
+{
+    bool masked;
+    if (reg != TCA6424_OUTPUT_PORT1 && reg != TCA6424_OUTPUT_PORT2)
+        return;
+    masked = IntMasterDisable();
+    trace[trace_head].cycles = DWT_CYCLES();
+    trace[trace_head].reg = reg;
+    trace[trace_head].val = val;
+    trace_head = (trace_head + 1) % DISPTRACE_SIZE;
+    if (trace_len < DISPTRACE_SIZE)
+        trace_len++;
+    if (!masked)
+        IntMasterEnable();
+}
+
+/* Characters searched in turn for a segment byte: many glyphs are
+ * shared, and a '5' must not come back as the '$' before it */
+static const char seg_ranges[4][2] = {
+    {'0', '9'}, {'A', 'Z'}, {'a', 'z'}, {FONT7_FIRST, FONT7_FIRST + FONT7_NUM - 1}};
+
+/* Character of a segment byte, the decimal point left out */
+static char seg_char(uint8_t seg, bool flip)
+{
+    const uint8_t *font = flip ? font7_flip : font7;
+    int r, c;
+    seg &= 0x7f;
+    if (!seg)
+        return ' ';
+    for (r = 0; r < 4; r++)
+        for (c = seg_ranges[r][0]; c <= seg_ranges[r][1]; c++)
+            if (font[c - FONT7_FIRST] == seg)
+                return c;
+    return '?';
+}
+
+/* Oldest first into snap, returns the records */
+static int disptrace_snap(disptrace_rec_t *snap)
+{
+    int n, i;
+    bool masked = IntMasterDisable();
+    n = trace_len;
+    for (i = 0; i < n; i++)
+        snap[i] = trace[(trace_head - n + i + DISPTRACE_SIZE) % DISPTRACE_SIZE];
+    if (!masked)
+        IntMasterEnable();
+    return n;
+}
+
+/* Replay n records, oldest first, into res; touches nothing else, so
+ * it runs as well on a trace captured with disp dump
+ *  0 - ok
+ * -1 - fewer than 2 records
+ */
+int disptrace_replay(const disptrace_rec_t *recs, int n, bool flip, disptrace_result_t *res)
+{
+    disptrace_digit_t *digits = res->digits;
+    int i, d, p1 = -1, p2 = -1, len = 0;
+
+    memset(res, 0, sizeof(*res));
+    res->writes = n;
+    if (n < 2)
+        return -1;
+
+    for (i = 0; i < n; i++)
+    {
+        /* State held since the previous write */
+        if (i && p1 >= 0 && p2 >= 0 && (p1 & 0x7f))
+            for (d = 0; d < DISPTRACE_DIGITS; d++)
+                if (p2 & (1 << d))
+                    digits[d].lit += recs[i].cycles - recs[i - 1].cycles;
+
+        if (recs[i].reg == TCA6424_OUTPUT_PORT1)
+        {
+            p1 = recs[i].val;
+            for (d = 0; d < DISPTRACE_DIGITS && p2 > 0; d++)
+                if (p2 & (1 << d))
+                    digits[d].ghosts++;
+        }
+        else
+        {
+            for (d = 0; d < DISPTRACE_DIGITS; d++)
+                if ((recs[i].val & (1 << d)) && !(p2 >= 0 && (p2 & (1 << d))))
+                {
+                    digits[d].rises++;
+                    digits[d].seg = p1 >= 0 ? p1 : 0;
+                }
+            p2 = recs[i].val;
+        }
+    }
+    res->span = recs[n - 1].cycles - recs[0].cycles;
+    if (!res->span)
+        res->span = 1;
+
+    for (d = 0; d < DISPTRACE_DIGITS; d++)
+    {
+        digits[d].c = seg_char(digits[d].seg, flip);
+        res->shown[len++] = digits[d].rises ? digits[d].c : ' ';
+        if (digits[d].rises && (digits[d].seg & 0x80))
+            res->shown[len++] = '.';
+    }
+    res->shown[len] = '\0';
+    return 0;
+}
+/* Print a replay, cycles counted at clock Hz */
+void disptrace_print(const disptrace_result_t *res, uint32_t clock)
+{
+    const disptrace_digit_t *digits = res->digits;
+    char buf[80];
+    uint32_t per_us = clock / 1000000 ? clock / 1000000 : 1;
+    int d;
+
+    sprintf(buf, "%d writes over %u us, showing \"%s\"\n", res->writes, res->span / per_us,
+            res->shown);
+    UARTStringPut((uint8_t *)buf);
+    UARTStringPut("digit char  segs  refresh Hz  duty %  ghosts\n");
+    for (d = 0; d < DISPTRACE_DIGITS; d++)
+    {
+        uint32_t permille = (uint32_t)((uint64_t)digits[d].lit * 1000 / res->span);
+        if (!digits[d].rises && !digits[d].ghosts)
+            continue;
+        sprintf(buf, "%5d    %c  0x%02x  %10u  %3u.%u  %6u\n", d, digits[d].c, digits[d].seg,
+                (uint32_t)((uint64_t)digits[d].rises * clock / res->span), permille / 10,
+                permille % 10, digits[d].ghosts);
+        UARTStringPut((uint8_t *)buf);
+    }
+}
+/* Print the records for a decoder off the board:
+ *   disptrace,clock,<Hz>
+ *   disptrace,<cycles>,<reg>,<val>     oldest first
+ */
+void disptrace_dump()
+{
+    static disptrace_rec_t snap[DISPTRACE_SIZE];
+    char buf[48];
+    int n = disptrace_snap(snap), i;
+
+    sprintf(buf, "disptrace,clock,%u\n", ui32SysClock);
+    UARTStringPut((uint8_t *)buf);
+    for (i = 0; i < n; i++)
+    {
+        sprintf(buf, "disptrace,%u,%u,%u\n", snap[i].cycles, snap[i].reg, snap[i].val);
+        UARTStringPut((uint8_t *)buf);
+    }
+}
+/* Replay the trace and print what the display showed */
+void disptrace_decode(bool flip)
+{
+    static disptrace_rec_t snap[DISPTRACE_SIZE];
+    static disptrace_result_t res;
+
+    if (disptrace_replay(snap, disptrace_snap(snap), flip, &res) < 0)
+    {
+        UARTStringPut("No display trace, start one with: disp trace\n");
+        return;
+    }
+    disptrace_print(&res, ui32SysClock);
+}
@@ -0,0 +1,47 @@
+#ifndef _DISPTRACE_H
+#define _DISPTRACE_H
+
+#include "headers.h"
+
+/* TCA6424 port 1 / port 2 writes kept, the oldest are overwritten */
+#define DISPTRACE_SIZE 256
+
+/* Digits of the display, digit i is selected by bit i of port 2 */
+#define DISPTRACE_DIGITS 8
+
+typedef struct
+{
+    uint32_t cycles; /* DWT cycle count of the write */
+    uint8_t reg;     /* TCA6424_OUTPUT_PORT1 or TCA6424_OUTPUT_PORT2 */
+    uint8_t val;
+} disptrace_rec_t;
+
+/* What a digit showed over a trace */
+typedef struct
+{
+    uint32_t lit;    /* cycles selected with segments on */
+    uint32_t rises;  /* select rising edges */
+    uint32_t ghosts; /* port 1 writes while selected */
+    uint8_t seg;     /* port 1 at the last rising edge */
+    char c;          /* seg through the font, ' ' blank, '?' no glyph */
+} disptrace_digit_t;
+
+typedef struct
+{
+    int writes;
+    uint32_t span; /* cycles from the first write to the last */
+    disptrace_digit_t digits[DISPTRACE_DIGITS];
+    char shown[2 * DISPTRACE_DIGITS + 1]; /* digits lit, with their points */
+} disptrace_result_t;
+
+extern volatile bool disptrace_on;
+
+void disptrace_start(void);
+void disptrace_stop(void);
+void disptrace_write(uint8_t reg, uint8_t val);
+int disptrace_replay(const disptrace_rec_t *recs, int n, bool flip, disptrace_result_t *res);
+void disptrace_print(const disptrace_result_t *res, uint32_t clock);
+void disptrace_dump(void);
+void disptrace_decode(bool flip);
+
+#endif
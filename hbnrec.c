@@ -0,0 +1,296 @@
+/*
+ * Versioned records of the hibernate memory.
+ *
+ * Every field is serialized explicitly, so the layout does not follow
+ * the structs of main.c. A record is only accepted when its header,
+ * length and CRC match and every field is in range; records of older
+ * versions are migrated to hbn_state_t and rewritten by the caller.
+ *
+ * Each hibernate word takes a few 32kHz cycles to write, so a shadow
+ * copy of the area is kept and only the words that differ are written.
+ */
+
+#include "initialize.h"
+#include "stwatch.h"
+#include "hbnrec.h"
+
+/* Contents of the hibernate data area */
+static uint32_t shadow[HBN_WORDS];
+
+/* Write statistics */
+static uint32_t stores, words_written;
+static uint64_t write_ticks;
+
+/* IEEE CRC-32 of n words */
+uint32_t crc32_words(const uint32_t *words, int n)
+{
+#ifdef HBN_HW_CRC
+    uint32_t crc;
+    bool masked = IntMasterDisable(); /* the CRC module is shared with the ISRs */
+    /* Bytes fed LSB first in memory order, as Crc32 does */
+    CRCConfigSet(CCM0_BASE, CRC_CFG_INIT_1 | CRC_CFG_TYPE_P4C11DB7 | CRC_CFG_SIZE_32BIT |
+                                CRC_CFG_ENDIAN_SBHW | CRC_CFG_ENDIAN_SHW |
+                                CRC_CFG_IBR | CRC_CFG_OBR | CRC_CFG_RESINV);
+    crc = CRCDataProcess(CCM0_BASE, (uint32_t *)words, n, true);
+    if (!masked)
+        IntMasterEnable();
+    return crc;
+#else
+    return Crc32(0xffffffff, (const uint8_t *)words, n * 4) ^ 0xffffffff;
+#endif
+}
+
+static bool in_range(int x, int lo, int hi)
+{
+    return x >= lo && x <= hi;
+}
+/* true - every field is valid */
+static bool state_valid(const hbn_state_t *st)
+{
+    int i;
+    bool ok = in_range(st->sec, 0, 59) && in_range(st->min, 0, 59) && in_range(st->hour, 0, 23) &&
+              in_range(st->mday, 1, 31) && in_range(st->month, 0, 11) && in_range(st->year, 0, 9999) &&
+              in_range(st->timer_millisec, 0, 999) && in_range(st->timer_sec, 0, 59) &&
+              in_range(st->timer_min, 0, 99) && in_range(st->snooze_sec, 0, 86399) &&
+              in_range(st->display_mode, 0, (1 << HBN_DISPLAY_BITS) - 1);
+    for (i = 0; i < HBN_ALARM_NUM; i++)
+        ok = ok && in_range(st->alarms[i].sec, 0, 59) && in_range(st->alarms[i].min, 0, 59) &&
+             in_range(st->alarms[i].hour, 0, 23);
+    for (i = 0; i < CDOWN_NUM; i++)
+        ok = ok && st->cdown_sec[i] <= 359999;
+    return ok;
+}
+
+/* Days since -0400-03-01 of a proleptic Gregorian date, month 0~11.
+ * Counting from a March makes the leap day the last day of a year. */
+uint32_t days_from_civil(int year, int month, int mday)
+{
+    uint32_t y = year + 400 - (month < 2), era = y / 400, yoe = y % 400;
+    uint32_t doy = (153 * (month < 2 ? month + 10 : month - 2) + 2) / 5 + mday - 1;
+    return era * 146097 + yoe * 365 + yoe / 4 - yoe / 100 + doy;
+}
+void civil_from_days(uint32_t days, int *year, int *month, int *mday)
+{
+    uint32_t era = days / 146097, doe = days % 146097;
+    uint32_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    uint32_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100), mp = (5 * doy + 2) / 153;
+    *mday = doy - (153 * mp + 2) / 5 + 1;
+    *month = mp < 10 ? mp + 2 : mp - 10;
+    *year = era * 400 + yoe - 400 + (*month < 2);
+}
+
+/* Bit stream of the version 3 payload, fields up to 32 bits */
+static void put_bits(uint32_t *w, int *pos, uint32_t v, int n)
+{
+    int i = *pos >> 5, s = *pos & 31;
+    if (n < 32)
+        v &= (1u << n) - 1;
+    w[i] |= v << s;
+    if (s + n > 32)
+        w[i + 1] |= v >> (32 - s);
+    *pos += n;
+}
+static uint32_t get_bits(const uint32_t *w, int *pos, int n)
+{
+    int i = *pos >> 5, s = *pos & 31;
+    uint32_t v = w[i] >> s;
+    if (s + n > 32)
+        v |= w[i + 1] << (32 - s);
+    *pos += n;
+    return n < 32 ? v & ((1u << n) - 1) : v;
+}
+
+/* Version 1: memcpy of dgtclock_t, alarm_t and timer_t, no CRC.
+ * The alarm enable flag was not part of the copy. */
+static int decode_v1(const uint32_t *w, hbn_state_t *st)
+{
+    const int32_t *c = (const int32_t *)w + HBN_V1_CLOCK;
+    const int32_t *a = (const int32_t *)w + HBN_V1_ALARM;
+    const int32_t *t = (const int32_t *)w + HBN_V1_TIMER;
+    st->rtc = w[HBN_V1_RTC];
+    st->sec = c[0], st->min = c[1], st->hour = c[2];
+    st->mday = c[3], st->month = c[4], st->year = c[5];
+    st->alarms[0].sec = a[0], st->alarms[0].min = a[1], st->alarms[0].hour = a[2];
+    st->timer_millisec = t[0], st->timer_sec = t[1], st->timer_min = t[2];
+    return 0;
+}
+/* Version 2: one word per field */
+#define V2_LEN 14
+static int decode_v2(const uint32_t *w, hbn_state_t *st)
+{
+    const int32_t *p = (const int32_t *)w + 1;
+    if ((w[0] & 0xff) != V2_LEN)
+        return -1;
+    st->rtc = w[1];
+    st->sec = p[1], st->min = p[2], st->hour = p[3];
+    st->mday = p[4], st->month = p[5], st->year = p[6];
+    st->alarms[0].sec = p[7], st->alarms[0].min = p[8], st->alarms[0].hour = p[9];
+    st->alarms[0].enable = p[10] != 0;
+    st->timer_millisec = p[11], st->timer_sec = p[12], st->timer_min = p[13];
+    return 0;
+}
+/* Version 3: bit-packed, the clock as an epoch second count */
+#define V3_BITS (32 + HBN_EPOCH_BITS + HBN_ALARM_NUM * (HBN_TOD_BITS + 1) + 10 + 6 + 7 + \
+                 CDOWN_NUM * HBN_CDOWN_BITS + HBN_TOD_BITS + 1 + HBN_DISPLAY_BITS +     \
+                 2 * HBN_COUNT_BITS)
+#define V3_LEN ((V3_BITS + 31) / 32)
+static int decode_v3(const uint32_t *w, hbn_state_t *st)
+{
+    const uint32_t *p = w + 1;
+    uint64_t epoch;
+    uint32_t tod;
+    int pos = 0, i;
+
+    if ((w[0] & 0xff) != V3_LEN)
+        return -1;
+    st->rtc = get_bits(p, &pos, 32);
+    epoch = get_bits(p, &pos, 32);
+    epoch |= (uint64_t)get_bits(p, &pos, HBN_EPOCH_BITS - 32) << 32;
+    civil_from_days((uint32_t)(epoch / 86400), &st->year, &st->month, &st->mday);
+    tod = (uint32_t)(epoch % 86400);
+    st->hour = tod / 3600, st->min = tod / 60 % 60, st->sec = tod % 60;
+    for (i = 0; i < HBN_ALARM_NUM; i++)
+    {
+        tod = get_bits(p, &pos, HBN_TOD_BITS);
+        if (tod >= 86400)
+            return -1;
+        st->alarms[i].hour = tod / 3600, st->alarms[i].min = tod / 60 % 60;
+        st->alarms[i].sec = tod % 60;
+        st->alarms[i].enable = get_bits(p, &pos, 1);
+    }
+    st->timer_millisec = get_bits(p, &pos, 10);
+    st->timer_sec = get_bits(p, &pos, 6);
+    st->timer_min = get_bits(p, &pos, 7);
+    for (i = 0; i < CDOWN_NUM; i++)
+        st->cdown_sec[i] = get_bits(p, &pos, HBN_CDOWN_BITS);
+    st->snooze_sec = get_bits(p, &pos, HBN_TOD_BITS);
+    st->flip = get_bits(p, &pos, 1);
+    st->display_mode = get_bits(p, &pos, HBN_DISPLAY_BITS);
+    st->boot_count = get_bits(p, &pos, HBN_COUNT_BITS);
+    st->reset_count = get_bits(p, &pos, HBN_COUNT_BITS);
+    return 0;
+}
+
+/* Serialize in the current version */
+void hbnrec_encode(const hbn_state_t *st, uint32_t *words)
+{
+    uint32_t *p = words + 1;
+    uint64_t epoch;
+    int pos = 0, i;
+
+    memset(words, 0, HBN_REC_WORDS * 4);
+    words[0] = HBN_HEADER(HBN_VERSION, V3_LEN);
+    epoch = (uint64_t)days_from_civil(st->year, st->month, st->mday) * 86400 +
+            (st->hour * 60 + st->min) * 60 + st->sec;
+    put_bits(p, &pos, st->rtc, 32);
+    put_bits(p, &pos, (uint32_t)epoch, 32);
+    put_bits(p, &pos, (uint32_t)(epoch >> 32), HBN_EPOCH_BITS - 32);
+    for (i = 0; i < HBN_ALARM_NUM; i++)
+    {
+        put_bits(p, &pos, (st->alarms[i].hour * 60 + st->alarms[i].min) * 60 + st->alarms[i].sec,
+                 HBN_TOD_BITS);
+        put_bits(p, &pos, st->alarms[i].enable, 1);
+    }
+    put_bits(p, &pos, st->timer_millisec, 10);
+    put_bits(p, &pos, st->timer_sec, 6);
+    put_bits(p, &pos, st->timer_min, 7);
+    for (i = 0; i < CDOWN_NUM; i++)
+        put_bits(p, &pos, st->cdown_sec[i], HBN_CDOWN_BITS);
+    put_bits(p, &pos, st->snooze_sec, HBN_TOD_BITS);
+    put_bits(p, &pos, st->flip, 1);
+    put_bits(p, &pos, st->display_mode, HBN_DISPLAY_BITS);
+    put_bits(p, &pos, st->boot_count, HBN_COUNT_BITS);
+    put_bits(p, &pos, st->reset_count, HBN_COUNT_BITS);
+    words[V3_LEN + 1] = crc32_words(words, V3_LEN + 1);
+}
+#if V3_LEN + 2 > HBN_REC_WORDS
+#error "hibernate record overlaps the boot log"
+#endif
+/* Validate and deserialize, migrating older versions.
+ * Fields an older version lacks are left zero.
+ * >0 - version of the record found
+ * -1 - no valid record
+ */
+int hbnrec_decode(const uint32_t *words, hbn_state_t *st)
+{
+    int ver, len, err;
+
+    memset(st, 0, sizeof(*st));
+    if (words[0] == HBN_CODE_VERIFY)
+    {
+        ver = 1;
+        err = decode_v1(words, st);
+    }
+    else
+    {
+        ver = (words[0] >> 8) & 0xff;
+        len = words[0] & 0xff;
+        if ((words[0] >> 16) != HBN_MAGIC || len + 2 > HBN_WORDS ||
+            words[len + 1] != crc32_words(words, len + 1))
+            return -1;
+        switch (ver)
+        {
+        case 2:
+            err = decode_v2(words, st);
+            break;
+        case 3:
+            err = decode_v3(words, st);
+            break;
+        default: /* newer than this firmware */
+            err = -1;
+            break;
+        }
+    }
+    if (err || !state_valid(st))
+        return -1;
+    return ver;
+}
+
+/* Load the hibernate data area and its shadow */
+void hbnrec_read(uint32_t *words)
+{
+    HibernateDataGet(shadow, HBN_WORDS);
+    memcpy(words, shadow, sizeof(shadow));
+}
+/* Write the words that differ from the shadow
+ * return: number of words written
+ */
+int hbnrec_write(const uint32_t *words)
+{
+    uint64_t start = hwclock_ticks();
+    int i, n = 0;
+    for (i = 0; i < HBN_WORDS; i++)
+    {
+        if (words[i] == shadow[i])
+            continue;
+        /* Same sequence as HibernateDataSet, one word */
+        HWREG(HIB_DATA + i * 4) = words[i];
+        while (!(HWREG(HIB_CTL) & HIB_CTL_WRC))
+            ;
+        shadow[i] = words[i];
+        n++;
+    }
+    stores++;
+    words_written += n;
+    write_ticks += hwclock_ticks() - start;
+    return n;
+}
+/* Print the write rate and the time saved against full writes and
+ * the former HibernateRTCMatchSet of every second */
+void hbnrec_get_stats()
+{
+    char buf[80];
+    uint32_t sec = (uint32_t)(hwclock_us() / 1000000), min = sec / 60, word_us, saved;
+
+    sprintf(buf, "Hibernate stores %u, words written %u of %u\n",
+            stores, words_written, stores * HBN_WORDS);
+    UARTStringPut((uint8_t *)buf);
+    if (!words_written)
+        return;
+    /* Store time is dominated by the word writes */
+    word_us = (uint32_t)(hwclock_ticks_to_ms(write_ticks * 1000) / words_written);
+    saved = (stores * HBN_WORDS - words_written + sec) * word_us;
+    sprintf(buf, "Writes %u/min, %u us/word, ISR time saved %u ms in %u min\n",
+            min ? words_written / min : words_written, word_us, saved / 1000, min);
+    UARTStringPut((uint8_t *)buf);
+}
@@ -0,0 +1,80 @@
+#ifndef _HBNREC_H
+#define _HBNREC_H
+
+#include "headers.h"
+
+/* Alarm slots kept in hibernate memory */
+#define HBN_ALARM_NUM 4
+
+typedef struct
+{
+    int sec, min, hour;
+    bool enable;
+} hbn_alarm_t;
+
+/* State kept in hibernate memory, independent of the in-memory structs */
+typedef struct
+{
+    uint32_t rtc; /* RTC seconds when stored */
+    int sec, min, hour, mday, month, year;
+    hbn_alarm_t alarms[HBN_ALARM_NUM];
+    int timer_millisec, timer_sec, timer_min;
+    uint32_t cdown_sec[CDOWN_NUM]; /* presets of cd1 ~ cd3 */
+    int snooze_sec;
+    bool flip;
+    int display_mode;
+    uint16_t boot_count;  /* boots with the state restored */
+    uint16_t reset_count; /* of them, not from power-on */
+} hbn_state_t;
+
+/* Record in the 16 hibernate words
+ *   [0]        header: [31:16] HBN_MAGIC, [15:8] version, [7:0] payload words
+ *   [1..len]   payload of the version
+ *   [len + 1]  CRC-32 of words 0..len
+ */
+#define HBN_WORDS 16
+#define HBN_REC_WORDS 11 /* words 0~10 hold the record */
+#define HBN_MAGIC 0x4443
+#define HBN_VERSION 3
+#define HBN_HEADER(ver, len) (((uint32_t)HBN_MAGIC << 16) | ((ver) << 8) | (len))
+
+/* Words 11~15: log of the last boots, see prof.c
+ *   [11]       header: [31:16] HBN_MAGIC, [15:8] boots logged, [7:0] next slot
+ *   [12..15]   HBN_BOOTLOG_NUM boots, one byte per stage */
+#define HBN_BOOTLOG HBN_REC_WORDS
+#define HBN_BOOTLOG_NUM 2
+
+/* Version 3 bit fields */
+#define HBN_EPOCH_BITS 39 /* seconds since -0400-03-01, covers years 0 ~ 9999 */
+#define HBN_TOD_BITS 17   /* second of the day */
+#define HBN_CDOWN_BITS 19 /* up to 99:59:59 */
+#define HBN_DISPLAY_BITS 4
+#define HBN_COUNT_BITS 16
+
+/* Version 1: raw struct copies, recognized by HBN_CODE_VERIFY in word 0 */
+#define HBN_V1_RTC 1
+#define HBN_V1_CLOCK 2
+#define HBN_V1_ALARM 8
+#define HBN_V1_TIMER 11
+
+/* The CRC module of the TM4C129 computes the record CRC, other builds
+ * fall back to Crc32 of sw_crc.c; both give the IEEE CRC-32 */
+#ifdef PART_TM4C1294NCPDT
+#define HBN_HW_CRC 1
+#endif
+
+/* Days since -0400-03-01 of a proleptic Gregorian date and back,
+ * month 0~11; also the reference of the calendar check */
+uint32_t days_from_civil(int year, int month, int mday);
+void civil_from_days(uint32_t days, int *year, int *month, int *mday);
+
+uint32_t crc32_words(const uint32_t *words, int n);
+void hbnrec_encode(const hbn_state_t *st, uint32_t *words);
+int hbnrec_decode(const uint32_t *words, hbn_state_t *st);
+
+/* Hibernate memory access through a shadow copy */
+void hbnrec_read(uint32_t *words);
+int hbnrec_write(const uint32_t *words);
+void hbnrec_get_stats(void);
+
+#endif
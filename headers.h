@@ -20,13 +20,24 @@
 #include "interrupt.h"
 #include "uart.h"
 #include "hw_ints.h"
+#include "hw_hibernate.h"
 #include "pwm.h"
 #include "hibernate.h"
+#include "timer.h"
+#include "eeprom.h"
+#include "crc.h"
+#include "sw_crc.h"
 
 #define SYSTICK_FREQUENCY 1000 // 1000hz
+#define SYSCLOCK_FREQ 20000000    // 20Mhz, the clock booted with
+#define PWM_CLOCK_MAX 20000000    // lowest note within the 16-bit up/down PWM counter
+#define CPU_PROFILE_NUM 4         // 16, 20, 60, 120Mhz
+#define CPU_BURST_MS 2000         // auto profile: fast for this long after activity
 
 #define I2C_FLASHTIME 500  // 500mS
 #define GPIO_FLASHTIME 300 // 300mS
+#define I2C_WAIT_US 2000   // longest wait for the I2C0 master
+#define I2C_CLK_TIMEOUT 0x7d // SCL low timeout, in 16 SCL clocks
 //*****************************************************************************
 //
 // I2C GPIO chip address and resigster define
@@ -61,11 +72,11 @@
             (s)++;                        \
     } while (0);
 
-#define SKIP_CHAR(s)                       \
-    do                                     \
-    {                                      \
-        while (!IS_END(s) && !isdigit(*s)) \
-            (s)++;                         \
+#define SKIP_CHAR(s)                                        \
+    do                                                      \
+    {                                                       \
+        while (!IS_END(s) && !isdigit((unsigned char)*(s))) \
+            (s)++;                                          \
     } while (0);
 
 #define MAXLINE 256
@@ -93,20 +104,27 @@
 #define BUTTON_ID_ENABLE 4
 #define BUTTON_ID_FLIP 3
 
-/* Define Hibernation data storage index */
-#define HBN_VERIFY 0
-#define HBN_RTC 1
-#define HBN_CLOCK 2
-#define HBN_ALARM 8
-#define HBN_TIMER 11
+/* Number of hardware-timed countdowns, "cd1" ~ "cd3" */
+#define CDOWN_NUM 3
 
-/* Define inner timer id */
-#define INNERTIMER_GENERAL 0
-#define INNERTIMER_BUZZER 1
-#define INNERTIMER_ALARM 2
-#define INNERTIMER_TIMER 3
+/* Routines timed by the bench command */
+#define BENCH_NUM 14
 
-/* Define verify code */
+/* Define ringing source id */
+#define RING_SRC_ALARM 0
+#define RING_SRC_TIMER 1
+#define RING_SRC_CDOWN 2 /* first of CDOWN_NUM sources */
+#define RING_SRC_NUM (RING_SRC_CDOWN + CDOWN_NUM)
+
+/* Define ringing state */
+#define RING_IDLE 0
+#define RING_ACTIVE 1
+#define RING_SNOOZED 2
+
+/* Default snooze duration(s) */
+#define RING_SNOOZE_DEFAULT 300
+
+/* Define verify code of version 1 hibernate records */
 #define HBN_CODE_VERIFY 21911101
 
 /* Pitch frequecy(Hz) */
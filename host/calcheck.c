@@ -0,0 +1,156 @@
+/*
+ * Calendar properties of the clock over years 0~9999, on every host
+ * build.
+ *
+ *   calcheck [-j threads] [from to]
+ *
+ * The checks of the clock methods are those of calcheck.c, which the
+ * calcheck command runs on the board. Here, for every day, the
+ * references of calcheck.c are checked in turn against timegm / gmtime_r
+ * of the C library, proleptic Gregorian like the clock: they agree on
+ * the date, the day of the year and the days of every month.
+ *
+ * Years are handed out to the threads a block at a time. The output is
+ * that of the calcheck command: calcheck,<from>,<to>,<days>,<failures>,<days/s>
+ */
+
+/* Only main.c has a timer_t of its own */
+#undef __timer_t_defined
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include "headers.h"
+#include "hbnrec.h"
+#include "calcheck.h"
+
+#define CAL_BLOCK 100 /* years handed out at a time */
+#define CAL_REPORT 8  /* failures printed */
+
+static int cal_from = 0, cal_to = 9999, cal_next;
+static uint32_t cal_days, cal_fails;
+static pthread_mutex_t cal_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void cal_fail(const char *what, int year, int month, int mday, int arg)
+{
+    pthread_mutex_lock(&cal_lock);
+    if (cal_fails++ < CAL_REPORT)
+        printf("calcheck,fail,%s,%04d-%02d-%02d,%d\n", what, year, month + 1, mday, arg);
+    pthread_mutex_unlock(&cal_lock);
+}
+
+/* Seconds since 1970 of a day number of hbnrec.c */
+static time_t ref_epoch(uint32_t days)
+{
+    return ((time_t)days - days_from_civil(1970, MONTH_JAN, 1)) * 86400;
+}
+/* true - the C library has the day as the given date */
+static bool ref_libc(uint32_t days, int year, int month, int mday, int yday)
+{
+    struct tm tm;
+    time_t t = ref_epoch(days);
+
+    memset(&tm, 0, sizeof(tm));
+    tm.tm_year = year - 1900, tm.tm_mon = month, tm.tm_mday = mday;
+    if (timegm(&tm) != t || !gmtime_r(&t, &tm))
+        return false;
+    return tm.tm_year == year - 1900 && tm.tm_mon == month && tm.tm_mday == mday &&
+           tm.tm_yday == yday;
+}
+/* Days of a month as the C library counts them, day 0 of the next */
+static int libc_mdays(int month, int year)
+{
+    struct tm tm;
+    time_t t;
+
+    memset(&tm, 0, sizeof(tm));
+    tm.tm_year = year - 1900, tm.tm_mon = month + 1, tm.tm_mday = 0;
+    t = timegm(&tm);
+    gmtime_r(&t, &tm);
+    return tm.tm_mday;
+}
+
+/* The references against the C library, every day of the years from ~ to */
+static void cal_refs(int from, int to)
+{
+    uint32_t d, end;
+    int year, month, mday, m;
+
+    end = days_from_civil(to + 1, MONTH_JAN, 1);
+    for (d = days_from_civil(from, MONTH_JAN, 1); d < end; d++)
+    {
+        civil_from_days(d, &year, &month, &mday);
+        if (days_from_civil(year, month, mday) != d ||
+            !ref_libc(d, year, month, mday, d - days_from_civil(year, MONTH_JAN, 1)))
+            cal_fail("reference", year, month, mday, 0);
+        if (mday == 1 && month == MONTH_JAN)
+            for (m = 0; m <= MONTH_DEC; m++)
+                if (calcheck_mdays(m, year) != libc_mdays(m, year))
+                    cal_fail("month_days", year, m, 1, calcheck_mdays(m, year));
+    }
+}
+static void *cal_thread(void *arg)
+{
+    calcheck_t cc;
+    int from, to;
+    uint32_t n;
+
+    calcheck_begin(&cc, cal_fail);
+    for (;;)
+    {
+        pthread_mutex_lock(&cal_lock);
+        from = cal_next;
+        cal_next += CAL_BLOCK;
+        pthread_mutex_unlock(&cal_lock);
+        if (from > cal_to)
+            return NULL;
+        to = from + CAL_BLOCK - 1 < cal_to ? from + CAL_BLOCK - 1 : cal_to;
+        cal_refs(from, to);
+        n = calcheck_years(&cc, from, to);
+        pthread_mutex_lock(&cal_lock);
+        cal_days += n;
+        pthread_mutex_unlock(&cal_lock);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    pthread_t threads[64];
+    struct timespec t0, t1;
+    double s;
+    int i, n = (int)sysconf(_SC_NPROCESSORS_ONLN), opt;
+
+    while ((opt = getopt(argc, argv, "j:")) != -1)
+    {
+        if (opt != 'j')
+        {
+            fprintf(stderr, "Usage: calcheck [-j threads] [from to]\n");
+            return 2;
+        }
+        n = atoi(optarg);
+    }
+    if (argc - optind == 2)
+        cal_from = atoi(argv[optind]), cal_to = atoi(argv[optind + 1]);
+    if ((argc - optind != 0 && argc - optind != 2) || cal_from < 0 || cal_to > 9999 ||
+        cal_from > cal_to)
+    {
+        fprintf(stderr, "Usage: calcheck [-j threads] [from to]\n");
+        return 2;
+    }
+    if (n < 1)
+        n = 1;
+    if (n > 64)
+        n = 64;
+
+    cal_next = cal_from;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (i = 0; i < n; i++)
+        pthread_create(&threads[i], NULL, cal_thread, NULL);
+    for (i = 0; i < n; i++)
+        pthread_join(threads[i], NULL);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    s = t1.tv_sec - t0.tv_sec + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+
+    printf("calcheck,%d,%d,%u,%u,%u\n", cal_from, cal_to, cal_days, cal_fails,
+           s > 0 ? (uint32_t)(cal_days / s) : 0);
+    return cal_fails != 0;
+}
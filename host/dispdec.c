@@ -0,0 +1,64 @@
+/*
+ * Display trace decoder on the host: the records printed by disp dump,
+ * taken from a serial log, are replayed with disptrace_replay of
+ * disptrace.c and printed as disp decode prints them on the board.
+ *
+ *   dispdec [-f] [log]
+ *
+ *   -f   the display is flipped (flip on the board)
+ *
+ * Lines of the log other than disptrace,... are skipped, so a whole
+ * terminal capture will do; the last dump in it is decoded. The clock
+ * of the cycle counts is that of the disptrace,clock line.
+ */
+
+#include "headers.h"
+#include "disptrace.h"
+#include "fake.h"
+
+int main(int argc, char **argv)
+{
+    static disptrace_rec_t recs[DISPTRACE_SIZE];
+    static disptrace_result_t res;
+    char line[256];
+    unsigned cycles, reg, val, clock = 0;
+    bool flip = false;
+    int n = 0, arg = 1;
+    FILE *f = stdin;
+
+    if (arg < argc && !strcmp(argv[arg], "-f"))
+        flip = true, arg++;
+    if (arg < argc - 1 || (arg < argc && !(f = fopen(argv[arg], "r"))))
+    {
+        if (arg < argc - 1)
+            fprintf(stderr, "Usage: dispdec [-f] [log]\n");
+        else
+            perror(argv[arg]);
+        return 2;
+    }
+    while (fgets(line, sizeof(line), f))
+    {
+        if (sscanf(line, "disptrace,clock,%u", &clock) == 1)
+            n = 0;
+        else if (sscanf(line, "disptrace,%u,%u,%u", &cycles, &reg, &val) == 3 &&
+                 n < DISPTRACE_SIZE)
+        {
+            recs[n].cycles = cycles;
+            recs[n].reg = reg;
+            recs[n].val = val;
+            n++;
+        }
+    }
+    if (f != stdin)
+        fclose(f);
+    if (!clock || disptrace_replay(recs, n, flip, &res) < 0)
+    {
+        fprintf(stderr, "dispdec: no disp dump in the log\n");
+        return 1;
+    }
+
+    fake_init();
+    fake_uart_echo(1);
+    disptrace_print(&res, clock);
+    return 0;
+}
@@ -0,0 +1,486 @@
+/*
+ * Virtual time, interrupts, SysTick, the system clock and the core
+ * registers the firmware writes through HWREG.
+ *
+ * The NVIC is modelled for the five interrupts the clock uses. They are
+ * taken between driverlib calls, by priority as on the Cortex-M4: only
+ * one of a higher priority preempts a running handler, and of those
+ * pending at once the lower exception number goes first. A SysTick that
+ * comes round again while still pending is lost, as on the chip.
+ *
+ * HWREG hands out a slot per register; a value the firmware stored in a
+ * slot is taken up at the next call into the fakes, so a store takes
+ * effect before anything else happens.
+ */
+
+/* Only main.c has a timer_t of its own */
+#undef __timer_t_defined
+#include <time.h>
+#include "headers.h"
+#include "initialize.h"
+#include "hw_nvic.h"
+#include "prof.h"
+#include "fake.h"
+
+void SysTick_Handler(void);
+void TIMER0A_Handler(void);
+void TIMER1A_Handler(void);
+void FLASH_Handler(void);
+void UART0_Handler(void);
+
+uint64_t fake_vt, fake_cycles;
+uint64_t fake_systick_vt;
+uint32_t fake_systick_irqs;
+
+/* The PIOSC out of reset */
+static uint32_t sysclk = 16000000, vt_cycle = VT_HZ / 16000000;
+
+/* The hook may call into the firmware, nothing preempts it */
+static void (*hook_fn)(void);
+static uint64_t hook_vt = UINT64_MAX;
+static bool in_hook;
+
+/* ================================================================
+ * Interrupts
+ * ================================================================ */
+enum
+{
+    IRQ_SYSTICK,
+    IRQ_TIMER0A,
+    IRQ_TIMER1A,
+    IRQ_FLASH,
+    IRQ_UART0,
+    IRQ_NUM
+};
+static const uint32_t irq_ints[IRQ_NUM] = {FAULT_SYSTICK, INT_TIMER0A, INT_TIMER1A, INT_FLASH,
+                                           INT_UART0};
+static void (*const irq_handlers[IRQ_NUM])(void) = {SysTick_Handler, TIMER0A_Handler,
+                                                    TIMER1A_Handler, FLASH_Handler, UART0_Handler};
+static uint8_t irq_prio[IRQ_NUM]; /* as written, 3 bits implemented */
+static bool irq_enabled[IRQ_NUM];
+static bool irq_set[IRQ_NUM]; /* by IntPendSet, until taken */
+static uint32_t prio_group;
+static bool primask;
+static int running_prio = 0x100; /* thread mode */
+
+/* SysTick, counting down to 0 at cycle st_next, held at st_held while
+ * stopped */
+static bool st_on, st_int, st_pending;
+static uint32_t st_load, st_held;
+static uint64_t st_next;
+
+static int irq_find(uint32_t n)
+{
+    int i;
+    for (i = 0; i < IRQ_NUM; i++)
+        if (irq_ints[i] == n)
+            return i;
+    return -1;
+}
+static bool irq_pending(int i)
+{
+    if (irq_set[i])
+        return true;
+    switch (i)
+    {
+    case IRQ_SYSTICK:
+        return st_pending;
+    case IRQ_TIMER0A:
+        return fake_timer_irq(0);
+    case IRQ_TIMER1A:
+        return fake_timer_irq(1);
+    case IRQ_FLASH:
+        return fake_eeprom_irq();
+    default:
+        return fake_uart_irq();
+    }
+}
+/* Take the pending interrupts that preempt what is running */
+static void irq_deliver(void)
+{
+    int i, best, prio;
+    while (!primask && !in_hook)
+    {
+        best = -1;
+        for (i = 0; i < IRQ_NUM; i++)
+            if ((i == IRQ_SYSTICK || irq_enabled[i]) && (irq_prio[i] >> 5) < running_prio &&
+                irq_pending(i) && (best < 0 || irq_prio[i] >> 5 < irq_prio[best] >> 5))
+                best = i;
+        if (best < 0)
+            return;
+        prio = running_prio;
+        running_prio = irq_prio[best] >> 5;
+        irq_set[best] = false;
+        if (best == IRQ_SYSTICK)
+        {
+            st_pending = false;
+            fake_systick_irqs++;
+        }
+        fake_run(12); /* exception entry */
+        irq_handlers[best]();
+        running_prio = prio;
+    }
+}
+
+/* ================================================================
+ * Virtual time
+ * ================================================================ */
+uint64_t fake_cycles_to_vt(uint64_t cycles)
+{
+    return cycles > fake_cycles ? fake_vt + (cycles - fake_cycles) * vt_cycle : fake_vt;
+}
+uint32_t fake_sysclk(void)
+{
+    return sysclk;
+}
+static uint64_t next_event(void)
+{
+    uint64_t t = hook_vt, e;
+    if (st_on && (e = fake_cycles_to_vt(st_next)) < t)
+        t = e;
+    if ((e = fake_timer_next()) < t)
+        t = e;
+    if ((e = fake_uart_next()) < t)
+        t = e;
+    if ((e = fake_eeprom_next()) < t)
+        t = e;
+    return t;
+}
+static void events(void)
+{
+    while (st_on && fake_cycles >= st_next)
+    {
+        if (st_int)
+            st_pending = true;
+        st_next += (uint64_t)st_load + 1;
+    }
+    fake_timer_event();
+    fake_uart_event();
+    fake_eeprom_event();
+    if (hook_fn && fake_vt >= hook_vt)
+    {
+        hook_vt = UINT64_MAX;
+        in_hook = true;
+        hook_fn();
+        in_hook = false;
+    }
+}
+void fake_run_until(uint64_t end)
+{
+    uint64_t next, n;
+    while (fake_vt < end)
+    {
+        next = next_event();
+        if (next > end)
+            next = end;
+        n = next > fake_vt ? (next - fake_vt + vt_cycle - 1) / vt_cycle : 1;
+        fake_cycles += n;
+        fake_vt += n * vt_cycle;
+        events();
+        irq_deliver();
+    }
+}
+void fake_run(uint64_t cycles)
+{
+    fake_run_until(fake_vt + cycles * vt_cycle);
+}
+void fake_hook(void (*fn)(void))
+{
+    hook_fn = fn;
+}
+void fake_hook_at(uint64_t vt)
+{
+    hook_vt = vt;
+}
+
+/* ================================================================
+ * Core registers
+ * ================================================================ */
+static uint32_t reg_demcr, reg_dwt_ctrl, reg_cyccnt, reg_int_ctrl, reg_st_current, reg_hib_ctl;
+static uint32_t shown_cyccnt, shown_int_ctrl, shown_st_current;
+static uint64_t dwt_base;
+static bool dwt_host;
+
+static uint32_t st_value(void)
+{
+    if (!st_on)
+        return st_held;
+    return st_next > fake_cycles ? (uint32_t)(st_next - fake_cycles) : 0;
+}
+static uint32_t dwt_now(void)
+{
+    if (dwt_host)
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        return (uint32_t)__builtin_ia32_rdtsc();
+#else
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint32_t)(ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+#endif
+    }
+    return (uint32_t)(fake_cycles - dwt_base);
+}
+void fake_dwt_host(bool on)
+{
+    dwt_host = on;
+}
+/* Take up what the firmware stored in the slots since the last call */
+static void hw_sync(void)
+{
+    if (reg_cyccnt != shown_cyccnt)
+    {
+        dwt_base = fake_cycles - reg_cyccnt;
+        shown_cyccnt = reg_cyccnt;
+    }
+    if (reg_int_ctrl != shown_int_ctrl)
+    {
+        if (reg_int_ctrl & NVIC_INT_CTRL_PENDSTCLR)
+            st_pending = false;
+        if (reg_int_ctrl & NVIC_INT_CTRL_PENDSTSET)
+            st_pending = true;
+        shown_int_ctrl = reg_int_ctrl;
+    }
+    if (reg_st_current != shown_st_current)
+    {
+        /* Cleared, reloaded on the next cycle */
+        if (st_on)
+            st_next = fake_cycles + st_load + 1;
+        st_held = 0;
+        shown_st_current = reg_st_current;
+    }
+}
+volatile uint32_t *fake_hwreg(uint32_t addr)
+{
+    hw_sync();
+    switch (addr)
+    {
+    case DEMCR:
+        return &reg_demcr;
+    case DWT_CTRL:
+        return &reg_dwt_ctrl;
+    case DWT_CYCCNT:
+        fake_run(FAKE_DWT_CYCLES);
+        reg_cyccnt = shown_cyccnt = dwt_now();
+        return &reg_cyccnt;
+    case NVIC_INT_CTRL:
+        reg_int_ctrl = shown_int_ctrl = st_pending ? NVIC_INT_CTRL_PENDSTSET : 0;
+        return &reg_int_ctrl;
+    case NVIC_ST_CURRENT:
+        reg_st_current = shown_st_current = st_value();
+        return &reg_st_current;
+    case HIB_CTL:
+        fake_hib_ctl();
+        reg_hib_ctl = HIB_CTL_WRC | HIB_CTL_CLK32EN | HIB_CTL_RTCEN;
+        return &reg_hib_ctl;
+    }
+    if (addr >= HIB_DATA && addr < HIB_DATA + 16 * 4 && !(addr & 3))
+        return fake_hib_data((addr - HIB_DATA) / 4);
+    fprintf(stderr, "fake: register 0x%08x is not modelled\n", addr);
+    abort();
+}
+
+/* Every driverlib call */
+void fake_charge(void)
+{
+    hw_sync();
+    fake_run(FAKE_CALL_CYCLES);
+}
+
+void fake_init(void)
+{
+    fake_vt = fake_cycles = 0;
+    sysclk = 16000000, vt_cycle = VT_HZ / sysclk;
+}
+
+/* ================================================================
+ * Interrupt controller
+ * ================================================================ */
+bool IntMasterDisable(void)
+{
+    bool was = primask;
+    fake_charge();
+    primask = true;
+    return was;
+}
+bool IntMasterEnable(void)
+{
+    bool was = primask;
+    primask = false;
+    fake_charge();
+    return was;
+}
+void IntEnable(uint32_t n)
+{
+    int i = irq_find(n);
+    fake_charge();
+    if (i < 0)
+    {
+        fprintf(stderr, "fake: interrupt %u is not modelled\n", n);
+        abort();
+    }
+    irq_enabled[i] = true;
+}
+void IntDisable(uint32_t n)
+{
+    int i = irq_find(n);
+    fake_charge();
+    if (i >= 0)
+        irq_enabled[i] = false;
+}
+void IntPendSet(uint32_t n)
+{
+    int i = irq_find(n);
+    fake_charge();
+    if (i >= 0)
+        irq_set[i] = true;
+}
+void IntPendClear(uint32_t n)
+{
+    int i = irq_find(n);
+    fake_charge();
+    if (i >= 0)
+        irq_set[i] = false;
+}
+void IntPrioritySet(uint32_t n, uint8_t prio)
+{
+    int i = irq_find(n);
+    fake_charge();
+    if (i >= 0)
+        irq_prio[i] = prio & 0xe0;
+}
+int32_t IntPriorityGet(uint32_t n)
+{
+    int i = irq_find(n);
+    fake_charge();
+    return i >= 0 ? irq_prio[i] : -1;
+}
+void IntPriorityGroupingSet(uint32_t bits)
+{
+    fake_charge();
+    prio_group = bits;
+}
+uint32_t IntPriorityGroupingGet(void)
+{
+    fake_charge();
+    return prio_group;
+}
+uint32_t IntPriorityMaskGet(void)
+{
+    fake_charge();
+    return 0;
+}
+
+/* ================================================================
+ * SysTick
+ * ================================================================ */
+void SysTickEnable(void)
+{
+    fake_charge();
+    if (!st_on)
+    {
+        /* From where it was stopped, 0 reloads first */
+        st_on = true;
+        st_next = fake_cycles + (st_held ? st_held : st_load + 1);
+        if (!fake_systick_vt)
+            fake_systick_vt = fake_vt;
+    }
+}
+void SysTickDisable(void)
+{
+    fake_charge();
+    st_held = st_value();
+    st_on = false;
+}
+void SysTickIntEnable(void)
+{
+    fake_charge();
+    st_int = true;
+}
+void SysTickIntDisable(void)
+{
+    fake_charge();
+    st_int = false;
+}
+void SysTickPeriodSet(uint32_t period)
+{
+    fake_charge();
+    st_load = period - 1;
+}
+uint32_t SysTickPeriodGet(void)
+{
+    fake_charge();
+    return st_load + 1;
+}
+uint32_t SysTickValueGet(void)
+{
+    fake_charge();
+    return st_value();
+}
+
+/* ================================================================
+ * System control
+ * ================================================================ */
+#define PLL_LOCK_US 300
+static uint32_t reset_cause = SYSCTL_CAUSE_POR;
+
+uint32_t SysCtlClockFreqSet(uint32_t cfg, uint32_t freq)
+{
+    uint32_t got, div;
+    fake_charge();
+    if ((cfg & SYSCTL_USE_OSC) == SYSCTL_USE_OSC)
+        div = (16000000 + freq - 1) / freq, got = 16000000 / div;
+    else if (freq > 120000000)
+        return 0;
+    else
+        div = (480000000 + freq - 1) / freq, got = 480000000 / div;
+    if (!freq || div > 1024 || VT_HZ % got)
+        return 0;
+    /* Runs from the PIOSC while the PLL locks */
+    sysclk = 16000000, vt_cycle = VT_HZ / sysclk;
+    fake_run_until(fake_vt + VT_US((cfg & SYSCTL_USE_OSC) == SYSCTL_USE_OSC ? 2 : PLL_LOCK_US));
+    sysclk = got, vt_cycle = VT_HZ / sysclk;
+    return got;
+}
+uint32_t SysCtlClockGet(void)
+{
+    fake_charge();
+    return sysclk;
+}
+void SysCtlPeripheralEnable(uint32_t periph)
+{
+    fake_charge();
+}
+bool SysCtlPeripheralReady(uint32_t periph)
+{
+    fake_charge();
+    return true;
+}
+uint32_t SysCtlResetCauseGet(void)
+{
+    fake_charge();
+    return reset_cause;
+}
+void SysCtlResetCauseClear(uint32_t causes)
+{
+    fake_charge();
+    reset_cause &= ~causes;
+}
+
+/* ================================================================
+ * Busy waits of the firmware
+ * ================================================================ */
+/* Delay of initialize.c, weakened in its object file */
+void Delay(uint32_t value)
+{
+    fake_charge();
+    fake_run((uint64_t)value * ui32SysClock / SYSCLOCK_FREQ * FAKE_DELAY_LOOP_CYCLES);
+}
+
+/* delay_ms polls a wheel timer and nothing else */
+bool __real_twheel_pending(int h);
+bool __wrap_twheel_pending(int h)
+{
+    fake_charge();
+    return __real_twheel_pending(h);
+}
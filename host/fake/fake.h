@@ -0,0 +1,97 @@
+/*
+ * Host stand-in for driverlib and the board.
+ *
+ * Time is virtual. The CPU costs nothing between driverlib calls; every
+ * call charges FAKE_CALL_CYCLES at the system clock and the busy waits of
+ * the firmware on the UART, I2C, hibernate and wheel timers move the time
+ * on to when the wait would end. Interrupts are delivered at those points,
+ * by priority and only while unmasked, so a run is the same every time.
+ *
+ * Time is kept in 1/VT_HZ s, a whole number of cycles at every system
+ * clock profile. SysTick, Timer0, Timer1 and the DWT count cycles; the
+ * UART, the I2C bus, the EEPROM and the hibernate RTC run in real time.
+ */
+
+#ifndef _FAKE_H
+#define _FAKE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define VT_HZ 240000000ULL /* 16, 20, 60 and 120MHz all divide it */
+#define VT_US(us) ((uint64_t)(us) * (VT_HZ / 1000000))
+#define VT_MS(ms) ((uint64_t)(ms) * (VT_HZ / 1000))
+
+/* Cycles charged for a driverlib call, and for a DWT read */
+#define FAKE_CALL_CYCLES 16
+#define FAKE_DWT_CYCLES 4
+
+/* Cycles an iteration of the Delay loop */
+#define FAKE_DELAY_LOOP_CYCLES 4
+
+/* Time and cycles since power up */
+extern uint64_t fake_vt, fake_cycles;
+
+void fake_init(void);
+
+/* Busy for some cycles of the system clock or until a time */
+void fake_run(uint64_t cycles);
+void fake_run_until(uint64_t vt);
+
+/* fn is called once the time reaches the last fake_hook_at, from any
+ * point the firmware calls in; it may call fake_hook_at again */
+void fake_hook(void (*fn)(void));
+void fake_hook_at(uint64_t vt);
+
+/* The DWT counts the host time stamp counter instead, for benches */
+void fake_dwt_host(bool on);
+
+/* Time SysTick was first started and the count of its interrupts taken */
+extern uint64_t fake_systick_vt;
+extern uint32_t fake_systick_irqs;
+
+/* Serial port: bytes to receive at 115200 baud after those queued,
+ * and everything sent, optionally echoed to a file */
+void fake_uart_rx(const char *s, int n);
+int fake_uart_rx_queued(void);
+const char *fake_uart_tx(int *len);
+void fake_uart_echo(int fd);
+extern uint32_t fake_uart_overruns;
+
+/* Panel: buttons held on TCA6424 port 0, bits of BUTTON_ID_*, and USR0 */
+void fake_buttons(uint8_t down);
+void fake_usr0(bool down);
+
+/* Segments lit on every digit, left to right, dark digits 0; a digit is
+ * lit if it was selected within the last FAKE_PANEL_MS */
+#define FAKE_PANEL_MS 30
+void fake_panel(uint8_t seg[8]);
+uint8_t fake_leds(void);
+uint32_t fake_i2c_transactions(void);
+
+/* Buzzer: PWM output 7 on or off, and its frequency */
+bool fake_buzzer(uint32_t *hz);
+
+/* EEPROM kept in a file across runs */
+void fake_eeprom_file(const char *path);
+
+/* Crystal error of the hibernate RTC, fast is positive */
+void fake_rtc_ppb(int32_t ppb);
+
+/* Driverlib fakes of each block, for core.c */
+void fake_uart_event(void);
+uint64_t fake_uart_next(void);
+bool fake_uart_irq(void);
+void fake_timer_event(void);
+uint64_t fake_timer_next(void);
+bool fake_timer_irq(int n);
+void fake_eeprom_event(void);
+uint64_t fake_eeprom_next(void);
+bool fake_eeprom_irq(void);
+volatile uint32_t *fake_hib_data(int i);
+void fake_hib_ctl(void);
+uint64_t fake_cycles_to_vt(uint64_t cycles);
+uint32_t fake_sysclk(void);
+void fake_charge(void);
+
+#endif
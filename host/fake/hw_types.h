@@ -0,0 +1,21 @@
+/*
+ * Host hw_types.h, found before inc/hw_types.h.
+ *
+ * Register accesses of the firmware go through fake_hwreg, which
+ * returns a slot of the fake hardware; see fake/core.c for the
+ * registers modelled.
+ */
+
+#ifndef __HW_TYPES_H__
+#define __HW_TYPES_H__
+
+#include <stdint.h>
+
+/* hibernate.h takes struct tm, time.h is left out for the global clock */
+struct tm;
+
+volatile uint32_t *fake_hwreg(uint32_t addr);
+
+#define HWREG(x) (*fake_hwreg((uint32_t)(x)))
+
+#endif // __HW_TYPES_H__
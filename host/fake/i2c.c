@@ -0,0 +1,191 @@
+/*
+ * I2C0 master at 400kHz with the TCA6424 and PCA9557 of the board.
+ *
+ * A command takes the bus for its bits at 2.5us each and is answered at
+ * once; the master reads busy until the bits are out. Other addresses
+ * are not acknowledged.
+ *
+ * TCA6424: port 0 reads the panel buttons, low while held; port 1 drives
+ * the segments and port 2 selects a digit, bit 0 the leftmost. Every
+ * select with segments is kept with its time, which is what the eye
+ * sees of the multiplexed display. PCA9557: the eight LEDs, lit low.
+ */
+
+#include "headers.h"
+#include "fake.h"
+
+#define I2C_BIT_VT (VT_US(5) / 2)
+
+/* Registers 0x00 ~ 0x0e of the TCA6424, 0x00 ~ 0x03 of the PCA9557 */
+static uint8_t tca[0x10], tca_ptr, pca[4] = {0xff, 0xff, 0xf0, 0xff}, pca_ptr;
+static uint8_t buttons;
+
+static uint8_t slave, mdr;
+static bool receive, enabled;
+static uint32_t err, transactions;
+static uint64_t busy_until;
+
+/* Segments shown on every digit and when */
+static uint8_t lit_seg[8];
+static uint64_t lit_at[8];
+
+void fake_buttons(uint8_t down)
+{
+    buttons = down;
+}
+void fake_panel(uint8_t seg[8])
+{
+    int i;
+    for (i = 0; i < 8; i++)
+        seg[i] = lit_at[i] && fake_vt - lit_at[i] < VT_MS(FAKE_PANEL_MS) ? lit_seg[i] : 0;
+}
+uint8_t fake_leds(void)
+{
+    return (uint8_t)~pca[PCA9557_OUTPUT];
+}
+uint32_t fake_i2c_transactions(void)
+{
+    return transactions;
+}
+
+/* A digit lights while selected, with the segments of that moment */
+static void panel_update(void)
+{
+    int i;
+    for (i = 0; i < 8; i++)
+        if (tca[TCA6424_OUTPUT_PORT2] & (1 << i))
+        {
+            lit_seg[i] = tca[TCA6424_OUTPUT_PORT1];
+            lit_at[i] = fake_vt;
+        }
+}
+static bool slave_write(uint8_t reg, uint8_t v)
+{
+    if (slave == TCA6424_I2CADDR)
+    {
+        reg &= 0x7f; /* auto-increment flag */
+        if (reg >= TCA6424_OUTPUT_PORT0 && reg <= TCA6424_CONFIG_PORT2)
+            tca[reg] = v;
+        panel_update();
+        return true;
+    }
+    if (slave == PCA9557_I2CADDR)
+    {
+        if (reg && reg < 4)
+            pca[reg] = v;
+        return true;
+    }
+    return false;
+}
+static uint8_t slave_read(void)
+{
+    if (slave == TCA6424_I2CADDR)
+    {
+        uint8_t reg = tca_ptr & 0x7f;
+        if (reg == TCA6424_INPUT_PORT0)
+            return (uint8_t)~buttons;
+        if (reg <= TCA6424_INPUT_PORT2)
+            return tca[reg + TCA6424_OUTPUT_PORT0];
+        return tca[reg];
+    }
+    return pca_ptr == PCA9557_INPUT ? pca[PCA9557_OUTPUT] : pca[pca_ptr & 3];
+}
+static bool slave_present(void)
+{
+    return slave == TCA6424_I2CADDR || slave == PCA9557_I2CADDR;
+}
+
+void I2CMasterInitExpClk(uint32_t base, uint32_t clk, bool fast)
+{
+    fake_charge();
+}
+void I2CMasterTimeoutSet(uint32_t base, uint32_t value)
+{
+    fake_charge();
+}
+void I2CMasterEnable(uint32_t base)
+{
+    fake_charge();
+    enabled = true;
+}
+void I2CMasterDisable(uint32_t base)
+{
+    fake_charge();
+    enabled = false;
+}
+void I2CMasterSlaveAddrSet(uint32_t base, uint8_t addr, bool rx)
+{
+    fake_charge();
+    slave = addr, receive = rx;
+}
+void I2CMasterDataPut(uint32_t base, uint8_t data)
+{
+    fake_charge();
+    mdr = data;
+}
+uint32_t I2CMasterDataGet(uint32_t base)
+{
+    fake_charge();
+    return mdr;
+}
+void I2CMasterControl(uint32_t base, uint32_t cmd)
+{
+    int bits = 0;
+    fake_charge();
+    if (!enabled)
+        return;
+    err = 0;
+    transactions++;
+    switch (cmd)
+    {
+    case I2C_MASTER_CMD_BURST_SEND_START: /* start, address, register */
+        bits = 19;
+        if (!slave_present())
+            err = I2C_MASTER_ERR_ADDR_ACK, bits = 10;
+        else if (slave == TCA6424_I2CADDR)
+            tca_ptr = mdr;
+        else
+            pca_ptr = mdr;
+        break;
+    case I2C_MASTER_CMD_BURST_SEND_FINISH: /* data, stop */
+        bits = 10;
+        if (!slave_write(slave == TCA6424_I2CADDR ? tca_ptr : pca_ptr, mdr))
+            err = I2C_MASTER_ERR_DATA_ACK;
+        break;
+    case I2C_MASTER_CMD_BURST_SEND_ERROR_STOP:
+        bits = 1;
+        break;
+    case I2C_MASTER_CMD_SINGLE_SEND: /* start, address, byte, stop either way */
+        bits = 20;
+        if (!slave_present())
+            err = I2C_MASTER_ERR_ADDR_ACK, bits = 11;
+        else if (receive)
+            mdr = slave_read();
+        else if (slave == TCA6424_I2CADDR)
+            tca_ptr = mdr;
+        else
+            pca_ptr = mdr;
+        break;
+    default:
+        fprintf(stderr, "fake: I2C command 0x%x is not modelled\n", cmd);
+        abort();
+    }
+    busy_until = fake_vt + bits * I2C_BIT_VT;
+}
+uint32_t I2CMasterErr(uint32_t base)
+{
+    fake_charge();
+    return fake_vt < busy_until ? 0 : err;
+}
+/* Only polled until it clears, so the wait is taken at once */
+bool I2CMasterBusy(uint32_t base)
+{
+    fake_charge();
+    if (fake_vt < busy_until)
+        fake_run_until(busy_until);
+    return fake_vt < busy_until;
+}
+bool I2CMasterBusBusy(uint32_t base)
+{
+    return I2CMasterBusy(base);
+}
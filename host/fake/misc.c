@@ -0,0 +1,483 @@
+/*
+ * GPIO, PWM, Timer0/1, hibernate, EEPROM and CRC.
+ *
+ * Timer0 counts cycles up from its start, Timer1 runs one-shots down.
+ * The hibernate RTC runs from VT at 32768Hz, off by the crystal error
+ * and slowed by the trim. The EEPROM takes EEPROM_WORD_US to program a
+ * word and raises its interrupt when done. The CRC module computes the
+ * configuration the firmware uses bit by bit, independent of sw_crc.c.
+ */
+
+#include <math.h>
+#include "headers.h"
+#include "fake.h"
+
+/* ================================================================
+ * GPIO and PWM
+ * ================================================================ */
+static bool usr0, pwm_on;
+static uint32_t pwm_div = 1, pwm_period;
+
+void fake_usr0(bool down)
+{
+    usr0 = down;
+}
+bool fake_buzzer(uint32_t *hz)
+{
+    if (hz)
+        *hz = pwm_period ? fake_sysclk() / pwm_div / pwm_period : 0;
+    return pwm_on;
+}
+
+void GPIOPinConfigure(uint32_t config)
+{
+    fake_charge();
+}
+void GPIOPinTypeGPIOInput(uint32_t port, uint8_t pins)
+{
+    fake_charge();
+}
+void GPIOPinTypeGPIOOutput(uint32_t port, uint8_t pins)
+{
+    fake_charge();
+}
+void GPIOPinTypeGPIOOutputOD(uint32_t port, uint8_t pins)
+{
+    fake_charge();
+}
+void GPIOPinTypeUART(uint32_t port, uint8_t pins)
+{
+    fake_charge();
+}
+void GPIOPinTypeI2C(uint32_t port, uint8_t pins)
+{
+    fake_charge();
+}
+void GPIOPinTypeI2CSCL(uint32_t port, uint8_t pins)
+{
+    fake_charge();
+}
+void GPIOPinTypePWM(uint32_t port, uint8_t pins)
+{
+    fake_charge();
+}
+void GPIOPadConfigSet(uint32_t port, uint8_t pins, uint32_t strength, uint32_t type)
+{
+    fake_charge();
+}
+void GPIOPinWrite(uint32_t port, uint8_t pins, uint8_t val)
+{
+    fake_charge();
+}
+/* USR0 on PJ0 is low while held, the released I2C lines read high */
+int32_t GPIOPinRead(uint32_t port, uint8_t pins)
+{
+    fake_charge();
+    if (port == GPIO_PORTJ_BASE)
+        return pins & ~(usr0 ? GPIO_PIN_0 : 0);
+    return pins;
+}
+
+void PWMClockSet(uint32_t base, uint32_t config)
+{
+    fake_charge();
+    pwm_div = config == PWM_SYSCLK_DIV_1 ? 1 : 2 << (config - PWM_SYSCLK_DIV_2);
+}
+void PWMGenConfigure(uint32_t base, uint32_t gen, uint32_t config)
+{
+    fake_charge();
+}
+/* Up/down counting: the load is half the period given, the output
+ * takes the whole period */
+void PWMGenPeriodSet(uint32_t base, uint32_t gen, uint32_t period)
+{
+    fake_charge();
+    pwm_period = period;
+}
+void PWMPulseWidthSet(uint32_t base, uint32_t out, uint32_t width)
+{
+    fake_charge();
+}
+void PWMGenEnable(uint32_t base, uint32_t gen)
+{
+    fake_charge();
+}
+void PWMOutputState(uint32_t base, uint32_t bits, bool enable)
+{
+    fake_charge();
+    if (bits & PWM_OUT_7_BIT)
+        pwm_on = enable;
+}
+
+/* ================================================================
+ * Timers
+ * ================================================================ */
+typedef struct
+{
+    uint32_t base, config, load, im, ris;
+    bool on;
+    uint64_t start; /* cycle the count started from */
+} fake_timer_t;
+
+static fake_timer_t timers[2] = {{TIMER0_BASE}, {TIMER1_BASE}};
+
+static fake_timer_t *timer_of(uint32_t base)
+{
+    return &timers[base != TIMER0_BASE];
+}
+/* Cycle of the next timeout */
+static uint64_t timer_due(const fake_timer_t *t)
+{
+    uint64_t period = (uint64_t)t->load + 1;
+    if (!t->on)
+        return UINT64_MAX;
+    if (t->config == TIMER_CFG_ONE_SHOT)
+        return t->start + period;
+    return t->start + ((fake_cycles - t->start) / period + 1) * period;
+}
+void fake_timer_event(void)
+{
+    int i;
+    for (i = 0; i < 2; i++)
+    {
+        fake_timer_t *t = &timers[i];
+        if (!t->on || fake_cycles < t->start + (uint64_t)t->load + 1)
+            continue;
+        t->ris |= TIMER_TIMA_TIMEOUT;
+        if (t->config == TIMER_CFG_ONE_SHOT)
+            t->on = false;
+        else
+            t->start += ((fake_cycles - t->start) / ((uint64_t)t->load + 1)) * ((uint64_t)t->load + 1);
+    }
+}
+uint64_t fake_timer_next(void)
+{
+    uint64_t a = timer_due(&timers[0]), b = timer_due(&timers[1]);
+    a = a < b ? a : b;
+    return a == UINT64_MAX ? a : fake_cycles_to_vt(a);
+}
+bool fake_timer_irq(int n)
+{
+    return (timers[n].ris & timers[n].im) != 0;
+}
+
+void TimerConfigure(uint32_t base, uint32_t config)
+{
+    fake_charge();
+    timer_of(base)->config = config;
+    timer_of(base)->on = false;
+}
+void TimerLoadSet(uint32_t base, uint32_t timer, uint32_t value)
+{
+    fake_charge();
+    timer_of(base)->load = value;
+}
+void TimerEnable(uint32_t base, uint32_t timer)
+{
+    fake_charge();
+    timer_of(base)->on = true;
+    timer_of(base)->start = fake_cycles;
+}
+void TimerDisable(uint32_t base, uint32_t timer)
+{
+    fake_charge();
+    timer_of(base)->on = false;
+}
+uint32_t TimerValueGet(uint32_t base, uint32_t timer)
+{
+    fake_timer_t *t = timer_of(base);
+    fake_charge();
+    if (!t->on)
+        return 0;
+    if (t->config == TIMER_CFG_ONE_SHOT)
+        return (uint32_t)(t->start + t->load - fake_cycles);
+    return (uint32_t)((fake_cycles - t->start) % ((uint64_t)t->load + 1));
+}
+void TimerIntEnable(uint32_t base, uint32_t flags)
+{
+    fake_charge();
+    timer_of(base)->im |= flags;
+}
+uint32_t TimerIntStatus(uint32_t base, bool masked)
+{
+    fake_timer_t *t = timer_of(base);
+    fake_charge();
+    return masked ? t->ris & t->im : t->ris;
+}
+void TimerIntClear(uint32_t base, uint32_t flags)
+{
+    fake_charge();
+    timer_of(base)->ris &= ~flags;
+}
+
+/* ================================================================
+ * Hibernate
+ * ================================================================ */
+#define HIB_WRITE_US 92 /* three 32kHz cycles */
+
+static uint32_t hib_mem[16], hib_match, hib_trim = 0x7fff;
+static int32_t rtc_ppb;
+static bool hib_written;
+/* Counts in 1/32768s at anchor_vt, rate from then on */
+static uint64_t anchor_vt, anchor_counts;
+
+static double rtc_rate(void)
+{
+    return 32768.0 * (1 + rtc_ppb * 1e-9 - ((double)hib_trim - 0x7fff) / (64 * 32768.0));
+}
+static uint64_t rtc_counts(void)
+{
+    return anchor_counts + (uint64_t)floor((double)(fake_vt - anchor_vt) * rtc_rate() / VT_HZ);
+}
+static void rtc_anchor(uint64_t counts)
+{
+    anchor_vt = fake_vt;
+    anchor_counts = counts;
+}
+void fake_rtc_ppb(int32_t ppb)
+{
+    rtc_anchor(rtc_counts());
+    rtc_ppb = ppb;
+}
+volatile uint32_t *fake_hib_data(int i)
+{
+    hib_written = true;
+    return &hib_mem[i];
+}
+/* HIB_CTL polled for WRC after a write */
+void fake_hib_ctl(void)
+{
+    if (hib_written)
+    {
+        hib_written = false;
+        fake_run_until(fake_vt + VT_US(HIB_WRITE_US));
+    }
+}
+
+void HibernateEnableExpClk(uint32_t clk)
+{
+    fake_charge();
+}
+void HibernateClockConfig(uint32_t config)
+{
+    fake_charge();
+}
+void HibernateLowBatSet(uint32_t flags)
+{
+    fake_charge();
+}
+uint32_t HibernateLowBatGet(void)
+{
+    fake_charge();
+    return HIBERNATE_LOW_BAT_DETECT | HIBERNATE_LOW_BAT_2_3V;
+}
+void HibernateRTCEnable(void)
+{
+    fake_charge();
+}
+void HibernateRTCSet(uint32_t sec)
+{
+    fake_charge();
+    fake_run_until(fake_vt + VT_US(HIB_WRITE_US));
+    rtc_anchor((uint64_t)sec << 15);
+}
+uint32_t HibernateRTCGet(void)
+{
+    fake_charge();
+    return (uint32_t)(rtc_counts() >> 15);
+}
+uint32_t HibernateRTCSSGet(void)
+{
+    fake_charge();
+    return (uint32_t)(rtc_counts() & 0x7fff);
+}
+void HibernateRTCMatchSet(uint32_t match, uint32_t value)
+{
+    fake_charge();
+    fake_run_until(fake_vt + VT_US(HIB_WRITE_US));
+    hib_match = value;
+}
+uint32_t HibernateRTCMatchGet(uint32_t match)
+{
+    fake_charge();
+    return hib_match;
+}
+void HibernateRTCTrimSet(uint32_t trim)
+{
+    fake_charge();
+    fake_run_until(fake_vt + VT_US(HIB_WRITE_US));
+    rtc_anchor(rtc_counts());
+    hib_trim = trim;
+}
+uint32_t HibernateRTCTrimGet(void)
+{
+    fake_charge();
+    return hib_trim;
+}
+void HibernateDataGet(uint32_t *data, uint32_t count)
+{
+    fake_charge();
+    memcpy(data, hib_mem, count * 4);
+}
+uint32_t HibernateIntStatus(bool masked)
+{
+    fake_charge();
+    return 0;
+}
+void HibernateIntClear(uint32_t flags)
+{
+    fake_charge();
+}
+
+/* ================================================================
+ * EEPROM
+ * ================================================================ */
+#define EEPROM_BYTES 6144
+#define EEPROM_WORD_US 110
+
+static uint32_t eeprom[EEPROM_BYTES / 4];
+static uint32_t ee_im, ee_ris;
+static uint64_t ee_done = UINT64_MAX;
+static const char *ee_path;
+
+static void eeprom_save(void)
+{
+    FILE *f = fopen(ee_path, "wb");
+    if (!f || fwrite(eeprom, sizeof(eeprom), 1, f) != 1)
+        fprintf(stderr, "fake: cannot write %s\n", ee_path);
+    if (f)
+        fclose(f);
+}
+void fake_eeprom_file(const char *path)
+{
+    FILE *f = fopen(path, "rb");
+    memset(eeprom, 0xff, sizeof(eeprom));
+    if (f)
+    {
+        if (fread(eeprom, sizeof(eeprom), 1, f) != 1)
+            memset(eeprom, 0xff, sizeof(eeprom));
+        fclose(f);
+    }
+    if (!ee_path)
+        atexit(eeprom_save);
+    ee_path = path;
+}
+void fake_eeprom_event(void)
+{
+    if (fake_vt >= ee_done)
+    {
+        ee_done = UINT64_MAX;
+        ee_ris |= EEPROM_INT_PROGRAM;
+    }
+}
+uint64_t fake_eeprom_next(void)
+{
+    return ee_done;
+}
+bool fake_eeprom_irq(void)
+{
+    return (ee_ris & ee_im) != 0;
+}
+
+uint32_t EEPROMInit(void)
+{
+    static bool erased;
+    fake_charge();
+    if (!erased && !ee_path)
+        memset(eeprom, 0xff, sizeof(eeprom));
+    erased = true;
+    return EEPROM_INIT_OK;
+}
+uint32_t EEPROMSizeGet(void)
+{
+    fake_charge();
+    return EEPROM_BYTES;
+}
+void EEPROMRead(uint32_t *data, uint32_t addr, uint32_t count)
+{
+    fake_charge();
+    memcpy(data, (uint8_t *)eeprom + addr, count);
+}
+uint32_t EEPROMProgramNonBlocking(uint32_t data, uint32_t addr)
+{
+    fake_charge();
+    if (ee_done != UINT64_MAX)
+    {
+        fprintf(stderr, "fake: EEPROM programmed while busy\n");
+        abort();
+    }
+    eeprom[addr / 4 % (EEPROM_BYTES / 4)] = data;
+    ee_done = fake_vt + VT_US(EEPROM_WORD_US);
+    return EEPROM_RC_WORKING;
+}
+uint32_t EEPROMStatusGet(void)
+{
+    fake_charge();
+    return ee_done != UINT64_MAX ? EEPROM_RC_WORKING : 0;
+}
+void EEPROMIntEnable(uint32_t flags)
+{
+    fake_charge();
+    ee_im |= flags;
+}
+uint32_t EEPROMIntStatus(bool masked)
+{
+    fake_charge();
+    return masked ? ee_ris & ee_im : ee_ris;
+}
+void EEPROMIntClear(uint32_t flags)
+{
+    fake_charge();
+    ee_ris &= ~flags;
+}
+
+/* ================================================================
+ * CRC
+ * ================================================================ */
+static uint32_t crc_config;
+
+void CRCConfigSet(uint32_t base, uint32_t config)
+{
+    fake_charge();
+    crc_config = config;
+}
+static uint32_t reverse_bits(uint32_t v, int n)
+{
+    uint32_t r = 0;
+    int i;
+    for (i = 0; i < n; i++)
+        r |= ((v >> i) & 1) << (n - 1 - i);
+    return r;
+}
+/* Words swapped as configured, bits of every byte reversed with IBR,
+ * fed MSB first through the 0x04c11db7 polynomial */
+uint32_t CRCDataProcess(uint32_t base, uint32_t *data, uint32_t n, bool pp)
+{
+    uint32_t crc = (crc_config & CRC_CFG_INIT_1) == CRC_CFG_INIT_1 ? 0xffffffff : 0, w;
+    int i, k;
+
+    fake_charge();
+    if ((crc_config & 0xf) != CRC_CFG_TYPE_P4C11DB7 || (crc_config & CRC_CFG_SIZE_8BIT))
+    {
+        fprintf(stderr, "fake: CRC configuration 0x%x is not modelled\n", crc_config);
+        abort();
+    }
+    for (; n; n--)
+    {
+        w = *data++;
+        if (crc_config & CRC_CFG_ENDIAN_SBHW)
+            w = ((w & 0x00ff00ff) << 8) | ((w >> 8) & 0x00ff00ff);
+        if (crc_config & CRC_CFG_ENDIAN_SHW)
+            w = (w << 16) | (w >> 16);
+        if (crc_config & CRC_CFG_IBR)
+            for (k = 0; k < 4; k++)
+                w = (w & ~(0xffu << 8 * k)) | reverse_bits((w >> 8 * k) & 0xff, 8) << 8 * k;
+        for (i = 31; i >= 0; i--)
+            crc = (crc << 1) ^ ((((crc >> 31) ^ (w >> i)) & 1) ? 0x04c11db7 : 0);
+    }
+    if (crc_config & CRC_CFG_OBR)
+        crc = reverse_bits(crc, 32);
+    if (crc_config & CRC_CFG_RESINV)
+        crc = ~crc;
+    return crc;
+}
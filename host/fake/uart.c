@@ -0,0 +1,217 @@
+/*
+ * UART0 at 115200 8-N-1 with its 16-byte FIFOs.
+ *
+ * A byte takes UART_CHAR_VT on the wire either way. Bytes to receive
+ * are queued with the time they are in the RX FIFO; the RX interrupt
+ * is raised at the FIFO level set and the receive timeout 32 bit times
+ * after the last byte with the FIFO not empty. The TX interrupt is only
+ * the end of transmission mode: raised when the last byte written is
+ * out, cleared by writing. What is sent is kept for the harnesses and
+ * can be echoed.
+ */
+
+#include <unistd.h>
+#include "headers.h"
+#include "fake.h"
+
+#define UART_CHAR_VT (VT_HZ * 10 / 115200)
+#define UART_RT_VT (VT_HZ * 32 / 115200)
+#define UART_FIFO 16
+#define RXQ_SIZE (1 << 16)
+
+uint32_t fake_uart_overruns;
+
+/* Transmit: the last byte written is out at tx_done, the TX interrupt
+ * is due then if tx_eot */
+static uint64_t tx_done;
+static bool tx_eot, tx_due;
+static char *tx_log;
+static int tx_len, tx_cap, echo_fd = -1;
+
+/* Receive */
+static struct
+{
+    unsigned char c;
+    uint64_t at;
+} rxq[RXQ_SIZE];
+static int rxq_head, rxq_num;
+static uint64_t rx_tail;
+static unsigned char fifo[UART_FIFO];
+static int fifo_head, fifo_num, rx_level = 8;
+static uint64_t rt_at = UINT64_MAX;
+static uint32_t ris, im;
+
+void fake_uart_rx(const char *s, int n)
+{
+    int i;
+    for (i = 0; i < n; i++)
+    {
+        if (rxq_num == RXQ_SIZE)
+        {
+            fprintf(stderr, "fake: UART receive queue full\n");
+            abort();
+        }
+        rx_tail = (rx_tail > fake_vt ? rx_tail : fake_vt) + UART_CHAR_VT;
+        rxq[(rxq_head + rxq_num) % RXQ_SIZE].c = (unsigned char)s[i];
+        rxq[(rxq_head + rxq_num) % RXQ_SIZE].at = rx_tail;
+        rxq_num++;
+    }
+}
+int fake_uart_rx_queued(void)
+{
+    return rxq_num + fifo_num;
+}
+const char *fake_uart_tx(int *len)
+{
+    *len = tx_len;
+    return tx_log ? tx_log : "";
+}
+void fake_uart_echo(int fd)
+{
+    echo_fd = fd;
+}
+
+void fake_uart_event(void)
+{
+    while (rxq_num && rxq[rxq_head].at <= fake_vt)
+    {
+        if (fifo_num == UART_FIFO)
+            fake_uart_overruns++;
+        else
+            fifo[(fifo_head + fifo_num++) % UART_FIFO] = rxq[rxq_head].c;
+        rt_at = rxq[rxq_head].at + UART_RT_VT;
+        rxq_head = (rxq_head + 1) % RXQ_SIZE;
+        rxq_num--;
+        if (fifo_num >= rx_level)
+            ris |= UART_INT_RX;
+    }
+    if (tx_due && fake_vt >= tx_done)
+    {
+        ris |= UART_INT_TX;
+        tx_due = false;
+    }
+    if (fake_vt >= rt_at)
+    {
+        if (fifo_num)
+            ris |= UART_INT_RT;
+        rt_at = UINT64_MAX;
+    }
+}
+uint64_t fake_uart_next(void)
+{
+    uint64_t t = rxq_num && rxq[rxq_head].at < rt_at ? rxq[rxq_head].at : rt_at;
+    return tx_due && tx_done < t ? tx_done : t;
+}
+bool fake_uart_irq(void)
+{
+    return (ris & im) != 0;
+}
+
+/* Bytes written and not yet out, the one shifting included */
+static int tx_inflight(void)
+{
+    return tx_done > fake_vt ? (int)((tx_done - fake_vt + UART_CHAR_VT - 1) / UART_CHAR_VT) : 0;
+}
+static void tx_put(unsigned char c)
+{
+    tx_done = (tx_done > fake_vt ? tx_done : fake_vt) + UART_CHAR_VT;
+    ris &= ~UART_INT_TX;
+    tx_due = tx_eot;
+    if (tx_len == tx_cap)
+    {
+        tx_cap = tx_cap ? tx_cap * 2 : 4096;
+        tx_log = realloc(tx_log, tx_cap + 1);
+    }
+    tx_log[tx_len++] = c;
+    tx_log[tx_len] = '\0';
+    if (echo_fd >= 0 && write(echo_fd, &c, 1) < 0)
+        echo_fd = -1;
+}
+
+void UARTConfigSetExpClk(uint32_t base, uint32_t clk, uint32_t baud, uint32_t config)
+{
+    fake_charge();
+}
+void UARTFIFOLevelSet(uint32_t base, uint32_t tx, uint32_t rx)
+{
+    static const int levels[5] = {2, 4, 8, 12, 14};
+    fake_charge();
+    rx_level = levels[(rx >> 3) % 5];
+}
+void UARTTxIntModeSet(uint32_t base, uint32_t mode)
+{
+    fake_charge();
+    tx_eot = mode == UART_TXINT_MODE_EOT;
+}
+void UARTIntEnable(uint32_t base, uint32_t flags)
+{
+    fake_charge();
+    im |= flags;
+}
+void UARTIntDisable(uint32_t base, uint32_t flags)
+{
+    fake_charge();
+    im &= ~flags;
+}
+uint32_t UARTIntStatus(uint32_t base, bool masked)
+{
+    fake_charge();
+    return masked ? ris & im : ris;
+}
+void UARTIntClear(uint32_t base, uint32_t flags)
+{
+    fake_charge();
+    ris &= ~flags;
+}
+bool UARTCharsAvail(uint32_t base)
+{
+    fake_charge();
+    return fifo_num > 0;
+}
+int32_t UARTCharGet(uint32_t base)
+{
+    unsigned char c;
+    fake_charge();
+    while (!fifo_num)
+    {
+        if (!rxq_num)
+        {
+            fprintf(stderr, "fake: UARTCharGet with nothing left to receive\n");
+            abort();
+        }
+        fake_run_until(rxq[rxq_head].at);
+    }
+    c = fifo[fifo_head];
+    fifo_head = (fifo_head + 1) % UART_FIFO;
+    if (--fifo_num < rx_level)
+        ris &= ~UART_INT_RX;
+    return c;
+}
+int32_t UARTCharGetNonBlocking(uint32_t base)
+{
+    fake_charge();
+    return fifo_num ? UARTCharGet(base) : -1;
+}
+void UARTCharPut(uint32_t base, unsigned char c)
+{
+    fake_charge();
+    while (tx_inflight() > UART_FIFO)
+        fake_run_until(tx_done - UART_FIFO * UART_CHAR_VT);
+    tx_put(c);
+}
+bool UARTCharPutNonBlocking(uint32_t base, unsigned char c)
+{
+    fake_charge();
+    if (tx_inflight() > UART_FIFO)
+        return false;
+    tx_put(c);
+    return true;
+}
+/* Only polled until it clears, so the wait is taken at once */
+bool UARTBusy(uint32_t base)
+{
+    fake_charge();
+    if (tx_done > fake_vt)
+        fake_run_until(tx_done);
+    return tx_done > fake_vt;
+}
@@ -0,0 +1,316 @@
+/*
+ * Fuzzing of the serial command line on the host: every input is typed
+ * into the fake UART of a running firmware and taken by UART0_Handler
+ * and uart0_service as on the board, then executed.
+ *
+ *   fuzz [-n runs] [-s seed] [-t slow us] corpus...
+ *
+ * The firmware boots once and keeps its state from one input to the
+ * next. It runs on a stack of its own; an input ends when the line has
+ * been read and the serial output has been quiet for FUZZ_QUIET_MS. An
+ * input not read within FUZZ_HANG_MS is a hang. The fuzz command of the
+ * firmware checks its parser on its own; a fuzz line it prints with
+ * failures is a failure here too. Crashes are for the sanitizers the
+ * harness is built with.
+ *
+ * LLVMFuzzerTestOneInput takes an input the way libFuzzer hands it over;
+ * with -DFUZZ_LIBFUZZER and -fsanitize=fuzzer libFuzzer drives it.
+ * Otherwise main runs every file of the corpus directories given, then
+ * runs mutations of them: byte sets, inserts, deletes, repeats of the
+ * tail and splices of two inputs. The input under way is kept in
+ * FUZZ_LAST for a crash. Every input is timed on the host clock; one
+ * over the slow limit (FUZZ_SLOW_US, or -t) is printed, and the slowest
+ * of them is kept in FUZZ_SLOW to be run again as a corpus file.
+ * Output: fuzz,host,<corpus>,<runs>,<virtual s>,<exec/s>,<max us>,<slow>
+ */
+
+/* Only main.c has a timer_t of its own */
+#undef __timer_t_defined
+#include <dirent.h>
+#include <signal.h>
+#include <time.h>
+#include <ucontext.h>
+#include <unistd.h>
+#include "headers.h"
+#include "fake.h"
+
+#define FUZZ_MAX 1024          /* bytes of an input */
+#define FUZZ_STACK (1 << 20)   /* of the firmware */
+#define FUZZ_BOOT_MS 4000      /* splash and the lost clock text */
+#define FUZZ_QUIET_MS 20
+#define FUZZ_HANG_MS 10000
+#define FUZZ_CORPUS 4096
+#define FUZZ_LAST "fuzz-last"
+#define FUZZ_SLOW "fuzz-slow"
+#define FUZZ_SLOW_US 20000 /* host time of an input */
+
+int firmware_main(void);
+
+static ucontext_t fuzz_ctx, fw_ctx;
+static bool booted;
+static uint64_t deadline, quiet_at;
+static int tx_len, tx_checked;
+static const uint8_t *input;
+static size_t input_size;
+
+/* An input in C string form, for the messages */
+static void show(FILE *f, const uint8_t *data, size_t size)
+{
+    size_t i;
+    for (i = 0; i < size; i++)
+        fprintf(f, isprint(data[i]) && data[i] != '\\' ? "%c" : "\\x%02x", data[i]);
+    fputc('\n', f);
+}
+static void fuzz_fail(const char *what)
+{
+    int len;
+    const char *tx = fake_uart_tx(&len);
+
+    fprintf(stderr, "fuzz: %s, input: ", what);
+    show(stderr, input, input_size);
+    fprintf(stderr, "--- serial output, last 600 bytes ---\n%s\n", len > 600 ? tx + len - 600 : tx);
+    abort();
+}
+
+/* fuzz lines of the firmware end in the failures, which must be 0 */
+static void check_output(void)
+{
+    const char *tx = fake_uart_tx(&tx_len), *p, *nl;
+    unsigned n, rate, max, slow, failures;
+
+    for (p = tx + tx_checked; (nl = strchr(p, '\n')) != NULL; p = nl + 1)
+        if (sscanf(p, "fuzz,%u,%u,%u,%u,%u", &n, &rate, &max, &slow, &failures) == 5 && failures)
+            fuzz_fail("the fuzz command found parser failures");
+    tx_checked = p - tx;
+}
+
+/* Called by the fakes in the firmware: back to the fuzzer once the
+ * input is taken and the firmware is quiet */
+static void fuzz_hook(void)
+{
+    int len;
+
+    fake_uart_tx(&len);
+    if (len != tx_len)
+    {
+        check_output();
+        quiet_at = fake_vt + VT_MS(FUZZ_QUIET_MS);
+    }
+    if (fake_uart_rx_queued() == 0 && fake_vt >= quiet_at)
+        swapcontext(&fw_ctx, &fuzz_ctx);
+    else if (fake_vt >= deadline)
+        fuzz_fail("the line was not taken");
+    fake_hook_at(fake_vt + VT_MS(1));
+}
+
+static void fw_entry(void)
+{
+    firmware_main();
+}
+static void boot(void)
+{
+    static char stack[FUZZ_STACK];
+
+    fake_init();
+    getcontext(&fw_ctx);
+    fw_ctx.uc_stack.ss_sp = stack;
+    fw_ctx.uc_stack.ss_size = sizeof(stack);
+    fw_ctx.uc_link = NULL;
+    makecontext(&fw_ctx, fw_entry, 0);
+    fake_hook(fuzz_hook);
+    quiet_at = VT_MS(FUZZ_BOOT_MS);
+    deadline = quiet_at + VT_MS(FUZZ_HANG_MS);
+    fake_hook_at(quiet_at);
+    swapcontext(&fuzz_ctx, &fw_ctx);
+    booted = true;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    if (!booted)
+        boot();
+    if (size > FUZZ_MAX)
+        size = FUZZ_MAX;
+    input = data, input_size = size;
+    fake_uart_rx((const char *)data, (int)size);
+    fake_uart_rx("\r", 1);
+    quiet_at = fake_vt + VT_MS(FUZZ_QUIET_MS);
+    deadline = fake_vt + VT_MS(FUZZ_HANG_MS);
+    fake_hook_at(fake_vt + VT_MS(1));
+    swapcontext(&fuzz_ctx, &fw_ctx);
+    return 0;
+}
+
+#ifndef FUZZ_LIBFUZZER
+static struct
+{
+    uint8_t *data;
+    size_t size;
+} corpus[FUZZ_CORPUS];
+static int corpus_num;
+static uint32_t seed = 0x2545f491;
+
+static uint32_t rnd(void)
+{
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed;
+}
+static int by_name(const struct dirent **a, const struct dirent **b)
+{
+    return strcmp((*a)->d_name, (*b)->d_name);
+}
+/* Every file of a directory in name order, a line each */
+static void load(const char *dir)
+{
+    char path[4096];
+    struct dirent **e;
+    int n, i;
+    FILE *f;
+
+    if ((n = scandir(dir, &e, NULL, by_name)) < 0)
+    {
+        perror(dir);
+        exit(2);
+    }
+    for (i = 0; i < n; i++)
+    {
+        snprintf(path, sizeof(path), "%s/%s", dir, e[i]->d_name);
+        if (e[i]->d_name[0] != '.' && corpus_num < FUZZ_CORPUS && (f = fopen(path, "rb")))
+        {
+            corpus[corpus_num].data = malloc(FUZZ_MAX);
+            corpus[corpus_num].size = fread(corpus[corpus_num].data, 1, FUZZ_MAX, f);
+            while (corpus[corpus_num].size &&
+                   corpus[corpus_num].data[corpus[corpus_num].size - 1] == '\n')
+                corpus[corpus_num].size--;
+            fclose(f);
+            corpus_num++;
+        }
+        free(e[i]);
+    }
+    free(e);
+}
+/* A corpus input with up to 8 mutations */
+static size_t mutate(uint8_t *buf)
+{
+    size_t size, pos, n;
+    int i = rnd() % corpus_num, k;
+
+    memcpy(buf, corpus[i].data, size = corpus[i].size);
+    for (k = 1 + rnd() % 8; k; k--)
+    {
+        pos = size ? rnd() % size : 0;
+        switch (rnd() % 5)
+        {
+        case 0:
+            if (size)
+                buf[pos] = (uint8_t)rnd();
+            break;
+        case 1:
+            if (size < FUZZ_MAX)
+            {
+                memmove(buf + pos + 1, buf + pos, size++ - pos);
+                buf[pos] = (uint8_t)rnd();
+            }
+            break;
+        case 2:
+            if (size)
+                memmove(buf + pos, buf + pos + 1, --size - pos);
+            break;
+        case 3:
+            if (2 * size - pos <= FUZZ_MAX)
+            {
+                memcpy(buf + size, buf + pos, size - pos);
+                size = 2 * size - pos;
+            }
+            break;
+        default:
+            i = rnd() % corpus_num;
+            n = corpus[i].size < FUZZ_MAX - pos ? corpus[i].size : FUZZ_MAX - pos;
+            memcpy(buf + pos, corpus[i].data, n);
+            size = pos + n;
+            break;
+        }
+    }
+    return size;
+}
+static long slow_us = FUZZ_SLOW_US, slow, max_us;
+
+static long now_us(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000L + t.tv_nsec / 1000;
+}
+static void save(const char *path, const uint8_t *data, size_t size)
+{
+    FILE *f = fopen(path, "wb");
+    if (f)
+    {
+        fwrite(data, 1, size, f);
+        fclose(f);
+    }
+}
+static void run(const uint8_t *data, size_t size)
+{
+    long us;
+
+    save(FUZZ_LAST, data, size);
+    us = now_us();
+    LLVMFuzzerTestOneInput(data, size);
+    us = now_us() - us;
+    if (us > max_us)
+    {
+        max_us = us;
+        if (us >= slow_us)
+            save(FUZZ_SLOW, data, size);
+    }
+    if (us < slow_us)
+        return;
+    slow++;
+    printf("fuzz,slow,%ld,", us);
+    show(stdout, data, size);
+}
+
+int main(int argc, char **argv)
+{
+    static uint8_t buf[FUZZ_MAX];
+    long runs = 10000, i, t0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:s:t:")) != -1)
+    {
+        if (opt == 'n')
+            runs = atol(optarg);
+        else if (opt == 's')
+            seed = strtoul(optarg, NULL, 0) | 1;
+        else if (opt == 't')
+            slow_us = atol(optarg);
+        else
+        {
+            fprintf(stderr, "Usage: fuzz [-n runs] [-s seed] [-t slow us] corpus...\n");
+            return 2;
+        }
+    }
+    for (; optind < argc; optind++)
+        load(argv[optind]);
+    if (!corpus_num)
+    {
+        fprintf(stderr, "Usage: fuzz [-n runs] [-s seed] [-t slow us] corpus...\n");
+        return 2;
+    }
+    boot();
+    unlink(FUZZ_SLOW);
+    t0 = now_us();
+    for (i = 0; i < corpus_num; i++)
+        run(corpus[i].data, corpus[i].size);
+    for (i = 0; i < runs; i++)
+        run(buf, mutate(buf));
+    t0 = now_us() - t0;
+    unlink(FUZZ_LAST);
+    printf("fuzz,host,%d,%ld,%.3f,%.0f,%ld,%ld\n", corpus_num, runs, (double)fake_vt / VT_HZ,
+           t0 ? (corpus_num + runs) * 1e6 / t0 : 0.0, max_us, slow);
+    return 0;
+}
+#endif
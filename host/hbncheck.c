@@ -0,0 +1,259 @@
+/*
+ * Round trips of the hibernate record of hbnrec.c.
+ *
+ *   hbncheck [-n states]
+ *
+ * Checked:
+ *   every field at its lowest and highest value, the clock at the first
+ *   and the last second of years 0~9999 (the widest epoch), and random
+ *   states, come back from hbnrec_encode / hbnrec_decode as version 3
+ *   every single bit flipped in the record of the first HBN_FLIPS
+ *   states is refused
+ *   version 1 (raw struct copies) and version 2 (a word per field)
+ *   records, built here from their layouts with a bitwise CRC-32, are
+ *   migrated field by field with the fields they lack left zero, and
+ *   come back as they are once rewritten in version 3
+ *   a version 2 record of a wrong length, a newer version and fields
+ *   out of range are refused
+ * Output: hbncheck,<states>,<failures>
+ */
+
+#include <unistd.h>
+#include "headers.h"
+#include "hbnrec.h"
+#include "fake.h"
+
+#define HBN_REPORT 8   /* failures printed */
+#define HBN_FLIPS 1000 /* states of which every bit is flipped */
+
+static uint32_t fails, seed = 0x9e3779b9;
+
+static uint32_t rnd(uint32_t n)
+{
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed % n;
+}
+static void hbn_fail(const char *what, int arg)
+{
+    if (fails++ < HBN_REPORT)
+        printf("hbncheck,fail,%s,%d\n", what, arg);
+}
+
+/* IEEE CRC-32, bit by bit, LSB first */
+static uint32_t ref_crc(const uint32_t *words, int n)
+{
+    const uint8_t *b = (const uint8_t *)words;
+    uint32_t crc = 0xffffffff;
+    int i, k;
+    for (i = 0; i < n * 4; i++)
+        for (crc ^= b[i], k = 0; k < 8; k++)
+            crc = crc & 1 ? (crc >> 1) ^ 0xedb88320 : crc >> 1;
+    return ~crc;
+}
+static bool same(const hbn_state_t *a, const hbn_state_t *b)
+{
+    int i;
+    bool ok = a->rtc == b->rtc && a->sec == b->sec && a->min == b->min && a->hour == b->hour &&
+              a->mday == b->mday && a->month == b->month && a->year == b->year &&
+              a->timer_millisec == b->timer_millisec && a->timer_sec == b->timer_sec &&
+              a->timer_min == b->timer_min && a->snooze_sec == b->snooze_sec &&
+              a->flip == b->flip && a->display_mode == b->display_mode &&
+              a->boot_count == b->boot_count && a->reset_count == b->reset_count;
+    for (i = 0; i < HBN_ALARM_NUM; i++)
+        ok = ok && a->alarms[i].sec == b->alarms[i].sec && a->alarms[i].min == b->alarms[i].min &&
+             a->alarms[i].hour == b->alarms[i].hour && a->alarms[i].enable == b->alarms[i].enable;
+    for (i = 0; i < CDOWN_NUM; i++)
+        ok = ok && a->cdown_sec[i] == b->cdown_sec[i];
+    return ok;
+}
+/* Days of a month, Gregorian */
+static int mdays(int month, int year)
+{
+    static const int days[12] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+    return days[month] + (month == MONTH_FEB && year % 4 == 0 && (year % 100 != 0 || year % 400 == 0));
+}
+
+/* A state with every field at its lowest (0), highest (1) or random */
+static void make_state(hbn_state_t *st, int how)
+{
+    int i;
+    memset(st, 0, sizeof(*st));
+#define PICK(lo, hi) (how == 0 ? (lo) : how == 1 ? (hi) : (lo) + (int)rnd((hi) - (lo) + 1))
+    st->rtc = how == 0 ? 0 : how == 1 ? UINT32_MAX : rnd(UINT32_MAX) ^ (rnd(2) << 31);
+    st->year = PICK(0, 9999);
+    st->month = PICK(MONTH_JAN, MONTH_DEC);
+    st->mday = PICK(1, mdays(st->month, st->year));
+    st->hour = PICK(0, 23), st->min = PICK(0, 59), st->sec = PICK(0, 59);
+    for (i = 0; i < HBN_ALARM_NUM; i++)
+    {
+        st->alarms[i].hour = PICK(0, 23), st->alarms[i].min = PICK(0, 59);
+        st->alarms[i].sec = PICK(0, 59), st->alarms[i].enable = PICK(0, 1);
+    }
+    st->timer_millisec = PICK(0, 999), st->timer_sec = PICK(0, 59), st->timer_min = PICK(0, 99);
+    for (i = 0; i < CDOWN_NUM; i++)
+        st->cdown_sec[i] = PICK(0, 359999);
+    st->snooze_sec = PICK(0, 86399);
+    st->flip = PICK(0, 1);
+    st->display_mode = PICK(0, (1 << HBN_DISPLAY_BITS) - 1);
+    st->boot_count = PICK(0, 65535), st->reset_count = PICK(0, 65535);
+#undef PICK
+}
+
+/* Encode, decode, and with flips every bit of the record flipped */
+static void round_trip(const hbn_state_t *st, int n, bool flips)
+{
+    uint32_t w[HBN_WORDS];
+    hbn_state_t got;
+    int len, i, b;
+
+    memset(w, 0, sizeof(w));
+    hbnrec_encode(st, w);
+    len = w[0] & 0xff;
+    if (len + 2 > HBN_REC_WORDS || w[len + 1] != ref_crc(w, len + 1))
+        hbn_fail("layout", n);
+    if (hbnrec_decode(w, &got) != HBN_VERSION || !same(st, &got))
+        hbn_fail("round trip", n);
+    for (i = 0; flips && i < len + 2; i++)
+        for (b = 0; b < 32; b++)
+        {
+            w[i] ^= 1u << b;
+            if (hbnrec_decode(w, &got) >= 0)
+                hbn_fail("bit flip", i * 32 + b);
+            w[i] ^= 1u << b;
+        }
+}
+/* Migration from the record w of version ver, which holds st */
+static void migrate(uint32_t *w, int ver, const hbn_state_t *st, int n)
+{
+    hbn_state_t got;
+    uint32_t v3[HBN_WORDS];
+
+    if (hbnrec_decode(w, &got) != ver || !same(st, &got))
+        hbn_fail(ver == 1 ? "v1" : "v2", n);
+    memset(v3, 0, sizeof(v3));
+    hbnrec_encode(&got, v3);
+    if (hbnrec_decode(v3, &got) != HBN_VERSION || !same(st, &got))
+        hbn_fail(ver == 1 ? "v1 rewrite" : "v2 rewrite", n);
+}
+/* Records of versions 1 and 2 holding what they can of st */
+static void old_records(const hbn_state_t *st, int n)
+{
+    uint32_t w[HBN_WORDS];
+    int32_t *p = (int32_t *)w;
+    hbn_state_t got, v2;
+    int i;
+
+    /* Version 2: header, rtc, a word per field, CRC */
+    memset(&v2, 0, sizeof(v2));
+    v2.rtc = st->rtc;
+    v2.sec = st->sec, v2.min = st->min, v2.hour = st->hour;
+    v2.mday = st->mday, v2.month = st->month, v2.year = st->year;
+    v2.alarms[0] = st->alarms[0];
+    v2.timer_millisec = st->timer_millisec, v2.timer_sec = st->timer_sec;
+    v2.timer_min = st->timer_min;
+    memset(w, 0, sizeof(w));
+    w[0] = HBN_HEADER(2, 14);
+    w[1] = v2.rtc;
+    p[2] = v2.sec, p[3] = v2.min, p[4] = v2.hour;
+    p[5] = v2.mday, p[6] = v2.month, p[7] = v2.year;
+    p[8] = v2.alarms[0].sec, p[9] = v2.alarms[0].min, p[10] = v2.alarms[0].hour;
+    p[11] = v2.alarms[0].enable;
+    p[12] = v2.timer_millisec, p[13] = v2.timer_sec, p[14] = v2.timer_min;
+    w[15] = ref_crc(w, 15);
+    migrate(w, 2, &v2, n);
+
+    /* A length the version does not have */
+    w[0] = HBN_HEADER(2, 13);
+    w[14] = ref_crc(w, 14);
+    if (hbnrec_decode(w, &got) >= 0)
+        hbn_fail("v2 length", n);
+    /* A version after this firmware */
+    w[0] = HBN_HEADER(HBN_VERSION + 1, 13);
+    w[14] = ref_crc(w, 14);
+    if (hbnrec_decode(w, &got) >= 0)
+        hbn_fail("newer version", n);
+
+    /* Version 1: HBN_CODE_VERIFY, rtc, then dgtclock_t, alarm_t and
+     * timer_t copied from their first field, without the enable flag */
+    v2.alarms[0].enable = false;
+    memset(w, 0, sizeof(w));
+    w[0] = HBN_CODE_VERIFY;
+    w[HBN_V1_RTC] = v2.rtc;
+    p[HBN_V1_CLOCK] = v2.sec, p[HBN_V1_CLOCK + 1] = v2.min, p[HBN_V1_CLOCK + 2] = v2.hour;
+    p[HBN_V1_CLOCK + 3] = v2.mday, p[HBN_V1_CLOCK + 4] = v2.month;
+    p[HBN_V1_CLOCK + 5] = v2.year;
+    p[HBN_V1_ALARM] = v2.alarms[0].sec, p[HBN_V1_ALARM + 1] = v2.alarms[0].min;
+    p[HBN_V1_ALARM + 2] = v2.alarms[0].hour;
+    p[HBN_V1_TIMER] = v2.timer_millisec, p[HBN_V1_TIMER + 1] = v2.timer_sec;
+    p[HBN_V1_TIMER + 2] = v2.timer_min;
+    migrate(w, 1, &v2, n);
+
+    /* Every field one past its range */
+    for (i = 0; i < 9; i++)
+    {
+        p[HBN_V1_CLOCK] = v2.sec, p[HBN_V1_CLOCK + 1] = v2.min, p[HBN_V1_CLOCK + 2] = v2.hour;
+        p[HBN_V1_CLOCK + 3] = v2.mday, p[HBN_V1_CLOCK + 4] = v2.month;
+        p[HBN_V1_CLOCK + 5] = v2.year;
+        p[HBN_V1_TIMER] = v2.timer_millisec, p[HBN_V1_TIMER + 1] = v2.timer_sec;
+        p[HBN_V1_TIMER + 2] = v2.timer_min;
+        switch (i)
+        {
+        case 0:
+            p[HBN_V1_CLOCK] = 60;
+            break;
+        case 1:
+            p[HBN_V1_CLOCK + 1] = 60;
+            break;
+        case 2:
+            p[HBN_V1_CLOCK + 2] = 24;
+            break;
+        case 3:
+            p[HBN_V1_CLOCK + 3] = 32;
+            break;
+        case 4:
+            p[HBN_V1_CLOCK + 4] = 12;
+            break;
+        case 5:
+            p[HBN_V1_CLOCK + 5] = 10000;
+            break;
+        case 6:
+            p[HBN_V1_TIMER] = 1000;
+            break;
+        case 7:
+            p[HBN_V1_TIMER + 1] = 60;
+            break;
+        default:
+            p[HBN_V1_TIMER + 2] = -1;
+            break;
+        }
+        if (hbnrec_decode(w, &got) >= 0)
+            hbn_fail("range", i);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    hbn_state_t st;
+    long n = 100000, i;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:")) != -1)
+    {
+        if (opt != 'n' || (n = atol(optarg)) < 2)
+        {
+            fprintf(stderr, "Usage: hbncheck [-n states]\n");
+            return 2;
+        }
+    }
+    fake_init();
+    for (i = 0; i < n; i++)
+    {
+        make_state(&st, i < 2 ? i : 2);
+        round_trip(&st, i, i < HBN_FLIPS);
+        old_records(&st, i);
+    }
+    printf("hbncheck,%ld,%u\n", n, fails);
+    return fails != 0;
+}
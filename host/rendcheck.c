@@ -0,0 +1,228 @@
+/*
+ * The time, date, alarm and timer pages through seg7_render, against a
+ * model of the upright and flipped scan loops they replaced, on the
+ * panel of the fakes, and the scan time of a frame.
+ *
+ *   rendcheck [-n values]
+ *
+ * Every page is drawn for n random values (50 by default), upright and
+ * flipped, and with no field in modify or one of the three blinked off
+ * and on: 4 * n * 2 * 8 frames. A frame is drawn on a dark panel and
+ * what it lit is compared digit by digit with the model:
+ *   upright  digit i of the page on the i-th from the right, with its
+ *            glyph of the old seg7 table, decimal points on digits 2, 4
+ *   flipped  digit i on the i-th from the left, with the glyph turned
+ *            over, the points on digits 1, 3
+ *   blink    the digits of the field in modify dark in the off phase,
+ *            counted on the page, so in either orientation; the labels
+ *            of alarm and timer never blink
+ * The time of a frame is taken on the virtual clock at 120MHz: the
+ * TCA6424 writes on the 400kHz bus and the Delay after each digit.
+ * Output:
+ *   rendcheck,<page>,<frames>,<avg us>,<min us>,<max us>
+ *   rendcheck,<frames>,<failures>
+ */
+
+#include <unistd.h>
+#include "headers.h"
+#include "initialize.h"
+#include "prof.h"
+#include "text7.h"
+#include "dgtclock.h"
+#include "fake.h"
+
+#define REND_REPORT 8 /* failures printed */
+#define REND_PAGES 4
+
+/* alarm_t and timer_t of main.c */
+typedef struct
+{
+    int sec, min, hour;
+    bool enable;
+} alarm_t;
+typedef struct
+{
+    int millisec, sec, min;
+    bool enable;
+    uint64_t deadline;
+} timer_t;
+
+void clock_display_date(dgtclock_t *clock);
+void clock_display_time(dgtclock_t *clock);
+void alarm_display(alarm_t *alarm);
+void timer_display(timer_t *timer);
+void update_blink_mask(uint8_t *mask, int ptr);
+extern volatile uint8_t global_blink_mask;
+extern volatile int global_flip;
+
+/* 0~9, then the labels A, L, C and d as the old pages drew them */
+static const uint8_t ref_glyph[] = {0x3f, 0x06, 0x5b, 0x4f, 0x66, 0x6d, 0x7d,
+                                    0x07, 0x7f, 0x6f, 0x77, 0x38, 0x39, 0x5e};
+#define REF_A 10
+#define REF_L 11
+#define REF_C 12
+#define REF_D 13
+
+static const char *const pages[REND_PAGES] = {"time", "date", "alarm", "timer"};
+static uint32_t fails, seed = 0x6d2b79f5;
+
+static uint32_t rnd(uint32_t n)
+{
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed % n;
+}
+
+/* Digits of a page from the right as reference glyph indexes, labels
+ * from 6; the number of digits */
+static int ref_digits(int page, int v[3], int d[8])
+{
+    int i, n = 8;
+    for (i = 0; i < 3; i++)
+        d[2 * i] = v[i] % 10, d[2 * i + 1] = v[i] / 10 % 10;
+    switch (page)
+    {
+    case 0:
+        n = 6;
+        break;
+    case 1:
+        d[6] = v[2] / 100 % 10, d[7] = v[2] / 1000;
+        break;
+    case 2:
+        d[6] = REF_L, d[7] = REF_A;
+        break;
+    default:
+        d[6] = REF_D, d[7] = REF_C;
+        break;
+    }
+    return n;
+}
+
+/* The panel, left to right, the model shows */
+static void ref_panel(int page, int v[3], bool flip, int ptr, bool off, uint8_t seg[8])
+{
+    static const uint8_t fields[4] = {0x00, 0xf0, 0x0c, 0x03};
+    int d[8], n = ref_digits(page, v, d), i;
+    uint8_t s;
+
+    memset(seg, 0, 8);
+    for (i = 0; i < n; i++)
+    {
+        if (off && (fields[ptr] >> i & 1) && !(page >= 2 && i >= 6))
+            continue;
+        s = ref_glyph[d[i]];
+        if (flip)
+            seg[i] = SEG7_FLIP(s) | (i == 1 || i == 3 ? 0x80 : 0x00);
+        else
+            seg[7 - i] = s | (i == 2 || i == 4 ? 0x80 : 0x00);
+    }
+}
+
+/* Draw a frame of a page on a dark panel, its time in virtual time */
+static uint64_t draw(int page, int v[3])
+{
+    dgtclock_t clock;
+    alarm_t alarm;
+    timer_t timer;
+    uint64_t t0;
+
+    memset(&clock, 0, sizeof(clock));
+    memset(&alarm, 0, sizeof(alarm));
+    memset(&timer, 0, sizeof(timer));
+    fake_run_until(fake_vt + VT_MS(FAKE_PANEL_MS));
+    t0 = fake_vt;
+    switch (page)
+    {
+    case 0:
+        clock.sec = v[0], clock.min = v[1], clock.hour = v[2];
+        clock_display_time(&clock);
+        break;
+    case 1:
+        clock.mday = v[0], clock.month = v[1] - 1, clock.year = v[2];
+        clock_display_date(&clock);
+        break;
+    case 2:
+        alarm.sec = v[0], alarm.min = v[1], alarm.hour = v[2];
+        alarm_display(&alarm);
+        break;
+    default:
+        timer.millisec = v[0] * 10, timer.sec = v[1], timer.min = v[2];
+        timer_display(&timer);
+        break;
+    }
+    return fake_vt - t0;
+}
+
+/* Random values of a page, from the right */
+static void values(int page, int v[3])
+{
+    switch (page)
+    {
+    case 1:
+        v[0] = 1 + rnd(28), v[1] = 1 + rnd(12), v[2] = rnd(10000);
+        break;
+    case 3:
+        v[0] = rnd(100), v[1] = rnd(60), v[2] = rnd(100);
+        break;
+    default:
+        v[0] = rnd(60), v[1] = rnd(60), v[2] = rnd(24);
+        break;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    uint8_t got[8], want[8];
+    uint64_t t, sum, min, max;
+    int n = 50, v[3], page, k, flip, ptr, off, opt, frames = 0;
+
+    while ((opt = getopt(argc, argv, "n:")) != -1)
+    {
+        if (opt != 'n' || (n = atoi(optarg)) < 1)
+        {
+            fprintf(stderr, "Usage: rendcheck [-n values]\n");
+            return 2;
+        }
+    }
+    fake_init();
+    ui32SysClock = SysCtlClockFreqSet(SYSCTL_XTAL_16MHZ | SYSCTL_OSC_INT | SYSCTL_USE_PLL |
+                                          SYSCTL_CFG_VCO_480,
+                                      120000000);
+    dwt_init();
+    S800_I2C0_Init();
+
+    for (page = 0; page < REND_PAGES; page++)
+    {
+        sum = max = 0, min = UINT64_MAX;
+        for (k = 0; k < n; k++)
+        {
+            values(page, v);
+            for (flip = 0; flip < 2; flip++)
+                for (ptr = 0; ptr < 4; ptr++)
+                    for (off = 1; off >= 0; off--)
+                    {
+                        global_flip = flip;
+                        global_blink_mask = 0xff;
+                        update_blink_mask((uint8_t *)&global_blink_mask, ptr);
+                        if (!off)
+                            update_blink_mask((uint8_t *)&global_blink_mask, ptr);
+                        t = draw(page, v);
+                        sum += t, frames++;
+                        if (t < min)
+                            min = t;
+                        if (t > max)
+                            max = t;
+                        fake_panel(got);
+                        ref_panel(page, v, flip, ptr, off && ptr, want);
+                        if (memcmp(got, want, 8) && fails++ < REND_REPORT)
+                            printf("rendcheck,fail,%s,%02d%02d%04d,%s,%d,%s\n", pages[page], v[0],
+                                   v[1], v[2], flip ? "flip" : "upright", ptr, off ? "off" : "on");
+                    }
+        }
+        printf("rendcheck,%s,%d,%.1f,%.1f,%.1f\n", pages[page], n * 16,
+               (double)sum / (n * 16) / VT_US(1), (double)min / VT_US(1), (double)max / VT_US(1));
+    }
+    printf("rendcheck,%d,%u\n", frames, fails);
+    return fails != 0;
+}
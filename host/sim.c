@@ -0,0 +1,520 @@
+/*
+ * Runs the clock firmware on the host against the fakes of fake/ and
+ * drives it from a script.
+ *
+ *   sim [-v] [-b] [-e eeprom] [-p ppb] script
+ *
+ *   -v         echo the serial output
+ *   -b         the DWT counts cycles of the host, for the bench command
+ *   -e eeprom  keep the EEPROM in a file across runs
+ *   -p ppb     crystal error of the hibernate RTC, fast is positive
+ *
+ * The script is read a line at a time while the firmware runs, in
+ * virtual time; blank lines and lines from '#' are skipped.
+ *
+ *   wait <ms>                  let the firmware run
+ *   send <text>                type a line on the serial port
+ *   sendcrlf <text>            the same, ended by CR LF as many terminals do
+ *   press <button> [ms]        hold a button, 100ms by default, and let it go
+ *                              for as long; toggle, modify, confirm, add,
+ *                              dec, enable, flip or usr0
+ *   within <ms>                time allowed to the checks below, 2000ms
+ *   expect <text>              the serial output has the text, after what
+ *                              the last expect matched
+ *   display <text>             the panel shows the text in the glyphs of
+ *                              text7.h, blanks dark and a dot on the digit
+ *                              before; dark digits at the ends are not
+ *                              compared
+ *   buzzer <hz>                the buzzer sounds within 2% of hz
+ *   mark                       note the time for drift
+ *   drift <ms>                 SysTick, the hwclock and the clock time have
+ *                              each moved with the virtual time since the
+ *                              mark, the clock time at the warp of now
+ *   echo <text>                print the text
+ *   repeat <n> ... end         run the lines between n times, not nested
+ *   pty [command]              from here on the serial port is also a
+ *                              pseudo-terminal, its path printed and in
+ *                              $SIM_PTY, and the virtual time keeps to
+ *                              the real time; the command is started
+ *                              with sh -c and stopped at the end
+ *
+ * A run ends at the last line with PASS, or at the first check not met
+ * with FAIL and the tail of the serial output.
+ */
+
+/* Only main.c has a timer_t of its own */
+#undef __timer_t_defined
+#define _XOPEN_SOURCE 700 /* posix_openpt */
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include "headers.h"
+#include "text7.h"
+#include "stwatch.h"
+#include "fake.h"
+
+#define SIM_LINE 256
+#define SIM_LINES 1024
+#define SIM_POLL_MS 1
+#define SIM_TAIL 600
+
+extern volatile uint32_t systick_ms;
+extern volatile int sim_warp;
+int64_t clock_time_us(uint64_t ticks);
+int firmware_main(void);
+
+static const struct
+{
+    const char *name;
+    int id; /* BUTTON_ID_*, -1 for USR0 */
+} buttons[] = {{"toggle", BUTTON_ID_TOGGLE}, {"modify", BUTTON_ID_MODIFY},
+               {"confirm", BUTTON_ID_CONFIRM}, {"add", BUTTON_ID_ADD},
+               {"dec", BUTTON_ID_DEC}, {"enable", BUTTON_ID_ENABLE},
+               {"flip", BUTTON_ID_FLIP}, {"usr0", -1}};
+
+static const char *path;
+static char *lines[SIM_LINES];
+static int nlines, line;
+
+/* Check in progress: give up at deadline */
+static enum
+{
+    STEP_NEXT,
+    STEP_WAIT,
+    STEP_RELEASE,
+    STEP_EXPECT,
+    STEP_DISPLAY,
+    STEP_BUZZER
+} step;
+static uint64_t until, deadline, within = VT_MS(2000);
+static uint64_t held;
+static int tx_seen;
+static char want[SIM_LINE];
+static uint32_t want_hz;
+static int repeat_line, repeat_left;
+
+/* Mark for drift */
+static uint64_t mark_vt, mark_hw_us;
+static uint32_t mark_ms;
+static int64_t mark_clock_us;
+
+static struct timespec host_start;
+
+/* Pseudo-terminal of the pty command, the slave kept open so that the
+ * master reads nothing rather than an error while no one is connected */
+static int pty_fd = -1, pty_slave = -1;
+static pid_t pty_child;
+static uint64_t pty_vt;
+static struct timespec pty_start;
+
+static void sim_fail(const char *fmt, ...) __attribute__((format(printf, 1, 2), noreturn));
+
+static void sim_fail(const char *fmt, ...)
+{
+    va_list ap;
+    int len;
+    const char *tx = fake_uart_tx(&len);
+
+    printf("FAIL %s:%d: ", path, line);
+    va_start(ap, fmt);
+    vprintf(fmt, ap);
+    va_end(ap);
+    printf("\n--- serial output, last %d bytes ---\n%s\n", SIM_TAIL,
+           len > SIM_TAIL ? tx + len - SIM_TAIL : tx);
+    exit(1);
+}
+
+/* Segments of a text as seg7_render shows it upright, a dot lighting the
+ * point of the digit before; dark digits at both ends are dropped */
+static int text_segs(const char *s, uint8_t *seg, int max)
+{
+    int n = 0, c, i;
+
+    for (; *s; s++)
+    {
+        c = (unsigned char)*s - FONT7_FIRST;
+        if (*s == '.' && n && !(seg[n - 1] & 0x80))
+            seg[n - 1] |= 0x80;
+        else if (n < max)
+            seg[n++] = c >= 0 && c < FONT7_NUM ? font7[c] : 0;
+    }
+    while (n && !seg[n - 1])
+        n--;
+    for (i = 0; i < n && !seg[i]; i++)
+        ;
+    memmove(seg, seg + i, n - i);
+    return n - i;
+}
+/* The panel and how it reads, the font has look-alikes */
+static int panel_segs(uint8_t *seg, char *s)
+{
+    static const char order[] = " 0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+                                "abcdefghijklmnopqrstuvwxyz-_=\"'";
+    uint8_t lit[8];
+    const char *p;
+    int i, n;
+
+    fake_panel(lit);
+    for (i = 0; i < 8; i++)
+    {
+        for (p = order; *p && font7[*p - FONT7_FIRST] != (lit[i] & 0x7f); p++)
+            ;
+        *s++ = *p ? *p : '?';
+        if (lit[i] & 0x80)
+            *s++ = '.';
+    }
+    *s = '\0';
+    for (i = 0; i < 8 && !lit[i]; i++)
+        ;
+    for (n = 8; n > i && !lit[n - 1]; n--)
+        ;
+    memcpy(seg, lit + i, n - i);
+    return n - i;
+}
+
+static void check_drift(long tol_ms)
+{
+    double vt_us = (double)(fake_vt - mark_vt) / (VT_HZ / 1000000);
+    double tick_us = (double)(systick_ms - mark_ms) * (1000000 / SYSTICK_FREQUENCY);
+    double hw_us = (double)(hwclock_us() - mark_hw_us);
+    double clock_us = (double)(clock_time_us(hwclock_ticks()) - mark_clock_us);
+
+    if (fabs(tick_us - vt_us) > tol_ms * 1000.0)
+        sim_fail("SysTick moved %.0f us in %.0f us", tick_us, vt_us);
+    if (fabs(hw_us - vt_us) > tol_ms * 1000.0)
+        sim_fail("hwclock moved %.0f us in %.0f us", hw_us, vt_us);
+    if (fabs(clock_us - vt_us * sim_warp) > tol_ms * 1000.0 * sim_warp)
+        sim_fail("clock moved %.0f us in %.0f us at %dx", clock_us, vt_us, sim_warp);
+}
+
+static void sim_pty_stop(void)
+{
+    if (pty_child > 0)
+        kill(pty_child, SIGTERM);
+}
+static void sim_pty(const char *command)
+{
+    struct termios tio;
+    const char *name;
+
+    if (pty_fd >= 0)
+        sim_fail("pty already open");
+    if ((pty_fd = posix_openpt(O_RDWR | O_NOCTTY)) < 0 || grantpt(pty_fd) < 0 ||
+        unlockpt(pty_fd) < 0 || !(name = ptsname(pty_fd)) ||
+        (pty_slave = open(name, O_RDWR | O_NOCTTY)) < 0)
+        sim_fail("no pseudo-terminal: %s", strerror(errno));
+    tcgetattr(pty_slave, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(pty_slave, TCSANOW, &tio);
+    setenv("SIM_PTY", name, 1);
+    printf("pty %s\n", name);
+    fake_uart_echo(pty_fd);
+    pty_vt = fake_vt;
+    clock_gettime(CLOCK_MONOTONIC, &pty_start);
+    if (!*command)
+        return;
+    fflush(stdout);
+    if ((pty_child = fork()) == 0)
+    {
+        close(pty_fd);
+        close(pty_slave);
+        execl("/bin/sh", "sh", "-c", command, (char *)NULL);
+        _exit(127);
+    }
+    atexit(sim_pty_stop);
+}
+/* Take what came in on the pseudo-terminal, and wait for the real time
+ * to catch up with the virtual one */
+static void sim_pty_poll(void)
+{
+    struct pollfd pfd = {pty_fd, POLLIN, 0};
+    struct timespec now, ts;
+    char buf[256];
+    int64_t ahead_ns;
+    int n;
+
+    while (poll(&pfd, 1, 0) > 0 && (pfd.revents & POLLIN) &&
+           (n = read(pty_fd, buf, sizeof(buf))) > 0)
+        fake_uart_rx(buf, n);
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    ahead_ns = (int64_t)((fake_vt - pty_vt) / (VT_HZ / 1000000)) * 1000 -
+               ((int64_t)(now.tv_sec - pty_start.tv_sec) * 1000000000 +
+                (now.tv_nsec - pty_start.tv_nsec));
+    if (ahead_ns > 0)
+    {
+        ts.tv_sec = ahead_ns / 1000000000, ts.tv_nsec = ahead_ns % 1000000000;
+        nanosleep(&ts, NULL);
+    }
+}
+/* The next call of sim_step, every SIM_POLL_MS with a pseudo-terminal */
+static void sim_hook_at(uint64_t vt)
+{
+    if (pty_fd >= 0 && vt > fake_vt + VT_MS(SIM_POLL_MS))
+        vt = fake_vt + VT_MS(SIM_POLL_MS);
+    fake_hook_at(vt);
+}
+
+static void sim_pass(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    printf("PASS %s: %.3f s simulated in %.3f s\n", path, (double)fake_vt / VT_HZ,
+           now.tv_sec - host_start.tv_sec + (now.tv_nsec - host_start.tv_nsec) / 1e9);
+    exit(0);
+}
+
+/* Start the next line */
+static void sim_line(void)
+{
+    char cmd[SIM_LINE], *arg, *end, *s = lines[line++];
+    long n;
+    int i;
+
+    while (*s == ' ' || *s == '\t')
+        s++;
+    if (!*s || *s == '#')
+        return;
+    for (i = 0; s[i] && s[i] != ' ' && s[i] != '\t'; i++)
+        cmd[i] = s[i];
+    cmd[i] = '\0';
+    arg = s + i;
+    if (*arg)
+        arg++;
+    n = strtol(arg, &end, 10);
+
+    if (!strcmp(cmd, "wait"))
+    {
+        if (end == arg || n < 0)
+            sim_fail("wait <ms>");
+        until = fake_vt + VT_MS(n), step = STEP_WAIT;
+        return;
+    }
+    if (!strcmp(cmd, "send") || !strcmp(cmd, "sendcrlf"))
+    {
+        fake_uart_rx(arg, strlen(arg));
+        fake_uart_rx("\r\n", cmd[4] ? 2 : 1);
+        return;
+    }
+    if (!strcmp(cmd, "press"))
+    {
+        for (i = 0; i < sizeof(buttons) / sizeof(buttons[0]); i++)
+            if (!strncmp(arg, buttons[i].name, strlen(buttons[i].name)))
+                break;
+        if (i == sizeof(buttons) / sizeof(buttons[0]))
+            sim_fail("press <button> [ms]");
+        n = strtol(arg + strlen(buttons[i].name), &end, 10);
+        if (n <= 0)
+            n = 100;
+        if (buttons[i].id < 0)
+            fake_usr0(true);
+        else
+            fake_buttons(1 << buttons[i].id);
+        held = VT_MS(n);
+        until = fake_vt + held, step = STEP_RELEASE;
+        return;
+    }
+    if (!strcmp(cmd, "within"))
+    {
+        if (end == arg || n <= 0)
+            sim_fail("within <ms>");
+        within = VT_MS(n);
+        return;
+    }
+    if (!strcmp(cmd, "expect") || !strcmp(cmd, "display"))
+    {
+        strcpy(want, arg);
+        deadline = fake_vt + within;
+        step = cmd[0] == 'e' ? STEP_EXPECT : STEP_DISPLAY;
+        return;
+    }
+    if (!strcmp(cmd, "buzzer"))
+    {
+        if (end == arg || n <= 0)
+            sim_fail("buzzer <hz>");
+        want_hz = n;
+        deadline = fake_vt + within;
+        step = STEP_BUZZER;
+        return;
+    }
+    if (!strcmp(cmd, "mark"))
+    {
+        mark_vt = fake_vt, mark_ms = systick_ms, mark_hw_us = hwclock_us();
+        mark_clock_us = clock_time_us(hwclock_ticks());
+        return;
+    }
+    if (!strcmp(cmd, "drift"))
+    {
+        if (end == arg || n < 0)
+            sim_fail("drift <ms>");
+        check_drift(n);
+        return;
+    }
+    if (!strcmp(cmd, "repeat"))
+    {
+        if (end == arg || n <= 0)
+            sim_fail("repeat <n>");
+        repeat_line = line, repeat_left = n;
+        return;
+    }
+    if (!strcmp(cmd, "end"))
+    {
+        if (!repeat_left)
+            sim_fail("end without repeat");
+        if (--repeat_left)
+            line = repeat_line;
+        return;
+    }
+    if (!strcmp(cmd, "echo"))
+    {
+        printf("%s\n", arg);
+        return;
+    }
+    if (!strcmp(cmd, "pty"))
+    {
+        sim_pty(arg);
+        return;
+    }
+    sim_fail("unknown command %s", cmd);
+}
+
+/* Called by the fakes when the time comes */
+static void sim_step(void)
+{
+    char panel[24];
+    const char *tx, *hit;
+    uint8_t seg[8], segw[SIM_LINE];
+    uint32_t hz;
+    int len, n;
+
+    if (pty_fd >= 0)
+        sim_pty_poll();
+    for (;;)
+    {
+        switch (step)
+        {
+        case STEP_WAIT:
+            if (fake_vt < until)
+            {
+                sim_hook_at(until);
+                return;
+            }
+            break;
+        case STEP_RELEASE:
+            if (fake_vt < until)
+            {
+                sim_hook_at(until);
+                return;
+            }
+            fake_buttons(0);
+            fake_usr0(false);
+            /* Let go for as long as it was held */
+            until = fake_vt + held, step = STEP_WAIT;
+            sim_hook_at(until);
+            return;
+        case STEP_EXPECT:
+            tx = fake_uart_tx(&len);
+            if ((hit = strstr(tx + tx_seen, want)) != NULL)
+            {
+                tx_seen = hit - tx + strlen(want);
+                break;
+            }
+            if (fake_vt >= deadline)
+                sim_fail("no \"%s\" within %llu ms", want,
+                         (unsigned long long)(within / VT_MS(1)));
+            sim_hook_at(fake_vt + VT_MS(SIM_POLL_MS));
+            return;
+        case STEP_DISPLAY:
+            n = panel_segs(seg, panel);
+            if (n == text_segs(want, segw, SIM_LINE) && !memcmp(seg, segw, n))
+                break;
+            if (fake_vt >= deadline)
+                sim_fail("display reads \"%s\", not \"%s\"", panel, want);
+            sim_hook_at(fake_vt + VT_MS(SIM_POLL_MS));
+            return;
+        case STEP_BUZZER:
+            if (fake_buzzer(&hz) && hz * 50 >= want_hz * 49 && hz * 50 <= want_hz * 51)
+                break;
+            if (fake_vt >= deadline)
+                sim_fail("no buzzer at %u Hz within %llu ms, it is at %u Hz", want_hz,
+                         (unsigned long long)(within / VT_MS(1)), fake_buzzer(&hz) ? hz : 0);
+            sim_hook_at(fake_vt + VT_MS(SIM_POLL_MS));
+            return;
+        default:
+            break;
+        }
+        step = STEP_NEXT;
+        if (line == nlines)
+            sim_pass();
+        sim_line();
+    }
+}
+
+static void load(const char *file)
+{
+    char buf[SIM_LINE];
+    FILE *f = fopen(file, "r");
+
+    if (!f)
+    {
+        perror(file);
+        exit(2);
+    }
+    while (fgets(buf, sizeof(buf), f))
+    {
+        if (nlines == SIM_LINES)
+        {
+            fprintf(stderr, "%s: more than %d lines\n", file, SIM_LINES);
+            exit(2);
+        }
+        buf[strcspn(buf, "\r\n")] = '\0';
+        lines[nlines++] = strdup(buf);
+    }
+    fclose(f);
+}
+
+int main(int argc, char **argv)
+{
+    int opt;
+
+    fake_init();
+    while ((opt = getopt(argc, argv, "vbe:p:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'v':
+            fake_uart_echo(1);
+            break;
+        case 'b':
+            fake_dwt_host(true);
+            break;
+        case 'e':
+            fake_eeprom_file(optarg);
+            break;
+        case 'p':
+            fake_rtc_ppb(atoi(optarg));
+            break;
+        default:
+            fprintf(stderr, "Usage: sim [-v] [-b] [-e eeprom] [-p ppb] script\n");
+            return 2;
+        }
+    }
+    if (optind != argc - 1)
+    {
+        fprintf(stderr, "Usage: sim [-v] [-b] [-e eeprom] [-p ppb] script\n");
+        return 2;
+    }
+    path = argv[optind];
+    load(path);
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    clock_gettime(CLOCK_MONOTONIC, &host_start);
+
+    fake_hook(sim_step);
+    fake_hook_at(0);
+    firmware_main();
+    return 0;
+}
@@ -0,0 +1,180 @@
+/*
+ * Reference host of the sync command: the NTP-style exchange of main.c
+ * over a serial port, or over the pseudo-terminal of a sim run.
+ *
+ *   syncclient [-n exchanges] [-i ms] [-b baud] [-u] tty
+ *
+ *   -n   exchanges, 4 by default
+ *   -i   pause between them, 1000 ms by default
+ *   -b   line rate, 115200 by default
+ *   -u   send UTC; the clock shows the local time by default
+ *
+ * An exchange types "sync", notes T2 as the "sync,<seq>" line comes in
+ * and replies "sync <seq> T2 T3". T3 is when the reply will have left:
+ * the time it is written plus its characters at the line rate, held to
+ * by a tcdrain. The result line of the board is printed as
+ *   syncclient,<n>,<offset s>,<delay s>,<slew/step/drop>
+ * and at the end the exchange of least delay, the one to believe:
+ *   syncclient,best,<n>,<offset s>,<delay s>
+ */
+
+#include <fcntl.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SYNC_TIMEOUT_MS 2000
+#define SYNC_LINE 128
+
+static int fd;
+static long baud = 115200;
+static int utc;
+
+static const struct
+{
+    long baud;
+    speed_t speed;
+} speeds[] = {{9600, B9600}, {19200, B19200}, {38400, B38400}, {57600, B57600},
+              {115200, B115200}, {230400, B230400}, {460800, B460800}};
+
+/* Microseconds since 1970-01-01 00:00 of the local or UTC time */
+static int64_t now_us(void)
+{
+    struct timespec ts;
+    struct tm tm;
+    int64_t us;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    us = (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+    if (!utc && localtime_r(&ts.tv_sec, &tm))
+        us += (int64_t)tm.tm_gmtoff * 1000000;
+    return us;
+}
+/* Next line, its end time in *at
+ * -1 - nothing within SYNC_TIMEOUT_MS */
+static int read_line(char *line, int64_t *at)
+{
+    struct pollfd pfd = {fd, POLLIN, 0};
+    int len = 0;
+    char c;
+
+    for (;;)
+    {
+        if (poll(&pfd, 1, SYNC_TIMEOUT_MS) <= 0 || read(fd, &c, 1) != 1)
+            return -1;
+        if (c == '\n')
+        {
+            *at = now_us();
+            line[len] = '\0';
+            return 0;
+        }
+        if (c != '\r' && len < SYNC_LINE - 1)
+            line[len++] = c;
+    }
+}
+static void put(const char *s)
+{
+    if (write(fd, s, strlen(s)) != (ssize_t)strlen(s))
+    {
+        perror("syncclient: write");
+        exit(1);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    char line[SYNC_LINE], reply[SYNC_LINE], action[8], end;
+    struct termios tio;
+    struct timespec pause;
+    int64_t t2, t3, at;
+    double offset, delay, best_offset = 0, best_delay = -1;
+    unsigned seq;
+    int n = 4, interval = 1000, k, best = 0, opt;
+
+    while ((opt = getopt(argc, argv, "n:i:b:u")) != -1)
+    {
+        switch (opt)
+        {
+        case 'n':
+            n = atoi(optarg);
+            break;
+        case 'i':
+            interval = atoi(optarg);
+            break;
+        case 'b':
+            baud = atol(optarg);
+            break;
+        case 'u':
+            utc = 1;
+            break;
+        default:
+            optind = argc;
+            break;
+        }
+    }
+    if (optind != argc - 1 || n < 1 || interval < 0 || baud <= 0)
+    {
+        fprintf(stderr, "Usage: syncclient [-n exchanges] [-i ms] [-b baud] [-u] tty\n");
+        return 2;
+    }
+    if ((fd = open(argv[optind], O_RDWR | O_NOCTTY)) < 0)
+    {
+        perror(argv[optind]);
+        return 2;
+    }
+    if (tcgetattr(fd, &tio) == 0)
+    {
+        cfmakeraw(&tio);
+        for (k = 0; k < (int)(sizeof(speeds) / sizeof(speeds[0])); k++)
+            if (speeds[k].baud == baud)
+                cfsetspeed(&tio, speeds[k].speed);
+        tcsetattr(fd, TCSANOW, &tio);
+    }
+    pause.tv_sec = interval / 1000, pause.tv_nsec = interval % 1000 * 1000000L;
+
+    for (k = 1; k <= n; k++)
+    {
+        if (k > 1)
+            nanosleep(&pause, NULL);
+        tcflush(fd, TCIFLUSH);
+        put("sync\r");
+        do
+            if (read_line(line, &t2) < 0)
+            {
+                fprintf(stderr, "syncclient: no sync request came back\n");
+                return 1;
+            }
+        while (sscanf(line, "sync,%u%c", &seq, &end) != 1);
+
+        /* T3 is in the line it times: its length with T2 in place of
+         * T3, the two have the same digits */
+        snprintf(reply, sizeof(reply), "sync %u %lld %lld\r", seq, (long long)t2,
+                 (long long)t2);
+        t3 = now_us() + (int64_t)strlen(reply) * 10 * 1000000 / baud;
+        snprintf(reply, sizeof(reply), "sync %u %lld %lld\r", seq, (long long)t2,
+                 (long long)t3);
+        put(reply);
+        tcdrain(fd);
+
+        do
+            if (read_line(line, &at) < 0)
+            {
+                fprintf(stderr, "syncclient: no result of exchange %d\n", k);
+                return 1;
+            }
+        while (sscanf(line, "sync,%lf,%lf,%7s", &offset, &delay, action) != 3);
+        printf("syncclient,%d,%s\n", k, line + 5);
+        fflush(stdout);
+        if (strcmp(action, "drop") && (best_delay < 0 || delay < best_delay))
+            best = k, best_offset = offset, best_delay = delay;
+    }
+    if (best)
+        printf("syncclient,best,%d,%.6f,%.6f\n", best, best_offset, best_delay);
+    close(fd);
+    return !best;
+}
@@ -0,0 +1,103 @@
+/*
+ * Cost of twheel_tick against the number of running timers, on host
+ * cycles.
+ *
+ *   twbench [-t ticks]
+ *
+ * For 0, 16, ... TWHEEL_POOL timers the wheel is ticked ticks times
+ * (65536 by default, four cascades of the top level) in two loads:
+ *   parked    every timer ~17 min out, so only the cascades move them
+ *   periodic  timer i restarts itself every 10 + i * 7919 % 2000 ms
+ *             from its callback, so ticks expire some and cascade
+ *             the rest
+ * Every tick is timed on the DWT, counting the host time stamp counter,
+ * less the cost of timing nothing. A restart takes IntMasterDisable of
+ * the fakes, dearer than on the chip. Output:
+ *   twbench,<load>,<timers>,<ticks>,<min>,<avg>,<max>
+ */
+
+#include <unistd.h>
+#include "headers.h"
+#include "initialize.h"
+#include "prof.h"
+#include "twheel.h"
+#include "fake.h"
+
+#define TW_STEP 16
+#define TW_PARK_MS 1000000
+
+static int handles[TWHEEL_POOL];
+static uint32_t periods[TWHEEL_POOL];
+
+static void tw_restart(void *arg)
+{
+    int i = (int)(intptr_t)arg;
+    twheel_start(handles[i], periods[i], tw_restart, arg);
+}
+static void tw_run(const char *load, int n, long ticks, uint32_t overhead)
+{
+    uint32_t t0, t, min = UINT32_MAX, max = 0;
+    uint64_t sum = 0;
+    long k;
+    int i;
+
+    for (i = 0; i < n; i++)
+    {
+        if ((handles[i] = twheel_alloc()) < 0)
+        {
+            fprintf(stderr, "twbench: pool exhausted at %d timers\n", i);
+            exit(1);
+        }
+        periods[i] = 10 + (uint32_t)i * 7919 % 2000;
+        if (!strcmp(load, "parked"))
+            twheel_start(handles[i], TW_PARK_MS, NULL, NULL);
+        else
+            twheel_start(handles[i], periods[i], tw_restart, (void *)(intptr_t)i);
+    }
+    for (k = 0; k < ticks; k++)
+    {
+        t0 = DWT_CYCLES();
+        twheel_tick();
+        t = DWT_CYCLES() - t0;
+        t = t > overhead ? t - overhead : 0;
+        sum += t;
+        if (t < min)
+            min = t;
+        if (t > max)
+            max = t;
+    }
+    printf("twbench,%s,%d,%ld,%u,%u,%u\n", load, twheel_active(), ticks, min,
+           (uint32_t)(sum / ticks), max);
+    for (i = 0; i < n; i++)
+        twheel_free(handles[i]);
+}
+
+int main(int argc, char **argv)
+{
+    static const char *const loads[] = {"parked", "periodic"};
+    uint32_t t0, t, overhead = UINT32_MAX;
+    long ticks = 65536;
+    int opt, l, n, i;
+
+    while ((opt = getopt(argc, argv, "t:")) != -1)
+    {
+        if (opt != 't' || (ticks = atol(optarg)) < 1)
+        {
+            fprintf(stderr, "Usage: twbench [-t ticks]\n");
+            return 2;
+        }
+    }
+    fake_init();
+    fake_dwt_host(true);
+    for (i = 0; i < 1000; i++)
+    {
+        t0 = DWT_CYCLES();
+        t = DWT_CYCLES() - t0;
+        if (t < overhead)
+            overhead = t;
+    }
+    for (l = 0; l < 2; l++)
+        for (n = 0; n <= TWHEEL_POOL; n += TW_STEP)
+            tw_run(loads[l], n, ticks, overhead);
+    return 0;
+}
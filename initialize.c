@@ -1,10 +1,13 @@
 #include "initialize.h"
+#include "stwatch.h"
+#include "prof.h"
+#include "disptrace.h"
+#include "tone.h"
+#include "hw_nvic.h"
 
-uint32_t ui32SysClock, ui32IntPriorityGroup, ui32IntPriorityMask;
+uint32_t ui32SysClock, ui32PWMClock, ui32IntPriorityGroup, ui32IntPriorityMask;
 uint32_t ui32IntPrioritySystick, ui32IntPriorityUart0;
 
-uint8_t seg7[40] = {0x3f, 0x06, 0x5b, 0x4f, 0x66, 0x6d, 0x7d, 0x07, 0x7f, 0x6f, 0x77, 0x7c, 0x58, 0x5e, 0x079, 0x71, 0x5c};
-uint8_t flp7[40] = {0x3f, 0x30, 0x5b, 0x79, 0x74, 0x6d, 0x6f, 0x38, 0x7f, 0x7d, 0x7e, 0x67, 0x43, 0x73, 0x4f, 0x4e};
 uint8_t uart_receive_char;
 
 uint32_t ui32Status;
@@ -12,8 +15,6 @@ uint32_t pui32NVData[64];
 
 void IO_initialize()
 {
-    seg7['L' - 'A' + 10] = 0x38;
-    flp7['L' - 'A' + 10] = 0x07;
     // use internal 16M oscillator, PIOSC
     // ui32SysClock = SysCtlClockFreqSet((SYSCTL_XTAL_16MHZ |SYSCTL_OSC_INT |SYSCTL_USE_OSC), 16000000);
     // ui32SysClock = SysCtlClockFreqSet((SYSCTL_XTAL_16MHZ |SYSCTL_OSC_INT |SYSCTL_USE_OSC), 8000000);
@@ -22,17 +23,26 @@ void IO_initialize()
 
     // use external 25M oscillator and PLL to 120M
     // ui32SysClock = SysCtlClockFreqSet((SYSCTL_XTAL_25MHZ |SYSCTL_OSC_MAIN | SYSCTL_USE_PLL |SYSCTL_CFG_VCO_480), 120000000);;
-    ui32SysClock = SysCtlClockFreqSet((SYSCTL_XTAL_16MHZ | SYSCTL_OSC_INT | SYSCTL_USE_PLL | SYSCTL_CFG_VCO_480), 20000000);
+    dwt_init();
+    ui32SysClock = SysCtlClockFreqSet((SYSCTL_XTAL_16MHZ | SYSCTL_OSC_INT | SYSCTL_USE_PLL | SYSCTL_CFG_VCO_480), SYSCLOCK_FREQ);
+    boot_mark(BOOT_CLOCK);
+    Peripherals_Enable();
+    boot_hwclock_mark();
+    HWClock_Init(); // The hwclock counts from here, boot_hwclock_us is the time before
 
     SysTickPeriodSet(ui32SysClock / SYSTICK_FREQUENCY);
     SysTickEnable();
     SysTickIntEnable(); // Enable Systick interrupt
 
     S800_GPIO_Init();
+    boot_mark(BOOT_GPIO);
     S800_I2C0_Init();
+    boot_mark(BOOT_I2C);
     S800_UART_Init();
+    boot_mark(BOOT_UART);
 
     Hibernation_Init();
+    boot_mark(BOOT_HIBERNATE);
 
     IntEnable(INT_UART0);
     UARTIntEnable(UART0_BASE, UART_INT_RX | UART_INT_RT); // Enable UART0 RX,TX interrupt
@@ -52,11 +62,33 @@ void IO_initialize()
     ui32IntPrioritySystick = IntPriorityGet(FAULT_SYSTICK);
 
     PWM_Init();
+    Sequencer_Init();
+    EEPROM_Init();
+    boot_mark(BOOT_PWM);
 }
 
+/* Peripherals of the clock, enabled together and waited for once */
+static const uint32_t peripherals[] = {
+    SYSCTL_PERIPH_GPIOA, SYSCTL_PERIPH_GPIOB, SYSCTL_PERIPH_GPIOF, SYSCTL_PERIPH_GPIOJ,
+    SYSCTL_PERIPH_GPIOK, SYSCTL_PERIPH_GPION, SYSCTL_PERIPH_UART0, SYSCTL_PERIPH_I2C0,
+    SYSCTL_PERIPH_PWM0, SYSCTL_PERIPH_TIMER0, SYSCTL_PERIPH_TIMER1, SYSCTL_PERIPH_HIBERNATE,
+    SYSCTL_PERIPH_CCM0, SYSCTL_PERIPH_EEPROM0};
+
+void Peripherals_Enable(void)
+{
+    int i, n = sizeof(peripherals) / sizeof(peripherals[0]);
+    for (i = 0; i < n; i++)
+        SysCtlPeripheralEnable(peripherals[i]);
+    for (i = 0; i < n; i++)
+        while (!SysCtlPeripheralReady(peripherals[i]))
+            ; // Wait for all modules ready
+}
+
+/* Busy loop, value is the count at SYSCLOCK_FREQ */
 void Delay(uint32_t value)
 {
     uint32_t ui32Loop;
+    value = (uint32_t)((uint64_t)value * ui32SysClock / SYSCLOCK_FREQ);
     for (ui32Loop = 0; ui32Loop < value; ui32Loop++)
     {
     };
@@ -75,11 +107,6 @@ void UARTStringPutNonBlocking(const char *cMessage)
 
 void S800_UART_Init(void)
 {
-    SysCtlPeripheralEnable(SYSCTL_PERIPH_UART0);
-    SysCtlPeripheralEnable(SYSCTL_PERIPH_GPIOA); // Enable PortA
-    while (!SysCtlPeripheralReady(SYSCTL_PERIPH_GPIOA))
-        ; // Wait for the GPIO moduleA ready
-
     GPIOPinConfigure(GPIO_PA0_U0RX); // Set GPIO A0 and A1 as UART pins.
     GPIOPinConfigure(GPIO_PA1_U0TX);
 
@@ -89,19 +116,10 @@ void S800_UART_Init(void)
     UARTConfigSetExpClk(UART0_BASE, ui32SysClock, 115200, (UART_CONFIG_WLEN_8 | UART_CONFIG_STOP_ONE | UART_CONFIG_PAR_NONE));
     UARTStringPut((uint8_t *)"\r\nDigital clock is starting...\r\n");
     UARTFIFOLevelSet(UART0_BASE, UART_FIFO_TX2_8, UART_FIFO_RX7_8);
+    UARTTxIntModeSet(UART0_BASE, UART_TXINT_MODE_EOT); // TX interrupt once idle, for the T1 of sync
 }
 void S800_GPIO_Init(void)
 {
-    SysCtlPeripheralEnable(SYSCTL_PERIPH_GPIOF); // Enable PortF
-    while (!SysCtlPeripheralReady(SYSCTL_PERIPH_GPIOF))
-        ;                                        // Wait for the GPIO moduleF ready
-    SysCtlPeripheralEnable(SYSCTL_PERIPH_GPIOJ); // Enable PortJ
-    while (!SysCtlPeripheralReady(SYSCTL_PERIPH_GPIOJ))
-        ;                                        // Wait for the GPIO moduleJ ready
-    SysCtlPeripheralEnable(SYSCTL_PERIPH_GPION); // Enable PortN
-    while (!SysCtlPeripheralReady(SYSCTL_PERIPH_GPION))
-        ; // Wait for the GPIO moduleN ready
-
     GPIOPinTypeGPIOOutput(GPIO_PORTF_BASE, GPIO_PIN_0); // Set PF0 as Output pin
     GPIOPinTypeGPIOOutput(GPIO_PORTN_BASE, GPIO_PIN_0); // Set PN0 as Output pin
     GPIOPinTypeGPIOOutput(GPIO_PORTN_BASE, GPIO_PIN_1); // Set PN1 as Output pin
@@ -110,18 +128,40 @@ void S800_GPIO_Init(void)
     GPIOPadConfigSet(GPIO_PORTJ_BASE, GPIO_PIN_0 | GPIO_PIN_1, GPIO_STRENGTH_2MA, GPIO_PIN_TYPE_STD_WPU);
 }
 
-void S800_I2C0_Init(void)
+/* ================================================================
+ * I2C0: bounded waits, per-device accounting and bus recovery
+ * ================================================================ */
+#define I2C_DEV_NUM 3 /* TCA6424, PCA9557, any other address */
+
+typedef struct
+{
+    uint32_t writes, reads, bytes;
+    uint32_t nacks, arb_lost, timeouts;
+    uint64_t cycles;
+    prof_hist_t latency;
+} i2c_dev_stats_t;
+
+static const uint8_t i2c_addrs[I2C_DEV_NUM - 1] = {TCA6424_I2CADDR, PCA9557_I2CADDR};
+static const char *const i2c_names[I2C_DEV_NUM] = {"TCA6424", "PCA9557", "other"};
+static i2c_dev_stats_t i2c_stats[I2C_DEV_NUM];
+static uint32_t i2c_recoveries;
+
+static void i2c0_setup(void)
 {
-    uint8_t result;
-    SysCtlPeripheralEnable(SYSCTL_PERIPH_I2C0);
-    SysCtlPeripheralEnable(SYSCTL_PERIPH_GPIOB);
     GPIOPinConfigure(GPIO_PB2_I2C0SCL);
     GPIOPinConfigure(GPIO_PB3_I2C0SDA);
     GPIOPinTypeI2CSCL(GPIO_PORTB_BASE, GPIO_PIN_2);
     GPIOPinTypeI2C(GPIO_PORTB_BASE, GPIO_PIN_3);
 
-    I2CMasterInitExpClk(I2C0_BASE, ui32SysClock, true); // config I2C0 400k
+    I2CMasterInitExpClk(I2C0_BASE, ui32SysClock, true); // config I2C0 400k, again on a clock change
+    I2CMasterTimeoutSet(I2C0_BASE, I2C_CLK_TIMEOUT);    // a slave stretching SCL too long
     I2CMasterEnable(I2C0_BASE);
+}
+
+void S800_I2C0_Init(void)
+{
+    uint8_t result;
+    i2c0_setup();
 
     result = I2C0_WriteByte(TCA6424_I2CADDR, TCA6424_CONFIG_PORT0, 0x0ff); // config port 0 as input
     result = I2C0_WriteByte(TCA6424_I2CADDR, TCA6424_CONFIG_PORT1, 0x0);   // config port 1 as output
@@ -131,65 +171,215 @@ void S800_I2C0_Init(void)
     result = I2C0_WriteByte(PCA9557_I2CADDR, PCA9557_OUTPUT, 0x0ff); // turn off the LED1-8
 }
 
-uint8_t I2C0_WriteByte(uint8_t DevAddr, uint8_t RegAddr, uint8_t WriteData)
+static void i2c0_delay_us(uint32_t us)
 {
-    uint8_t rop;
-    while (I2CMasterBusy(I2C0_BASE))
+    uint32_t t0 = DWT_CYCLES(), n = ui32SysClock / 1000000 * us;
+    while (DWT_CYCLES() - t0 < n)
     {
     };
+}
+/* Wait while the master (or the bus) is busy, for at most I2C_WAIT_US
+ *  0 - idle
+ * -1 - timed out
+ */
+static int i2c0_wait(bool bus)
+{
+    uint32_t t0 = DWT_CYCLES(), n = ui32SysClock / 1000000 * I2C_WAIT_US;
+    while (bus ? I2CMasterBusBusy(I2C0_BASE) : I2CMasterBusy(I2C0_BASE))
+        if (DWT_CYCLES() - t0 > n)
+            return -1;
+    return 0;
+}
+/* Free a slave holding SDA low: clock SCL until SDA is released, send a
+ * STOP by hand and set the controller up again */
+static void i2c0_recover(void)
+{
+    int i;
+    I2CMasterDisable(I2C0_BASE);
+    GPIOPinTypeGPIOInput(GPIO_PORTB_BASE, GPIO_PIN_3);
+    GPIOPinTypeGPIOOutputOD(GPIO_PORTB_BASE, GPIO_PIN_2);
+    GPIOPinWrite(GPIO_PORTB_BASE, GPIO_PIN_2, GPIO_PIN_2);
+    i2c0_delay_us(5);
+    for (i = 0; i < 9 && !GPIOPinRead(GPIO_PORTB_BASE, GPIO_PIN_3); i++)
+    {
+        GPIOPinWrite(GPIO_PORTB_BASE, GPIO_PIN_2, 0);
+        i2c0_delay_us(5);
+        GPIOPinWrite(GPIO_PORTB_BASE, GPIO_PIN_2, GPIO_PIN_2);
+        i2c0_delay_us(5);
+    }
+    /* STOP: SDA rises while SCL is high */
+    GPIOPinWrite(GPIO_PORTB_BASE, GPIO_PIN_2, 0);
+    GPIOPinTypeGPIOOutputOD(GPIO_PORTB_BASE, GPIO_PIN_3);
+    GPIOPinWrite(GPIO_PORTB_BASE, GPIO_PIN_3, 0);
+    i2c0_delay_us(5);
+    GPIOPinWrite(GPIO_PORTB_BASE, GPIO_PIN_2, GPIO_PIN_2);
+    i2c0_delay_us(5);
+    GPIOPinWrite(GPIO_PORTB_BASE, GPIO_PIN_3, GPIO_PIN_3);
+    i2c0_delay_us(5);
+
+    i2c0_setup();
+    i2c_recoveries++;
+}
+/* Count a transaction, recover the bus after a lost arbitration or a timeout */
+static void i2c0_account(uint8_t addr, bool read, uint8_t err, uint32_t cycles)
+{
+    i2c_dev_stats_t *d = &i2c_stats[I2C_DEV_NUM - 1];
+    bool masked;
+    int i;
+
+    for (i = 0; i < I2C_DEV_NUM - 1; i++)
+        if (i2c_addrs[i] == addr)
+            d = &i2c_stats[i];
+    masked = IntMasterDisable();
+    if (read)
+        d->reads++;
+    else
+        d->writes++;
+    if (!err)
+        d->bytes += read ? 4 : 3; /* addresses, register and data */
+    if (err & (I2C_MASTER_ERR_ADDR_ACK | I2C_MASTER_ERR_DATA_ACK))
+        d->nacks++;
+    if (err & I2C_MASTER_ERR_ARB_LOST)
+        d->arb_lost++;
+    if (err & I2C_MASTER_ERR_CLK_TOUT)
+        d->timeouts++;
+    d->cycles += cycles;
+    prof_hist_add(&d->latency, cycles);
+    if (!masked)
+        IntMasterEnable();
+
+    if (err & (I2C_MASTER_ERR_ARB_LOST | I2C_MASTER_ERR_CLK_TOUT))
+        i2c0_recover();
+}
+
+/* A stuck wait is reported as I2C_MASTER_ERR_CLK_TOUT */
+static uint8_t i2c0_write_byte(uint8_t DevAddr, uint8_t RegAddr, uint8_t WriteData)
+{
+    uint8_t rop;
+    if (i2c0_wait(false))
+        return I2C_MASTER_ERR_CLK_TOUT;
     I2CMasterSlaveAddrSet(I2C0_BASE, DevAddr, false);
     I2CMasterDataPut(I2C0_BASE, RegAddr);
     I2CMasterControl(I2C0_BASE, I2C_MASTER_CMD_BURST_SEND_START);
-    while (I2CMasterBusy(I2C0_BASE))
-    {
-    };
+    if (i2c0_wait(false))
+        return I2C_MASTER_ERR_CLK_TOUT;
     rop = (uint8_t)I2CMasterErr(I2C0_BASE);
+    if (rop)
+    {
+        if (!(rop & I2C_MASTER_ERR_ARB_LOST))
+            I2CMasterControl(I2C0_BASE, I2C_MASTER_CMD_BURST_SEND_ERROR_STOP);
+        return rop;
+    }
 
     I2CMasterDataPut(I2C0_BASE, WriteData);
     I2CMasterControl(I2C0_BASE, I2C_MASTER_CMD_BURST_SEND_FINISH);
-    while (I2CMasterBusy(I2C0_BASE))
-    {
-    };
+    if (i2c0_wait(false))
+        return I2C_MASTER_ERR_CLK_TOUT;
 
     rop = (uint8_t)I2CMasterErr(I2C0_BASE);
     return rop;
 }
 
-uint8_t I2C0_ReadByte(uint8_t DevAddr, uint8_t RegAddr)
+static uint8_t i2c0_read_byte(uint8_t DevAddr, uint8_t RegAddr, uint8_t *value)
 {
-    uint8_t value, rop;
-    while (I2CMasterBusy(I2C0_BASE))
-    {
-    };
+    uint8_t rop;
+    if (i2c0_wait(false))
+        return I2C_MASTER_ERR_CLK_TOUT;
 
     I2CMasterSlaveAddrSet(I2C0_BASE, DevAddr, false);
     I2CMasterDataPut(I2C0_BASE, RegAddr);
     //	I2CMasterControl(I2C0_BASE, I2C_MASTER_CMD_BURST_SEND_START);
     I2CMasterControl(I2C0_BASE, I2C_MASTER_CMD_SINGLE_SEND);
 
-    while (I2CMasterBusBusy(I2C0_BASE))
-    {
-    };
-    // test();
+    if (i2c0_wait(true))
+        return I2C_MASTER_ERR_CLK_TOUT;
     rop = (uint8_t)I2CMasterErr(I2C0_BASE);
+    if (rop)
+        return rop;
     Delay(1000);
     // receive data
     I2CMasterSlaveAddrSet(I2C0_BASE, DevAddr, true);
     I2CMasterControl(I2C0_BASE, I2C_MASTER_CMD_SINGLE_RECEIVE);
-    while (I2CMasterBusBusy(I2C0_BASE))
-        ;
-    value = I2CMasterDataGet(I2C0_BASE);
+    if (i2c0_wait(true))
+        return I2C_MASTER_ERR_CLK_TOUT;
+    rop = (uint8_t)I2CMasterErr(I2C0_BASE);
+    if (rop)
+        return rop;
+    *value = I2CMasterDataGet(I2C0_BASE);
     Delay(1000);
+    return 0;
+}
+
+/* Returns the I2C_MASTER_ERR_* bits of the transaction */
+uint8_t I2C0_WriteByte(uint8_t DevAddr, uint8_t RegAddr, uint8_t WriteData)
+{
+    uint32_t t0 = DWT_CYCLES();
+    uint8_t rop;
+    if (disptrace_on && DevAddr == TCA6424_I2CADDR)
+        disptrace_write(RegAddr, WriteData);
+    PROF_CALL(PROF_I2C_WRITE, rop = i2c0_write_byte(DevAddr, RegAddr, WriteData));
+    i2c0_account(DevAddr, false, rop, DWT_CYCLES() - t0);
+    return rop;
+}
+
+/* Returns 0xff, nothing pressed on the input ports, when the read fails */
+uint8_t I2C0_ReadByte(uint8_t DevAddr, uint8_t RegAddr)
+{
+    uint32_t t0 = DWT_CYCLES();
+    uint8_t value = 0xff, rop;
+    PROF_CALL(PROF_I2C_READ, rop = i2c0_read_byte(DevAddr, RegAddr, &value));
+    i2c0_account(DevAddr, true, rop, DWT_CYCLES() - t0);
     return value;
 }
 
-void PWM_Init(void)
+/* Print the transactions, faults and latency of every device */
+void I2C0_GetStats(void)
 {
-    SysCtlPeripheralEnable(SYSCTL_PERIPH_PWM0);
-    SysCtlPeripheralEnable(SYSCTL_PERIPH_GPIOK); // Enable PortK
-    while (!SysCtlPeripheralReady(SYSCTL_PERIPH_GPIOK))
-        ; // Wait for the GPIO moduleK ready
+    static i2c_dev_stats_t snap[I2C_DEV_NUM];
+    uint64_t us = hwclock_us(), bytes = 0, cycles = 0;
+    uint32_t per_us = ui32SysClock / 1000000, recoveries, permille;
+    bool masked = IntMasterDisable();
+    char buf[80];
+    int i;
+
+    memcpy(snap, i2c_stats, sizeof(i2c_stats));
+    recoveries = i2c_recoveries;
+    if (!masked)
+        IntMasterEnable();
+
+    for (i = 0; i < I2C_DEV_NUM; i++)
+        bytes += snap[i].bytes, cycles += snap[i].cycles;
+    if (!us)
+        us = 1;
+    permille = (uint32_t)(cycles * 1000 / (us * per_us));
+    sprintf(buf, "Bus: %u bytes/s, busy %u.%u%%, %u recoveries in %u s\n",
+            (uint32_t)(bytes * 1000000 / us), permille / 10, permille % 10,
+            recoveries, (uint32_t)(us / 1000000));
+    UARTStringPut((uint8_t *)buf);
+    UARTStringPut("device       writes     reads    nacks  arblost timeouts\n");
+    for (i = 0; i < I2C_DEV_NUM; i++)
+    {
+        sprintf(buf, "%-8s %10u %9u %8u %8u %8u\n", i2c_names[i], snap[i].writes, snap[i].reads,
+                snap[i].nacks, snap[i].arb_lost, snap[i].timeouts);
+        UARTStringPut((uint8_t *)buf);
+    }
+    for (i = 0; i < I2C_DEV_NUM; i++)
+        if (snap[i].latency.count)
+            prof_hist_print(i2c_names[i], &snap[i].latency);
+}
 
+/* PWM clock, the system clock divided down to PWM_CLOCK_MAX at most */
+static void pwm_clock_setup(void)
+{
+    int k = 0;
+    while ((ui32SysClock >> k) > PWM_CLOCK_MAX && k < 6)
+        k++;
+    PWMClockSet(PWM0_BASE, k ? PWM_SYSCLK_DIV_2 + k - 1 : PWM_SYSCLK_DIV_1);
+    ui32PWMClock = ui32SysClock >> k;
+    seq_set_clock(ui32PWMClock);
+}
+void PWM_Init(void)
+{
     GPIOPinTypeGPIOOutput(GPIO_PORTK_BASE, GPIO_PIN_5); // Set PK5 as Output pin
 
     GPIOPadConfigSet(GPIO_PORTK_BASE, GPIO_PIN_5, GPIO_STRENGTH_4MA, GPIO_PIN_TYPE_STD_WPU);
@@ -197,6 +387,7 @@ void PWM_Init(void)
     GPIOPinConfigure(GPIO_PK5_M0PWM7);
 
     GPIOPinTypePWM(GPIO_PORTK_BASE, GPIO_PIN_5);
+    pwm_clock_setup();
     PWMGenConfigure(PWM0_BASE, PWM_GEN_3, PWM_GEN_MODE_UP_DOWN | PWM_GEN_MODE_NO_SYNC);
 
     PWMGenPeriodSet(PWM0_BASE, PWM_GEN_3, 4000);
@@ -206,22 +397,115 @@ void PWM_Init(void)
     PWMOutputState(PWM0_BASE, PWM_OUT_7_BIT, false);
 }
 
-void Hibernation_Init()
+/* One-shot Timer1 timing the notes of tone.c */
+void Sequencer_Init(void)
 {
-    int i;
-    char buf[MAXLINE];
-    //
-    // Need to enable the hibernation peripheral after wake/reset, before using
-    // it.
-    //
-    SysCtlPeripheralEnable(SYSCTL_PERIPH_HIBERNATE);
+    TimerConfigure(TIMER1_BASE, TIMER_CFG_ONE_SHOT);
+    TimerIntEnable(TIMER1_BASE, TIMER_TIMA_TIMEOUT);
+    IntEnable(INT_TIMER1A);
+}
 
-    //
-    // Wait for the Hibernate module to be ready.
-    //
-    while (!SysCtlPeripheralReady(SYSCTL_PERIPH_HIBERNATE))
+/* EEPROM with program-done interrupt, used by persist.c */
+void EEPROM_Init(void)
+{
+    EEPROMIntEnable(EEPROM_INT_PROGRAM);
+    IntEnable(INT_FLASH); // EEPROM shares the flash interrupt
+}
+
+/* Free-running Timer0 at system clock, time base of stwatch.c */
+void HWClock_Init(void)
+{
+    TimerConfigure(TIMER0_BASE, TIMER_CFG_PERIODIC_UP);
+    TimerLoadSet(TIMER0_BASE, TIMER_A, 0xffffffff);
+    TimerIntEnable(TIMER0_BASE, TIMER_TIMA_TIMEOUT); // Count wraps for the upper 32 bits
+    IntEnable(INT_TIMER0A);
+    TimerEnable(TIMER0_BASE, TIMER_A);
+    hwclock_rebase(0);
+}
+
+/* RTC in 1/32768 s, wrapping every 36 hours */
+static uint32_t rtc_counts(void)
+{
+    uint32_t sec, ss;
+    do
+    {
+        sec = HibernateRTCGet();
+        ss = HibernateRTCSSGet();
+    } while (sec != HibernateRTCGet());
+    return (sec << 15) | ss;
+}
+/* Wait for the RTC subseconds to count, returns the new count */
+static uint32_t rtc_edge(void)
+{
+    uint32_t rtc0 = rtc_counts(), rtc;
+    while ((rtc = rtc_counts()) == rtc0)
+        ;
+    return rtc;
+}
+/* Switch the system clock at run time; every peripheral timed from it
+ * is set up again from ui32SysClock. 16MHz runs from the PIOSC with the
+ * PLL off, the others from the PLL. The switch is timed between two
+ * edges of the RTC subseconds: the hwclock goes on by the gap, and
+ * SysTick starts again on the grid of its ticks. The ticks that fell due
+ * meanwhile are not taken, the caller runs them.
+ * >= 0 - switched, SysTick ticks owed
+ *   -1 - frequency not available
+ */
+int SysClock_Set(uint32_t freq)
+{
+    uint32_t got, old = ui32SysClock, rtc0, since, period, owed;
+    uint64_t now, gap, due;
+    bool masked;
+
+    if (freq == ui32SysClock)
+        return 0;
+    while (UARTBusy(UART0_BASE))
+        ; // Let the output go at the old baud rate
+    masked = IntMasterDisable();
+    rtc0 = rtc_edge();
+    now = hwclock_ticks();
+    /* Stopped where it is, a tick pending is owed as well */
+    SysTickDisable();
+    since = SysTickPeriodGet() - 1 - SysTickValueGet();
+    owed = (HWREG(NVIC_INT_CTRL) & NVIC_INT_CTRL_PENDSTSET) ? 1 : 0;
+    if (freq == 16000000)
+        got = SysCtlClockFreqSet(SYSCTL_OSC_INT | SYSCTL_USE_OSC, freq);
+    else
+        got = SysCtlClockFreqSet(SYSCTL_XTAL_16MHZ | SYSCTL_OSC_INT | SYSCTL_USE_PLL | SYSCTL_CFG_VCO_480, freq);
+    if (!got)
     {
+        SysTickEnable();
+        if (!masked)
+            IntMasterEnable();
+        return -1;
     }
+    ui32SysClock = got;
+    gap = (uint64_t)(rtc_edge() - rtc0) * HWCLOCK_FREQ / 32768;
+    hwclock_rebase(now + gap);
+
+    /* New cycles since the last tick, the next one where it falls due */
+    due = ((uint64_t)since * HWCLOCK_FREQ / old + gap) * got / HWCLOCK_FREQ;
+    period = ui32SysClock / SYSTICK_FREQUENCY;
+    owed += (uint32_t)(due / period);
+    HWREG(NVIC_INT_CTRL) = NVIC_INT_CTRL_PENDSTCLR;
+    SysTickPeriodSet(period - (uint32_t)(due % period));
+    HWREG(NVIC_ST_CURRENT) = 0;
+    SysTickEnable();
+    SysTickPeriodSet(period);
+
+    UARTConfigSetExpClk(UART0_BASE, ui32SysClock, 115200, (UART_CONFIG_WLEN_8 | UART_CONFIG_STOP_ONE | UART_CONFIG_PAR_NONE));
+    I2CMasterInitExpClk(I2C0_BASE, ui32SysClock, true);
+    I2CMasterTimeoutSet(I2C0_BASE, I2C_CLK_TIMEOUT);
+    pwm_clock_setup();
+    if (!masked)
+        IntMasterEnable();
+    return (int)owed;
+}
+
+void Hibernation_Init()
+{
+    int i;
+    char buf[MAXLINE];
     //
     // Enable clocking to the Hibernation module.
     //
@@ -6,23 +6,20 @@
  */
 
 #include "initialize.h"
+#include "stwatch.h"
+#include "twheel.h"
+#include "tone.h"
+#include "persist.h"
+#include "hbnrec.h"
+#include "prof.h"
+#include "disptrace.h"
+#include "rtccal.h"
+#include "text7.h"
+#include "dgtclock.h"
+#include "calcheck.h"
 
 typedef uint8_t byte;
 
-/* Digital clock type */
-typedef struct
-{
-    int sec;      /* second, range 0~59 */
-    int min;      /* minute, range 0~59 */
-    int hour;     /* hour, range 0~23*/
-    int mday;     /* which day in this month, range 1~31 */
-    int month;    /* month range 0~11 */
-    int year;     /* year */
-    int yday;     /* which day in this year, 0~365 */
-    int isleap;   /* whether leap year or not */
-    int days[12]; /* built-in calendar */
-} dgtclock_t;
-
 /* Alarm type*/
 typedef struct
 {
@@ -32,28 +29,42 @@ typedef struct
     bool enable;
 } alarm_t;
 
-/* Countdown type */
+/* Countdown type
+ * While running, the countdown is an absolute deadline on the hwclock
+ * time base; millisec/sec/min are only refreshed by timer_update()
+ * when displayed, queried or stored.
+ */
 typedef struct
 {
     int millisec;
     int sec;
     int min;
     bool enable;
+    uint64_t deadline; /* hwclock tick of expiry while running */
 } timer_t;
 
+/* Ringing source type */
 typedef struct
 {
-    int notelen;
-    pitch_t notes[MAXLINE];
-    int notetime[MAXLINE];
-} music_t;
+    const char *name; /* name used in serial messages */
+    int state;        /* RING_IDLE, RING_ACTIVE or RING_SNOOZED */
+    int page;         /* display mode shown while ringing */
+    int ring_ms;      /* ringing period before stopping by itself */
+    uint32_t until;   /* systick_ms at which current state ends */
+    const tone_t *tone; /* ringtone */
+} ring_t;
 
 /* Global display mode
  * 0 - time
  * 1 - date
  * 2 - alarm
  * 3 - countdown
+ * 4 - stopwatch
+ * 5~7 - countdown cd1~cd3
  * */
+#define DISPLAY_MODE_STWATCH 4
+#define DISPLAY_MODE_CDOWN 5
+#define DISPLAY_MODE_NUM (DISPLAY_MODE_CDOWN + CDOWN_NUM)
 volatile int global_display_mode = 0;
 
 /* Global modification mode
@@ -66,7 +77,7 @@ volatile int global_modify_mode = 0;
  * 1~3 - correspond to respective position */
 volatile int global_modify_ptr = 0;
 
-/* Global blink mask vector*/
+/* Global blink mask vector, digits lit counted from the right */
 volatile uint8_t global_blink_mask = 0xff;
 
 /* Global already indicator */
@@ -75,9 +86,6 @@ volatile int global_already = 0;
 /* Global flip indicator */
 volatile int global_flip = 0;
 
-/* Buzzer enable indicator*/
-volatile int buzzer_enable;
-
 /* Global button events */
 volatile int BUTTON_EVENT_TOGGLE, BUTTON_EVENT_MODIFY, BUTTON_EVENT_CONFIRM;
 volatile int BUTTON_EVENT_ADD, BUTTON_EVENT_DEC, BUTTON_EVENT_ENABLE;
@@ -87,34 +95,93 @@ volatile int BUTTON_EVENT_USR0_PRESSED, BUTTON_EVENT_FLIP;
 volatile uint16_t blink_500ms_counter, systick_500ms_counter, systick_1000ms_counter;
 volatile uint8_t systick_10ms_status, systick_500ms_status, systick_1000ms_status;
 
-/* Ten inner timers for use */
-volatile int inner_timers[10];
+/* Milliseconds since power up */
+volatile uint32_t systick_ms;
+
+/* DWT cycles of the last twheel_tick, for the bench */
+static volatile uint32_t twheel_tick_cycles;
+
+/* Snooze duration(s) */
+volatile int ring_snooze_sec = RING_SNOOZE_DEFAULT;
+
+/* Virtual time: clock seconds per real second, 1 - real time */
+volatile int sim_warp = 1;
+
+/* Button presses injected from the serial port, bits of BUTTON_ID_* */
+volatile uint8_t sim_buttons;
+
+/* Benchmark requested from the serial port, run by the main loop
+ * 0 - none
+ * 1 - run
+ * 2 - run and save the results as the baseline */
+volatile int bench_pending = 0;
+
+/* Inputs of a fuzz run requested from the serial port, run by the main loop */
+#define FUZZ_DEFAULT 10000
+#define FUZZ_MAX 1000000
+volatile int fuzz_pending = 0;
+
+/* Calendar check requested from the serial port
+ * 0 - none
+ * 1 - requested for years calcheck_from ~ calcheck_to
+ * 2 - running, a few years per pass of the main loop */
+volatile int calcheck_pending = 0, calcheck_from, calcheck_to;
+
+/* Serial time sync, NTP-style. Times are us since 1970-01-01 00:00 of
+ * the clock; offsets up to SYNC_STEP_US are slewed, a tick of 1ms
+ * every SYNC_SLEW_SECS (500 ppm), larger ones stepped */
+#define SYNC_STEP_US 128000
+#define SYNC_SLEW_SECS 2
+#define SYNC_MAX_DELAY_US 50000     /* exchanges with a longer round trip are dropped */
+#define SYNC_CAL_INTERVAL_MS 60000  /* a sync feeds the calibration once a minute */
+volatile int32_t sync_slew_us;      /* offset left to slew, positive when behind */
+
+/* hwclock tick the clock second started */
+volatile uint64_t clock_sec_ticks;
+
+/* hwclock tick the last command line ended */
+uint64_t uart_rx_ticks;
+
+/* System clock profile requested from the serial port, run by the main
+ * loop: -1 - none, 0 ~ CPU_PROFILE_NUM - 1 - fixed, CPU_PROFILE_NUM - auto */
+#define CPU_PROFILE_AUTO CPU_PROFILE_NUM
+volatile int cpu_pending = -1;
 
-extern uint8_t seg7[40];
-extern uint8_t flp7[40];
-extern uint32_t ui32SysClock;
+/* systick_ms of the last serial line or button, auto profile runs fast
+ * for CPU_BURST_MS after it */
+volatile uint32_t cpu_active_ms;
+
+/* Boot splash timer, 0 when no splash is shown */
+int splash = 0;
+
+/* hwclock tick of the first display after boot */
+uint64_t boot_display_ticks = 0;
+
+
+extern uint32_t ui32SysClock, ui32PWMClock;
 extern uint32_t pui32NVData[64];
 
 /* Function prototypes */
-/* Inner timer functions*/
-void inner_timer_start(int timerId, int timeoutMs);
-bool inner_timer_status(int timerId);
-void inner_timer_update(void);
-
 /* Hibernation functions */
-void hibernation_wakeup_init(dgtclock_t *clock, alarm_t *alarm, timer_t *timer);
+int hibernation_wakeup_init(dgtclock_t *clock, alarm_t *alarm, timer_t *timer);
 void hibernation_data_store(dgtclock_t *clock, alarm_t *alarm, timer_t *timer);
 
-/* Clock methods */
-void clock_init(dgtclock_t *clock, int ss, int mm, int hh, int mday, int month, int year);
-void clock_update(dgtclock_t *clock);
-int clock_set_date(dgtclock_t *clock, int mday, int month, int year);
-int clock_set_time(dgtclock_t *clock, int sec, int min, int hour);
+/* Configuration kept in the EEPROM */
+void config_restore(void);
+void config_save(void);
+
+/* Clock methods, the calendar ones in dgtclock.h */
 void clock_get_date(dgtclock_t *clock, char *buf);
 void clock_get_time(dgtclock_t *clock, char *buf);
 void clock_display_date(dgtclock_t *clock);
 void clock_display_time(dgtclock_t *clock);
-void clock_button_increase(dgtclock_t *clock, int incr, int ptr);
+int64_t clock_time_us(uint64_t ticks);
+int clock_step_us(int64_t us);
+
+/* Time sync methods */
+void sync_request(void);
+int sync_reply(uint32_t seq, int64_t t2, int64_t t3);
+int sync_slew_adjust(void);
 
 /* Alarm methods */
 void alarm_init(alarm_t *alarm, int sec, int min, int hour);
@@ -127,10 +194,24 @@ void alarm_button_increase(alarm_t *alarm, int incr, int ptr);
 /* Timer methods */
 void timer_init(timer_t *timer, int millisec, int sec, int min);
 void timer_update(timer_t *timer);
+void timer_start(timer_t *timer);
+void timer_pause(timer_t *timer);
 void timer_display(timer_t *timer);
 void timer_go_off(timer_t *timer);
 void timer_button_increase(timer_t *timer, int incr, int ptr);
 
+/* Stopwatch and countdown display */
+void stwatch_display(void);
+void cdown_display(int id);
+
+/* Ring methods */
+void ring_start(int src);
+void ring_stop(int src);
+void ring_snooze(int src);
+void ring_service(void);
+int ring_active(void);
+int ring_find(const char *name);
+
 /* Serial command functions */
 int parse_command(char *cmd, int *argc, char *argv[]);
 int execute_command(int argc, char *argv[]);
@@ -138,36 +219,62 @@ int execute_command(int argc, char *argv[]);
 /*  Event functions */
 void events_catch(void);
 void events_clear(void);
-void start_up(void);
+void start_up(bool warm);
+void splash_display(void);
+void splash_end(void);
+void boot_report(bool warm);
 
 /* Buzzer functions */
 void buzzer_on(int freq, int time_ms);
 void buzzer_off(void);
-void buzzer_music_nonblocking(int len, pitch_t notes[], int time[], bool set);
 
 /* Util functions */
 void test(void);
 bool istriggered(uint8_t keyval, uint8_t preval, int eventid);
 int get_format_nums(char *buf, int *x, int *y, int *z);
 void delay_ms(int ms);
+int64_t parse_us(const char *s, char **end);
 void update_blink_mask(uint8_t *mask, int ptr);
 void led_show_info(void);
 void print_log(void);
+void bench_run(void);
+void fuzz_run(void);
+void calcheck_step(void);
+void cpu_service(void);
+void cpu_get_stats(void);
+int cpu_profile_of(uint32_t hz);
 
 /* Create global clock_t, alarm_t, timer_t instance */
 dgtclock_t clock;
 alarm_t alarm;
 timer_t timer;
 
+/* Ringing sources, indexed by RING_SRC_* */
+ring_t rings[RING_SRC_NUM] = {
+    {"alarm", RING_IDLE, 2, 10000, 0, &tones[TONE_RISE]},
+    {"cdown", RING_IDLE, 3, 5000, 0, &tones[TONE_QUICK]},
+    {"cd1", RING_IDLE, DISPLAY_MODE_CDOWN, 5000, 0, &tones[TONE_QUICK]},
+    {"cd2", RING_IDLE, DISPLAY_MODE_CDOWN + 1, 5000, 0, &tones[TONE_QUICK]},
+    {"cd3", RING_IDLE, DISPLAY_MODE_CDOWN + 2, 5000, 0, &tones[TONE_QUICK]},
+};
+
 int main(void)
 {
     char buf[MAXLINE];
-    int incr = 0;
+    int incr = 0, prev_usr0 = 0, id;
+    uint32_t cause;
+    bool warm;
 
+    /* Restore the clock first, the splash runs from the main loop */
     IO_initialize();
-    start_up();
-    hibernation_wakeup_init(&clock, &alarm, &timer);
+    cause = SysCtlResetCauseGet();
+    warm = hibernation_wakeup_init(&clock, &alarm, &timer) == 0 && !(cause & SYSCTL_CAUSE_POR);
+    config_restore();
+    boot_mark(BOOT_WAKEUP);
     global_already = 1;
+    start_up(warm);
+    boot_mark(BOOT_SPLASH);
+    boot_save();
 
     clock_get_date(&clock, buf);
     UARTStringPut((byte *)buf);
@@ -176,17 +283,73 @@ int main(void)
 
     while (1)
     {
+        cpu_service();
+
         /* Catch button events */
-        events_catch();
+        PROF_CALL(PROF_EVENTS, events_catch());
 
-        led_show_info();
         alarm_go_off(&alarm, &clock);
         timer_go_off(&timer);
+        if ((id = cdown_poll()) >= 0)
+        {
+            sprintf(buf, "\n>>> Cd%d time is up!\n", id + 1);
+            UARTStringPut((byte *)buf);
+            ring_start(RING_SRC_CDOWN + id);
+        }
+        ring_service();
+
+        /* Boot splash, any button skips it */
+        if (splash)
+        {
+            if (twheel_pending(splash) &&
+                !(BUTTON_EVENT_TOGGLE || BUTTON_EVENT_MODIFY || BUTTON_EVENT_CONFIRM ||
+                  BUTTON_EVENT_ADD || BUTTON_EVENT_DEC || BUTTON_EVENT_ENABLE || BUTTON_EVENT_FLIP))
+                splash_display();
+            else
+                splash_end();
+            BUTTON_EVENT_FLIP = 0;
+            events_clear();
+            continue;
+        }
+        PROF_CALL(PROF_LEDS, led_show_info());
+
+        /* Text over the display, ended by any button or a ringing */
+        if (text_active())
+        {
+            if (ring_active() || BUTTON_EVENT_TOGGLE || BUTTON_EVENT_MODIFY || BUTTON_EVENT_CONFIRM ||
+                BUTTON_EVENT_ADD || BUTTON_EVENT_DEC || BUTTON_EVENT_ENABLE || BUTTON_EVENT_FLIP)
+                text_stop();
+            else
+                PROF_CALL(PROF_DISP_TEXT, text_display(global_flip));
+            BUTTON_EVENT_FLIP = 0;
+            events_clear();
+            continue;
+        }
+
+        /* Any button dismisses, USR_SW1 snoozes the ringing */
+        if (ring_active())
+        {
+            if (BUTTON_EVENT_USR0_PRESSED && !prev_usr0)
+            {
+                prev_usr0 = 1;
+                ring_snooze(-1);
+                continue;
+            }
+            if (BUTTON_EVENT_TOGGLE || BUTTON_EVENT_MODIFY || BUTTON_EVENT_CONFIRM || BUTTON_EVENT_ADD ||
+                BUTTON_EVENT_DEC || BUTTON_EVENT_ENABLE || BUTTON_EVENT_FLIP)
+            {
+                BUTTON_EVENT_FLIP = 0;
+                ring_stop(-1);
+                continue;
+            }
+        }
+        prev_usr0 = BUTTON_EVENT_USR0_PRESSED;
+
         /* Handle button events */
         if (BUTTON_EVENT_TOGGLE)
         {
             if (!global_modify_mode)
-                global_display_mode = (global_display_mode + 1) % 4;
+                global_display_mode = (global_display_mode + 1) % DISPLAY_MODE_NUM;
             global_modify_mode = 0;
             global_modify_ptr = 0;
             update_blink_mask((uint8_t *)&global_blink_mask, global_modify_ptr);
@@ -209,7 +372,7 @@ int main(void)
         }
         if (BUTTON_EVENT_MODIFY)
         {
-            if (!global_modify_mode)
+            if (!global_modify_mode && global_display_mode < DISPLAY_MODE_STWATCH)
             {
                 global_modify_mode = 1;
                 global_modify_ptr = 1;
@@ -220,7 +383,6 @@ int main(void)
         if (BUTTON_EVENT_FLIP)
         {
             global_flip ^= 1;
-            update_blink_mask((uint8_t *)&global_blink_mask, global_modify_ptr);
             BUTTON_EVENT_FLIP = 0;
         }
 
@@ -229,12 +391,20 @@ int main(void)
         else if (BUTTON_EVENT_DEC)
             incr = -1;
 
+        /* Blink the display while ringing */
+        if (ring_active() && !systick_500ms_status)
+        {
+            I2C0_WriteByte(TCA6424_I2CADDR, TCA6424_OUTPUT_PORT2, 0x00);
+            events_clear();
+            continue;
+        }
+
         /* Display */
         switch (global_display_mode)
         {
         /* Time mode */
         case 0:
-            clock_display_time(&clock);
+            PROF_CALL(PROF_DISP_TIME, clock_display_time(&clock));
             if (global_modify_mode)
             {
                 if (BUTTON_EVENT_ADD || BUTTON_EVENT_DEC)
@@ -244,7 +414,7 @@ int main(void)
 
         /* Date mode */
         case 1:
-            clock_display_date(&clock);
+            PROF_CALL(PROF_DISP_DATE, clock_display_date(&clock));
             if (global_modify_mode)
             {
                 if (BUTTON_EVENT_ADD || BUTTON_EVENT_DEC)
@@ -254,7 +424,7 @@ int main(void)
 
         /* Alarm mode */
         case 2:
-            alarm_display(&alarm);
+            PROF_CALL(PROF_DISP_ALARM, alarm_display(&alarm));
             if (global_modify_mode)
             {
                 if (BUTTON_EVENT_ADD || BUTTON_EVENT_DEC)
@@ -272,7 +442,7 @@ int main(void)
 
         /* Countdown mode */
         case 3:
-            timer_display(&timer);
+            PROF_CALL(PROF_DISP_TIMER, timer_display(&timer));
             if (global_modify_mode)
             {
                 if (BUTTON_EVENT_ADD || BUTTON_EVENT_DEC)
@@ -284,17 +454,52 @@ int main(void)
                 if (0 == timer.millisec + timer.sec + timer.min)
                     break;
                 global_modify_mode = global_modify_ptr = 0;
-                timer.enable = !timer.enable;
+                timer.enable ? timer_pause(&timer) : timer_start(&timer);
                 sprintf(buf, "%s\n",
                         timer.enable ? " Start countdown" : "Pause countdown");
                 UARTStringPut((byte *)buf);
             }
             break;
 
+        /* Stopwatch mode: ENABLE start/stop, ADD lap, DEC reset */
+        case DISPLAY_MODE_STWATCH:
+            PROF_CALL(PROF_DISP_STWATCH, stwatch_display());
+            if (BUTTON_EVENT_ENABLE)
+            {
+                stwatch.running ? stwatch_stop() : stwatch_start();
+                UARTStringPut(stwatch.running ? "Start stopwatch\n" : "Stop stopwatch\n");
+            }
+            if (BUTTON_EVENT_ADD && stwatch.running)
+            {
+                sprintf(buf, "Lap %d\n", stwatch_lap());
+                UARTStringPut((byte *)buf);
+            }
+            if (BUTTON_EVENT_DEC && !stwatch.running)
+                stwatch_reset();
+            break;
+
+        /* Countdown cd1~cd3 mode */
         default:
+            id = global_display_mode - DISPLAY_MODE_CDOWN;
+            PROF_CALL(PROF_DISP_CDOWN, cdown_display(id));
+            if (BUTTON_EVENT_ENABLE)
+            {
+                cdowns[id].enable ? cdown_stop(id) : cdown_start(id);
+                sprintf(buf, "%s cd%d\n", cdowns[id].enable ? "Start" : "Pause", id + 1);
+                UARTStringPut((byte *)buf);
+            }
             break;
         }
         events_clear();
+        if (!boot_display_ticks)
+            boot_report(warm);
+        config_save();
+        if (bench_pending)
+            bench_run();
+        if (fuzz_pending)
+            fuzz_run();
+        if (calcheck_pending)
+            calcheck_step();
         Delay(1000);
     }
 }
@@ -307,74 +512,196 @@ void test()
     UARTStringPut((byte *)buf);
 }
 
-/* Wake from hibernation. Read data from memory */
-void hibernation_wakeup_init(dgtclock_t *clock, alarm_t *alarm, timer_t *timer)
+/* Last stored state. The RTC/clock pair in it is kept while the clock
+ * only follows the RTC, so an unchanged state encodes to the same words */
+static hbn_state_t hbn_last;
+static bool hbn_anchored;
+
+/* Wake from hibernation. Read data from memory
+ *  0 - state restored
+ * -1 - no valid state, defaults loaded
+ */
+int hibernation_wakeup_init(dgtclock_t *clock, alarm_t *alarm, timer_t *timer)
 {
-    HibernateDataGet(pui32NVData, 16);
+    static hbn_state_t st;
+    char buf[48];
+    int ver, i;
+
+    hbnrec_read(pui32NVData);
     // print_log();
-    if (pui32NVData[HBN_VERIFY] != HBN_CODE_VERIFY)
+    ver = hbnrec_decode(pui32NVData, &st);
+    if (ver < 0)
     {
-        pui32NVData[HBN_VERIFY] = HBN_CODE_VERIFY;
-        pui32NVData[HBN_RTC] = HibernateRTCGet();
         clock_init(clock, 59, 00, 8, 11, 5, 2023);
         alarm_init(alarm, 3, 0, 8);
         timer_init(timer, 233, 13, 0);
         HibernateRTCSet(0);
+        hbn_last.boot_count = 1;
         hibernation_data_store(clock, alarm, timer);
+        text_show("Clock lost, set the time", 0);
+        return -1;
     }
-    else
+    clock_init(clock, st.sec + (HibernateRTCGet() - st.rtc), st.min, st.hour,
+               st.mday, st.month, st.year);
+    alarm_init(alarm, st.alarms[0].sec, st.alarms[0].min, st.alarms[0].hour);
+    alarm->enable = st.alarms[0].enable;
+    timer_init(timer, st.timer_millisec, st.timer_sec, st.timer_min);
+    for (i = 0; i < CDOWN_NUM; i++)
+        if (st.cdown_sec[i])
+            cdown_set(i, st.cdown_sec[i] * 1000);
+    if (st.snooze_sec)
+        ring_snooze_sec = st.snooze_sec;
+    global_flip = st.flip;
+    if (st.display_mode < DISPLAY_MODE_NUM)
+        global_display_mode = st.display_mode;
+
+    /* Count the boot, power-on is not a reset */
+    st.boot_count++;
+    if (!(SysCtlResetCauseGet() & SYSCTL_CAUSE_POR))
+        st.reset_count++;
+    SysCtlResetCauseClear(SysCtlResetCauseGet());
+    hbn_last = st;
+    hbn_anchored = ver == HBN_VERSION;
+    hibernation_data_store(clock, alarm, timer);
+    if (ver < HBN_VERSION)
     {
-        memcpy(clock, pui32NVData + HBN_CLOCK, sizeof(int) * 6);
-        memcpy(alarm, pui32NVData + HBN_ALARM, sizeof(int) * 3);
-        memcpy(timer, pui32NVData + HBN_TIMER, sizeof(int) * 3);
-        clock_init(clock, clock->sec, clock->min, clock->hour,
-                   clock->mday, clock->month, clock->year);
-        clock->sec += HibernateRTCGet() - HibernateRTCMatchGet(0);
-        clock_update(clock);
+        sprintf(buf, "Hibernate data migrated from v%d to v%d\n", ver, HBN_VERSION);
+        UARTStringPut((byte *)buf);
     }
+    return 0;
 }
 
+/* Store the state, only the changed words are written */
 void hibernation_data_store(dgtclock_t *clock, alarm_t *alarm, timer_t *timer)
 {
-    pui32NVData[HBN_VERIFY] = HBN_CODE_VERIFY;
-    pui32NVData[HBN_RTC] = HibernateRTCGet();
+    static dgtclock_t expect;
+    uint32_t rtc = HibernateRTCGet();
+    int i;
 
-    memcpy(pui32NVData + HBN_CLOCK, clock, sizeof(int) * 6);
-    memcpy(pui32NVData + HBN_ALARM, alarm, sizeof(int) * 3);
-    memcpy(pui32NVData + HBN_TIMER, timer, sizeof(int) * 3);
-    HibernateDataSet(pui32NVData, 16);
+    if (hbn_anchored)
+    {
+        clock_init(&expect, hbn_last.sec + (rtc - hbn_last.rtc), hbn_last.min, hbn_last.hour,
+                   hbn_last.mday, hbn_last.month, hbn_last.year);
+        hbn_anchored = expect.sec == clock->sec && expect.min == clock->min &&
+                       expect.hour == clock->hour && expect.mday == clock->mday &&
+                       expect.month == clock->month && expect.year == clock->year;
+    }
+    if (!hbn_anchored)
+    {
+        hbn_last.rtc = rtc;
+        hbn_last.sec = clock->sec, hbn_last.min = clock->min, hbn_last.hour = clock->hour;
+        hbn_last.mday = clock->mday, hbn_last.month = clock->month, hbn_last.year = clock->year;
+        hbn_anchored = true;
+    }
+    hbn_last.alarms[0].sec = alarm->sec, hbn_last.alarms[0].min = alarm->min;
+    hbn_last.alarms[0].hour = alarm->hour, hbn_last.alarms[0].enable = alarm->enable;
+    timer_update(timer);
+    hbn_last.timer_millisec = timer->millisec, hbn_last.timer_sec = timer->sec;
+    hbn_last.timer_min = timer->min;
+    for (i = 0; i < CDOWN_NUM; i++)
+        hbn_last.cdown_sec[i] = hwclock_ticks_to_ms(cdowns[i].preset) / 1000;
+    hbn_last.snooze_sec = ring_snooze_sec;
+    hbn_last.flip = global_flip;
+    hbn_last.display_mode = global_display_mode;
+    hbnrec_encode(&hbn_last, pui32NVData);
+    hbnrec_write(pui32NVData);
 }
 
-void start_up()
+/* Load the configuration from the EEPROM log over the defaults */
+void config_restore()
 {
-    pitch_t notes[14] = {C4, D4, E4, F4, G4, A4, B4, C5, D5, E5, F5, G5, A5, B5};
-    int note_time[14] = {400, 400, 400, 400, 400, 400, 400, 400, 400, 400, 400, 400, 400, 400};
-    int student_id[8] = {2, 1, 9, 1, 1, 1, 0, 1};
+    uint32_t v;
     int i;
-    char buf[MAXLINE];
-    uint8_t mask = 0x80;
-
-    buzzer_music_nonblocking(14, notes, note_time, 1);
-
-    global_modify_mode = global_modify_ptr = 1;
-    inner_timer_start(INNERTIMER_GENERAL, 3000);
-    while (inner_timer_status(INNERTIMER_GENERAL))
+    if (persist_init() < 0)
     {
-
-        for (i = 0, mask = 0x80; i < 8; i++, mask >>= 1)
-        {
-            I2C0_WriteByte(TCA6424_I2CADDR, TCA6424_OUTPUT_PORT2, 0x00);
-            I2C0_WriteByte(TCA6424_I2CADDR, TCA6424_OUTPUT_PORT1, (seg7[student_id[8 - i - 1]]));
-            I2C0_WriteByte(TCA6424_I2CADDR, TCA6424_OUTPUT_PORT2, mask);
-            Delay(1000);
-            if (global_blink_mask != 0xff)
-                I2C0_WriteByte(PCA9557_I2CADDR, PCA9557_OUTPUT, 0x00);
-            else
-                I2C0_WriteByte(PCA9557_I2CADDR, PCA9557_OUTPUT, 0xff);
-        }
+        UARTStringPut("EEPROM unavailable, settings will not be kept\n");
+        text_show("EEPROM Error", 0);
+        return;
     }
+    if (!persist_get(PKEY_ALARM, &v))
+    {
+        alarm_set(&alarm, v & 0xff, (v >> 8) & 0xff, (v >> 16) & 0xff);
+        alarm.enable = (v >> 24) & 1;
+    }
+    if (!persist_get(PKEY_FLIP, &v))
+        global_flip = v & 1;
+    if (!persist_get(PKEY_SNOOZE, &v) && v)
+        ring_snooze_sec = v;
+    for (i = 0; i < CDOWN_NUM; i++)
+        if (!persist_get(PKEY_CDOWN + i, &v))
+            cdown_set(i, v);
+    /* The uploaded melody lives in RAM only, keep the default for it */
+    for (i = 0; i < RING_SRC_NUM; i++)
+        if (!persist_get(PKEY_TONE + i, &v) && v < TONE_NUM)
+            rings[i].tone = &tones[v];
+    if (!persist_get(PKEY_CAL_RTC, &v))
+        cal_rtc_ppb = (int32_t)v;
+    if (!persist_get(PKEY_CAL_TICK, &v))
+        cal_tick_ppb = (int32_t)v;
+    cal_apply();
+}
+/* Log the configuration items that changed, not while being edited */
+void config_save()
+{
+    int i;
+    if (global_modify_mode)
+        return;
+    persist_set(PKEY_ALARM, (alarm.enable ? 1u << 24 : 0) |
+                                (alarm.hour << 16) | (alarm.min << 8) | alarm.sec);
+    persist_set(PKEY_FLIP, global_flip);
+    persist_set(PKEY_SNOOZE, ring_snooze_sec);
+    for (i = 0; i < CDOWN_NUM; i++)
+        persist_set(PKEY_CDOWN + i, hwclock_ticks_to_ms(cdowns[i].preset));
+    for (i = 0; i < RING_SRC_NUM; i++)
+        persist_set(PKEY_TONE + i, rings[i].tone == &tone_user ? TONE_NUM : rings[i].tone - tones);
+    persist_set(PKEY_CAL_RTC, (uint32_t)cal_rtc_ppb);
+    persist_set(PKEY_CAL_TICK, (uint32_t)cal_tick_ppb);
+}
+
+/* Start the boot splash, shown by the main loop for 3s.
+ * Warm resets go straight to the clock. */
+void start_up(bool warm)
+{
+    if (warm)
+        return;
+    seq_play(&tones[TONE_SCALE], false);
+    splash = twheel_alloc();
+    twheel_start(splash, 3000, NULL, NULL);
+}
+/* One scan of the student id, LEDs blinking */
+void splash_display()
+{
+    static const char student_id[8] = {'2', '1', '9', '1', '1', '1', '0', '1'};
+    char digits[8];
+    int i;
+
+    for (i = 0; i < 8; i++)
+        digits[i] = student_id[8 - i - 1];
+    seg7_render(digits, 8, 0x00, 0xff, false);
+    I2C0_WriteByte(PCA9557_I2CADDR, PCA9557_OUTPUT, systick_500ms_status ? 0x00 : 0xff);
+}
+void splash_end()
+{
     I2C0_WriteByte(PCA9557_I2CADDR, PCA9557_OUTPUT, 0xff);
-    global_modify_mode = global_modify_ptr = 0;
+    twheel_free(splash);
+    splash = 0;
+}
+/* First display after boot is up: report the boot time from the start
+ * of IO_initialize, PLL lock and Peripherals_Enable before the hwclock
+ * included, then print the banner, which would otherwise hold the
+ * display back */
+void boot_report(bool warm)
+{
+    char buf[64];
+    uint32_t us;
+
+    boot_display_ticks = hwclock_ticks();
+    us = (uint32_t)(boot_display_ticks / (HWCLOCK_FREQ / 1000000)) + boot_hwclock_us();
+    sprintf(buf, "%s boot, first display at %u.%03ums\n", warm ? "Warm" : "Cold",
+            us / 1000, us % 1000);
+    UARTStringPut((byte *)buf);
+    if (warm)
+        return;
 
     UARTStringPut("===================================================================\n");
     UARTStringPut("                                                                   \n");
@@ -389,11 +716,6 @@ void start_up()
     UARTStringPut("                                         `Y8P'\n");
     UARTStringPut("                                                                   \n");
     UARTStringPut("===================================================================\n");
-
-    // UARTStringPut("                                                                   \n");
-    // UARTStringPut("                                                                   \n");
-    // UARTStringPut("                                                                   \n");
-    // UARTStringPut("                                                                   \n");
 }
 
 void events_catch()
@@ -408,6 +730,7 @@ void events_catch()
 
     if (now_val != prev_val)
     {
+        cpu_active_ms = systick_ms;
         delay_ms(20);
         now_val = I2C0_ReadByte(TCA6424_I2CADDR, TCA6424_INPUT_PORT0);
         BUTTON_EVENT_TOGGLE = istriggered(now_val, prev_val, BUTTON_ID_TOGGLE);
@@ -423,6 +746,7 @@ void events_catch()
     now_pin0 = GPIOPinRead(GPIO_PORTJ_BASE, GPIO_PIN_0);
     if (now_pin0 != prev_pin0)
     {
+        cpu_active_ms = systick_ms;
         delay_ms(5);
         if (!now_pin0)
             BUTTON_EVENT_USR0_PRESSED = 1;
@@ -430,6 +754,22 @@ void events_catch()
             BUTTON_EVENT_USR0_PRESSED = 0;
         prev_pin0 = now_pin0;
     }
+    /* Presses injected by "sim press" */
+    if (sim_buttons)
+    {
+        bool masked = IntMasterDisable();
+        cpu_active_ms = systick_ms;
+        BUTTON_EVENT_TOGGLE |= !!(sim_buttons & (1 << BUTTON_ID_TOGGLE));
+        BUTTON_EVENT_MODIFY |= !!(sim_buttons & (1 << BUTTON_ID_MODIFY));
+        BUTTON_EVENT_CONFIRM |= !!(sim_buttons & (1 << BUTTON_ID_CONFIRM));
+        BUTTON_EVENT_ADD |= !!(sim_buttons & (1 << BUTTON_ID_ADD));
+        BUTTON_EVENT_DEC |= !!(sim_buttons & (1 << BUTTON_ID_DEC));
+        BUTTON_EVENT_ENABLE |= !!(sim_buttons & (1 << BUTTON_ID_ENABLE));
+        BUTTON_EVENT_FLIP |= !!(sim_buttons & (1 << BUTTON_ID_FLIP));
+        sim_buttons = 0;
+        if (!masked)
+            IntMasterEnable();
+    }
 }
 void events_clear()
 {
@@ -446,55 +786,18 @@ void buzzer_on(int freq, int time_ms)
 {
     if (freq != 0)
     {
-        PWMGenPeriodSet(PWM0_BASE, PWM_GEN_3, ui32SysClock / freq);
-        PWMPulseWidthSet(PWM0_BASE, PWM_OUT_7, ui32SysClock / freq / 100);
+        PWMGenPeriodSet(PWM0_BASE, PWM_GEN_3, ui32PWMClock / freq);
+        PWMPulseWidthSet(PWM0_BASE, PWM_OUT_7, ui32PWMClock / freq / 100);
         PWMOutputState(PWM0_BASE, PWM_OUT_7_BIT, true);
     }
 
-    inner_timer_start(INNERTIMER_BUZZER, time_ms);
-    while (inner_timer_status(INNERTIMER_BUZZER))
-        ;
+    delay_ms(time_ms);
     PWMOutputState(PWM0_BASE, PWM_OUT_7_BIT, false);
 }
 /* Turn off the buzzer */
 void buzzer_off()
 {
-    buzzer_enable = 0;
-    PWMOutputState(PWM0_BASE, PWM_OUT_7_BIT, false);
-}
-/* Concurrent music player */
-void buzzer_music_nonblocking(int len, pitch_t notes[], int time[], bool set)
-{
-    static music_t music;
-    static int i;
-    PWMOutputState(PWM0_BASE, PWM_OUT_7_BIT, false);
-    if (set)
-    {
-        music.notelen = len;
-        for (i = 0; i < len; i++)
-        {
-            music.notes[i] = notes[i];
-            music.notetime[i] = time[i];
-        }
-        i = 0;
-        buzzer_enable = 1;
-    }
-    else
-    {
-        if (i >= music.notelen)
-        {
-            buzzer_enable = 0;
-            return;
-        }
-        if (music.notes[i])
-        {
-            PWMGenPeriodSet(PWM0_BASE, PWM_GEN_3, ui32SysClock / music.notes[i]);
-            PWMPulseWidthSet(PWM0_BASE, PWM_OUT_7, ui32SysClock / music.notes[i] / 4);
-            PWMOutputState(PWM0_BASE, PWM_OUT_7_BIT, true);
-        }
-        inner_timer_start(INNERTIMER_BUZZER, music.notetime[i]);
-        i++;
-    }
+    seq_stop();
 }
 
 /* ================================================================
@@ -600,67 +903,22 @@ void clock_get_time(dgtclock_t *clock, char *buf)
 void clock_display_date(dgtclock_t *clock)
 {
     /* Format: yyyy.mm.dd */
-    int i, bits[8];
-    uint8_t mask = 0x80, seg_dot = 0x00;
-    bits[0] = clock->mday % 10, bits[1] = clock->mday / 10;
-    bits[2] = (clock->month + 1) % 10, bits[3] = (clock->month + 1) / 10;
-    bits[4] = clock->year % 10, bits[5] = clock->year / 10 % 10;
-    bits[6] = clock->year / 100 % 10, bits[7] = clock->year / 1000;
-    if (!global_flip)
-    {
-        for (i = 0; i < 8; i++, mask >>= 1)
-        {
-            seg_dot = (i == 2 || i == 4) ? 0x80 : 0x00;
-            I2C0_WriteByte(TCA6424_I2CADDR, TCA6424_OUTPUT_PORT2, 0x00);
-            I2C0_WriteByte(TCA6424_I2CADDR, TCA6424_OUTPUT_PORT1, (seg7[bits[i]] | seg_dot));
-            I2C0_WriteByte(TCA6424_I2CADDR, TCA6424_OUTPUT_PORT2, mask & global_blink_mask);
-            Delay(1000);
-        }
-    }
-    else
-    {
-        mask = 0x01;
-        for (i = 0; i < 8; i++, mask <<= 1)
-        {
-            seg_dot = (i == 1 || i == 3) ? 0x80 : 0x00;
-            I2C0_WriteByte(TCA6424_I2CADDR, TCA6424_OUTPUT_PORT2, 0x00);
-            I2C0_WriteByte(TCA6424_I2CADDR, TCA6424_OUTPUT_PORT1, (flp7[bits[i]] | seg_dot));
-            I2C0_WriteByte(TCA6424_I2CADDR, TCA6424_OUTPUT_PORT2, mask & global_blink_mask);
-            Delay(1000);
-        }
-    }
+    char digits[8];
+    digits[0] = '0' + clock->mday % 10, digits[1] = '0' + clock->mday / 10;
+    digits[2] = '0' + (clock->month + 1) % 10, digits[3] = '0' + (clock->month + 1) / 10;
+    digits[4] = '0' + clock->year % 10, digits[5] = '0' + clock->year / 10 % 10;
+    digits[6] = '0' + clock->year / 100 % 10, digits[7] = '0' + clock->year / 1000;
+    seg7_render(digits, 8, 1 << 2 | 1 << 4, global_blink_mask, global_flip);
 }
 /* Display time once  */
 void clock_display_time(dgtclock_t *clock)
 {
     /* Format: hh.mm.ss*/
-    int i, bits[6];
-    uint8_t mask = 0x80, seg_dot = 0x00;
-    bits[0] = clock->sec % 10, bits[1] = clock->sec / 10;
-    bits[2] = clock->min % 10, bits[3] = clock->min / 10;
-    bits[4] = clock->hour % 10, bits[5] = clock->hour / 10;
-    if (!global_flip)
-    {
-        for (i = 0; i < 6; i++, mask >>= 1)
-        {
-            seg_dot = (i == 2 || i == 4) ? 0x80 : 0x00;
-            I2C0_WriteByte(TCA6424_I2CADDR, TCA6424_OUTPUT_PORT2, 0x00);
-            I2C0_WriteByte(TCA6424_I2CADDR, TCA6424_OUTPUT_PORT1, (seg7[bits[i]] | seg_dot));
-            I2C0_WriteByte(TCA6424_I2CADDR, TCA6424_OUTPUT_PORT2, mask & global_blink_mask);
-            Delay(1000);
-        }
-    }
-    else
-    {
-        for (i = 0, mask = 0x01; i < 6; i++, mask <<= 1)
-        {
-            seg_dot = (i == 1 || i == 3) ? 0x80 : 0x00;
-            I2C0_WriteByte(TCA6424_I2CADDR, TCA6424_OUTPUT_PORT2, 0x00);
-            I2C0_WriteByte(TCA6424_I2CADDR, TCA6424_OUTPUT_PORT1, (flp7[bits[i]] | seg_dot));
-            I2C0_WriteByte(TCA6424_I2CADDR, TCA6424_OUTPUT_PORT2, mask & global_blink_mask);
-            Delay(1000);
-        }
-    }
+    char digits[6];
+    digits[0] = '0' + clock->sec % 10, digits[1] = '0' + clock->sec / 10;
+    digits[2] = '0' + clock->min % 10, digits[3] = '0' + clock->min / 10;
+    digits[4] = '0' + clock->hour % 10, digits[5] = '0' + clock->hour / 10;
+    seg7_render(digits, 6, 1 << 2 | 1 << 4, global_blink_mask, global_flip);
 }
 /* modify clock value with incr caused by button press
  * clock - clock to modify
@@ -683,11 +941,15 @@ void clock_button_increase(dgtclock_t *clock, int incr, int ptr)
         break;
     case 4:
         clock->year = (clock->year + incr + 10000) % 10000;
+        if (clock->mday > month_days(clock->month, clock->year))
+            clock->mday = month_days(clock->month, clock->year);
         clock_init(clock, clock->sec, clock->min, clock->hour,
                    clock->mday, clock->month, clock->year);
         break;
     case 5:
         clock->month = (clock->month + incr + 12) % 12;
+        if (clock->mday > month_days(clock->month, clock->year))
+            clock->mday = month_days(clock->month, clock->year);
         clock_init(clock, clock->sec, clock->min, clock->hour,
                    clock->mday, clock->month, clock->year);
         break;
@@ -701,6 +963,172 @@ void clock_button_increase(dgtclock_t *clock, int incr, int ptr)
         break;
     }
 }
+/* Days of a month, month 0~11 */
+int month_days(int month, int year)
+{
+    static const int days[12] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+    int leap = (year % 100 && year % 4 == 0) || (year % 400 == 0);
+    return days[month] + (month == MONTH_FEB && leap);
+}
+/* Time of the global clock at a recent hwclock tick, us since 1970 */
+int64_t clock_time_us(uint64_t ticks)
+{
+    int64_t days, sec;
+    uint64_t start;
+    bool masked = IntMasterDisable();
+
+    days = (int64_t)days_from_civil(clock.year, clock.month, clock.mday) -
+           days_from_civil(1970, MONTH_JAN, 1);
+    sec = ((days * 24 + clock.hour) * 60 + clock.min) * 60 + clock.sec;
+    start = clock_sec_ticks;
+    if (!masked)
+        IntMasterEnable();
+    return sec * 1000000 + (int64_t)(ticks - start) / (HWCLOCK_FREQ / 1000000);
+}
+/* Step the global clock to a time, us since 1970
+ *  0 - set ok
+ * -1 - out of years 0~9999
+ */
+int clock_step_us(int64_t us)
+{
+    int64_t sec = us / 1000000;
+    int32_t frac = (int32_t)(us % 1000000), sod, left;
+    int year, month, mday;
+    bool masked;
+
+    if (us < 0)
+        return -1;
+    civil_from_days((uint32_t)(sec / 86400 + days_from_civil(1970, MONTH_JAN, 1)), &year, &month, &mday);
+    if (year < 0 || year > 9999)
+        return -1;
+    sod = (int32_t)(sec % 86400);
+    /* The second ends after systick_1000ms_counter + 1 ticks */
+    left = (1000000 - frac + 500) / 1000;
+    if (left < 1)
+        left = 1;
+    masked = IntMasterDisable();
+    clock_init(&clock, sod % 60, sod / 60 % 60, sod / 3600, mday, month, year);
+    systick_1000ms_counter = left - 1;
+    clock_sec_ticks = hwclock_ticks() - (uint64_t)frac * (HWCLOCK_FREQ / 1000000);
+    if (!masked)
+        IntMasterEnable();
+    return 0;
+}
+
+/* ================================================================
+ * Time sync methods
+ * ================================================================
+ * The device is the client of an NTP-style exchange with the host:
+ *   sync            device sends "sync,<seq>", T1 when the last bit left
+ *   sync seq t2 t3  host: T2 when it got the line, T3 when its reply left
+ *                   device: T4 when the end of the reply came in
+ * offset = ((T2 - T1) + (T3 - T4)) / 2, delay = (T4 - T1) - (T3 - T2)
+ */
+static uint32_t sync_seq;
+static int64_t sync_t1;
+static bool sync_waiting;
+
+/* Send a request; T1 is taken by sync_sent at the end of
+ * transmission interrupt once the UART has shifted it out */
+void sync_request()
+{
+    char buf[32];
+    sync_seq++;
+    sync_waiting = false;
+    sprintf(buf, "sync,%u\n", sync_seq);
+    UARTStringPut((byte *)buf);
+    UARTIntEnable(UART0_BASE, UART_INT_TX);
+}
+/* The UART went idle after a request, called from UART0_Handler */
+static void sync_sent(void)
+{
+    sync_t1 = clock_time_us(hwclock_ticks());
+    UARTIntDisable(UART0_BASE, UART_INT_TX);
+    UARTIntClear(UART0_BASE, UART_INT_TX);
+    sync_waiting = true;
+}
+/* Signed microseconds as seconds with 6 decimals, the whole calendar
+ * does not fit in 32 bits */
+static int sprint_us(char *buf, int64_t us)
+{
+    uint64_t u = us < 0 ? -(uint64_t)us : (uint64_t)us;
+    return sprintf(buf, "%s%llu.%06u", us < 0 ? "-" : "", (unsigned long long)(u / 1000000),
+                   (uint32_t)(u % 1000000));
+}
+/* Take the reply to the pending request, T4 is the end of its line.
+ * Output: sync,<offset s>,<delay s>,<slew/step/drop>
+ *  0 - applied
+ * -1 - no request pending with this seq
+ * -2 - dropped, delay out of 0 ~ SYNC_MAX_DELAY_US or time out of range
+ */
+int sync_reply(uint32_t seq, int64_t t2, int64_t t3)
+{
+    static uint64_t cal_last_ms;
+    int64_t t4 = clock_time_us(uart_rx_ticks), offset, delay, now;
+    uint64_t ref_ms;
+    const char *action = "slew";
+    char buf[80];
+    int len;
+
+    if (!sync_waiting || seq != sync_seq)
+        return -1;
+    sync_waiting = false;
+    offset = ((t2 - sync_t1) + (t3 - t4)) / 2;
+    delay = (t4 - sync_t1) - (t3 - t2);
+
+    if (delay < 0 || delay > SYNC_MAX_DELAY_US)
+        action = "drop";
+    else if (offset > SYNC_STEP_US || offset < -SYNC_STEP_US)
+    {
+        now = clock_time_us(hwclock_ticks());
+        if (clock_step_us(now + offset) < 0)
+            action = "drop";
+        else
+        {
+            sync_slew_us = 0;
+            action = "step";
+        }
+    }
+    else
+        sync_slew_us = (int32_t)offset;
+    len = sprintf(buf, "sync,");
+    len += sprint_us(buf + len, offset);
+    buf[len++] = ',';
+    len += sprint_us(buf + len, delay);
+    sprintf(buf + len, ",%s\n", action);
+    UARTStringPut((byte *)buf);
+    if (*action == 'd')
+        return -2;
+
+    /* Host time at the end of the reply, as a calibration reference */
+    ref_ms = (uint64_t)(t3 + delay / 2) / 1000;
+    if (!cal_last_ms || ref_ms - cal_last_ms >= SYNC_CAL_INTERVAL_MS)
+    {
+        cal_last_ms = ref_ms;
+        cal_ref(ref_ms);
+    }
+    return 0;
+}
+/* Called at the end of every clock second, returns the ticks to add
+ * to the next one while an offset is being slewed */
+int sync_slew_adjust()
+{
+    static int secs;
+    if (++secs < SYNC_SLEW_SECS)
+        return 0;
+    secs = 0;
+    if (sync_slew_us >= 500)
+    {
+        sync_slew_us -= 1000;
+        return -1;
+    }
+    if (sync_slew_us <= -500)
+    {
+        sync_slew_us += 1000;
+        return 1;
+    }
+    return 0;
+}
 
 /* ================================================================
  * Alarm methods
@@ -734,61 +1162,30 @@ void alarm_get(alarm_t *alarm, char *buf)
 /* Display alarm once */
 void alarm_display(alarm_t *alarm)
 {
-    /* Format: AL xx.yy.zz */
-    int i, bits[8];
-    uint8_t mask, seg_dot = 0x00;
-    bits[0] = alarm->sec % 10, bits[1] = alarm->sec / 10;
-    bits[2] = alarm->min % 10, bits[3] = alarm->min / 10;
-    bits[4] = alarm->hour % 10, bits[5] = alarm->hour / 10;
-    bits[6] = 'L' - 'A' + 10, bits[7] = 'A' - 'A' + 10;
-    if (!global_flip)
-    {
-        for (i = 0, mask = 0x80; i < 8; i++, mask >>= 1)
-        {
-            seg_dot = (i == 2 || i == 4) ? 0x80 : 0x00;
-            I2C0_WriteByte(TCA6424_I2CADDR, TCA6424_OUTPUT_PORT2, 0x00);
-            I2C0_WriteByte(TCA6424_I2CADDR, TCA6424_OUTPUT_PORT1, (seg7[bits[i]] | seg_dot));
-            I2C0_WriteByte(TCA6424_I2CADDR, TCA6424_OUTPUT_PORT2, mask & (global_blink_mask | 0x03));
-            Delay(1000);
-        }
-    }
-    else
-    {
-        for (i = 0, mask = 0x01; i < 8; i++, mask <<= 1)
-        {
-            seg_dot = (i == 1 || i == 3) ? 0x80 : 0x00;
-            I2C0_WriteByte(TCA6424_I2CADDR, TCA6424_OUTPUT_PORT2, 0x00);
-            I2C0_WriteByte(TCA6424_I2CADDR, TCA6424_OUTPUT_PORT1, (flp7[bits[i]] | seg_dot));
-            I2C0_WriteByte(TCA6424_I2CADDR, TCA6424_OUTPUT_PORT2, mask & (global_blink_mask | 0x03));
-            Delay(1000);
-        }
-    }
+    /* Format: AL xx.yy.zz, the label never blinks */
+    char digits[8];
+    digits[0] = '0' + alarm->sec % 10, digits[1] = '0' + alarm->sec / 10;
+    digits[2] = '0' + alarm->min % 10, digits[3] = '0' + alarm->min / 10;
+    digits[4] = '0' + alarm->hour % 10, digits[5] = '0' + alarm->hour / 10;
+    digits[6] = 'L', digits[7] = 'A';
+    seg7_render(digits, 8, 1 << 2 | 1 << 4, global_blink_mask | 0xc0, global_flip);
 }
+/* Start ringing when the clock reaches the alarm time, once per match */
 void alarm_go_off(alarm_t *alarm, dgtclock_t *clock)
 {
-    pitch_t notes[7] = {C4, D4, E4, F4, G4, A4, B4};
-    int ntime[7] = {400, 400, 400, 400, 400, 400, 400};
+    static int fired = 0;
 
     if (!alarm->enable || alarm->hour != clock->hour ||
         alarm->min != clock->min || alarm->sec != clock->sec)
-        return;
-
-    global_display_mode = 2;
-    global_modify_mode = global_modify_ptr = 0;
-    inner_timer_start(INNERTIMER_ALARM, 10000);
-    while (inner_timer_status(INNERTIMER_ALARM) && !BUTTON_EVENT_ENABLE)
     {
-        events_catch();
-        if (systick_500ms_status)
-            alarm_display(alarm);
-        else
-            I2C0_WriteByte(TCA6424_I2CADDR, TCA6424_OUTPUT_PORT2, 0x00);
-        if (!buzzer_enable)
-            buzzer_music_nonblocking(7, notes, ntime, 1);
+        fired = 0;
+        return;
     }
-    events_clear();
-    buzzer_off();
-    global_display_mode = 0;
+    if (fired)
+        return;
+    fired = 1;
+    UARTStringPut("\n>>> Alarm is going off!\n");
+    ring_start(RING_SRC_ALARM);
 }
 /* modify alarm value with incr caused by button press
  * alarm - alarm to modify
@@ -823,28 +1220,32 @@ void timer_init(timer_t *timer, int millisec, int sec, int min)
     timer->sec = sec;
     timer->min = min;
 }
-/* Update timer when counting down */
+/* Refresh millisec/sec/min from the deadline when counting down */
 void timer_update(timer_t *timer)
 {
-    if (timer->millisec + timer->sec + timer->min == 0)
+    uint64_t now;
+    uint32_t ms = 0;
+    if (!timer->enable)
         return;
-    if (timer->millisec < 0)
-    {
-        timer->sec--;
-        timer->millisec = 999;
-    }
-    if (timer->sec < 0)
-    {
-        timer->min--;
-        timer->sec = 59;
-    }
-    /* Time up */
-    if (timer->min < 0)
-    {
-        timer->millisec = 0;
-        timer->sec = 0;
-        timer->min = 0;
-    }
+    now = hwclock_ticks();
+    if (now < timer->deadline)
+        ms = hwclock_ticks_to_ms(timer->deadline - now);
+    timer->millisec = ms % 1000;
+    timer->sec = ms / 1000 % 60;
+    timer->min = ms / 60000;
+}
+/* Arm the deadline from the remaining time */
+void timer_start(timer_t *timer)
+{
+    timer->deadline = hwclock_ticks() +
+                      hwclock_ms_to_ticks((timer->min * 60 + timer->sec) * 1000 + timer->millisec);
+    timer->enable = true;
+}
+/* Save the remaining time */
+void timer_pause(timer_t *timer)
+{
+    timer_update(timer);
+    timer->enable = false;
 }
 /* Wrapped enable function */
 void timer_enable(timer_t *timer)
@@ -856,41 +1257,53 @@ void timer_enable(timer_t *timer)
     else
     {
         UARTStringPut("Start countdown\n");
-        timer->enable = true;
+        timer_start(timer);
     }
 }
 /* Display timer once */
 void timer_display(timer_t *timer)
 {
-    /* Format: cd xx.yy.zz*/
-    int i, bits[8];
-    uint8_t mask = 0x80, seg_dot = 0x00;
-    bits[0] = timer->millisec / 10 % 10, bits[1] = timer->millisec / 100;
-    bits[2] = timer->sec % 10, bits[3] = timer->sec / 10;
-    bits[4] = timer->min % 10, bits[5] = timer->min / 10;
-    bits[6] = 'D' - 'A' + 10, bits[7] = 'C' - 'A' + 10;
-    if (!global_flip)
+    /* Format: cd xx.yy.zz, the label never blinks */
+    char digits[8];
+    timer_update(timer);
+    digits[0] = '0' + timer->millisec / 10 % 10, digits[1] = '0' + timer->millisec / 100;
+    digits[2] = '0' + timer->sec % 10, digits[3] = '0' + timer->sec / 10;
+    digits[4] = '0' + timer->min % 10, digits[5] = '0' + timer->min / 10;
+    digits[6] = 'd', digits[7] = 'C';
+    seg7_render(digits, 8, 1 << 2 | 1 << 4, global_blink_mask | 0xc0, global_flip);
+}
+/* Display stopwatch once */
+void stwatch_display()
+{
+    /* Format: hh.mm.ss.cc */
+    char digits[8];
+    uint32_t ms = hwclock_ticks_to_ms(stwatch_elapsed());
+    digits[0] = '0' + ms / 10 % 10, digits[1] = '0' + ms / 100 % 10;
+    digits[2] = '0' + ms / 1000 % 10, digits[3] = '0' + ms / 10000 % 6;
+    digits[4] = '0' + ms / 60000 % 10, digits[5] = '0' + ms / 600000 % 6;
+    digits[6] = '0' + ms / 3600000 % 10, digits[7] = '0' + ms / 36000000 % 10;
+    seg7_render(digits, 8, 1 << 2 | 1 << 4 | 1 << 6, global_blink_mask, global_flip);
+}
+/* Display countdown cd1~cd3 once */
+void cdown_display(int id)
+{
+    /* Format: cN mm.ss.cc, or cN hh.mm.ss above one hour */
+    char digits[8];
+    uint32_t ms = cdown_remain_ms(id), s = ms / 1000;
+    if (ms >= 3600000)
     {
-        for (i = 0; i < 8; i++, mask >>= 1)
-        {
-            seg_dot = (i == 2 || i == 4) ? 0x80 : 0x00;
-            I2C0_WriteByte(TCA6424_I2CADDR, TCA6424_OUTPUT_PORT2, 0x00);
-            I2C0_WriteByte(TCA6424_I2CADDR, TCA6424_OUTPUT_PORT1, (seg7[bits[i]] | seg_dot));
-            I2C0_WriteByte(TCA6424_I2CADDR, TCA6424_OUTPUT_PORT2, mask & (global_blink_mask | 0x03));
-            Delay(1000);
-        }
+        digits[0] = '0' + s % 10, digits[1] = '0' + s / 10 % 6;
+        digits[2] = '0' + s / 60 % 10, digits[3] = '0' + s / 600 % 6;
+        digits[4] = '0' + s / 3600 % 10, digits[5] = '0' + s / 36000 % 10;
     }
     else
     {
-        for (i = 0, mask = 0x01; i < 8; i++, mask <<= 1)
-        {
-            seg_dot = (i == 1 || i == 3) ? 0x80 : 0x00;
-            I2C0_WriteByte(TCA6424_I2CADDR, TCA6424_OUTPUT_PORT2, 0x00);
-            I2C0_WriteByte(TCA6424_I2CADDR, TCA6424_OUTPUT_PORT1, (flp7[bits[i]] | seg_dot));
-            I2C0_WriteByte(TCA6424_I2CADDR, TCA6424_OUTPUT_PORT2, mask & (global_blink_mask | 0x03));
-            Delay(1000);
-        }
+        digits[0] = '0' + ms / 10 % 10, digits[1] = '0' + ms / 100 % 10;
+        digits[2] = '0' + s % 10, digits[3] = '0' + s / 10 % 6;
+        digits[4] = '0' + s / 60 % 10, digits[5] = '0' + s / 600 % 10;
     }
+    digits[6] = '1' + id, digits[7] = 'C';
+    seg7_render(digits, 8, 1 << 2 | 1 << 4, global_blink_mask, global_flip);
 }
 /* modify timer value with incr caused by button press
  * timer - timer to modify
@@ -899,6 +1312,8 @@ void timer_display(timer_t *timer)
  */
 void timer_button_increase(timer_t *timer, int incr, int ptr)
 {
+    bool running = timer->enable;
+    timer_pause(timer);
     switch (ptr)
     {
     case 1:
@@ -913,43 +1328,114 @@ void timer_button_increase(timer_t *timer, int incr, int ptr)
     default:
         break;
     }
+    if (running)
+        timer_start(timer);
 }
+/* Start ringing when the countdown reaches its deadline */
 void timer_go_off(timer_t *timer)
 {
-    pitch_t notes[7] = {C4, D4, E4, F4, G4, A4, B4};
-    int ntime[7] = {100, 100, 100, 100, 100, 100, 100};
-
-    if (!timer->enable || timer->millisec || timer->sec || timer->min)
+    if (!timer->enable || hwclock_ticks() < timer->deadline)
         return;
     timer->enable = false;
+    timer->millisec = timer->sec = timer->min = 0;
     UARTStringPut("\n>>> Time is up!\n");
+    ring_start(RING_SRC_TIMER);
+}
 
-    global_display_mode = 3;
+/* ================================================================
+ * Ring methods
+ *   Ringing is advanced by ring_service() from the main loop, so
+ *   the CLI, buttons and the other sources keep running meanwhile.
+ *   src = -1 applies to every source.
+ * ================================================================ */
+void ring_start(int src)
+{
+    rings[src].state = RING_ACTIVE;
+    rings[src].until = systick_ms + rings[src].ring_ms;
+    global_display_mode = rings[src].page;
     global_modify_mode = global_modify_ptr = 0;
-    inner_timer_start(INNERTIMER_TIMER, 5000);
-
-    while (inner_timer_status(INNERTIMER_TIMER) && !BUTTON_EVENT_ENABLE)
-    {
-        events_catch();
-        if (systick_500ms_status)
-            timer_display(timer);
-        else
-            I2C0_WriteByte(TCA6424_I2CADDR, TCA6424_OUTPUT_PORT2, 0x00);
-        if (!buzzer_enable)
-            buzzer_music_nonblocking(7, notes, ntime, 1);
-    }
-    events_clear();
+    update_blink_mask((uint8_t *)&global_blink_mask, global_modify_ptr);
     buzzer_off();
-    global_display_mode = 0;
 }
-/*
-    Corresponding to the startup_TM4C129.s vector table systick interrupt program name
-*/
-void SysTick_Handler(void)
+void ring_stop(int src)
+{
+    int i;
+    for (i = 0; i < RING_SRC_NUM; i++)
+    {
+        if ((src >= 0 && i != src) || rings[i].state == RING_IDLE)
+            continue;
+        if (rings[i].state == RING_ACTIVE)
+            global_display_mode = 0;
+        rings[i].state = RING_IDLE;
+    }
+    if (!ring_active())
+        buzzer_off();
+}
+void ring_snooze(int src)
+{
+    int i;
+    char buf[64];
+    for (i = 0; i < RING_SRC_NUM; i++)
+    {
+        if ((src >= 0 && i != src) || rings[i].state != RING_ACTIVE)
+            continue;
+        rings[i].state = RING_SNOOZED;
+        rings[i].until = systick_ms + ring_snooze_sec * 1000;
+        sprintf(buf, "Snooze %s for %d:%02d\n", rings[i].name,
+                ring_snooze_sec / 60, ring_snooze_sec % 60);
+        UARTStringPut((byte *)buf);
+        global_display_mode = 0;
+    }
+    if (!ring_active())
+        buzzer_off();
+}
+/* Advance ringing states, keep the ringtone playing */
+void ring_service()
+{
+    int i, playing = -1;
+    for (i = 0; i < RING_SRC_NUM; i++)
+    {
+        if (rings[i].state != RING_IDLE && (int32_t)(systick_ms - rings[i].until) >= 0)
+        {
+            if (rings[i].state == RING_SNOOZED)
+                ring_start(i);
+            else
+                ring_stop(i);
+        }
+        if (rings[i].state == RING_ACTIVE)
+            playing = i;
+    }
+    if (playing >= 0 && !seq_playing())
+        seq_play(rings[playing].tone, true);
+}
+/* Whether any source is ringing */
+int ring_active()
+{
+    int i;
+    for (i = 0; i < RING_SRC_NUM; i++)
+        if (rings[i].state == RING_ACTIVE)
+            return 1;
+    return 0;
+}
+/* Find source id by name
+ * -1 - not found
+ */
+int ring_find(const char *name)
+{
+    int i;
+    for (i = 0; i < RING_SRC_NUM; i++)
+        if (!strcasecmp(name, rings[i].name))
+            return i;
+    return -1;
+}
+/* Work of the 1 kHz tick */
+static void systick_service(void)
 {
     static uint32_t timestamp = 0, duration = 0;
     char buf[MAXLINE];
+    uint32_t t0;
     timestamp++;
+    systick_ms++;
 
     /* Handle button counter on red panel */
     if (BUTTON_EVENT_USR0_PRESSED)
@@ -975,19 +1461,10 @@ void SysTick_Handler(void)
         GPIOPinWrite(GPIO_PORTN_BASE, GPIO_PIN_0, 0);
     }
 
-    /* Whether run countdown */
-    if (timer.enable)
-    {
-        if (!global_modify_mode || global_display_mode != 3)
-            timer.millisec--;
-        timer_update(&timer);
-    }
-
     /* Handle timeout */
-    inner_timer_update();
-
-    if (buzzer_enable && !inner_timer_status(INNERTIMER_BUZZER))
-        buzzer_music_nonblocking(0, NULL, NULL, 0);
+    t0 = DWT_CYCLES();
+    twheel_tick();
+    twheel_tick_cycles = DWT_CYCLES() - t0;
 
     if (systick_1000ms_counter != 0)
     {
@@ -995,20 +1472,22 @@ void SysTick_Handler(void)
     }
     else
     {
-        systick_1000ms_counter = SYSTICK_FREQUENCY;
+        /* Warped, a clock second every SYSTICK_FREQUENCY / sim_warp ticks,
+         * otherwise a tick more or less now and then as calibrated or
+         * while slewing */
+        systick_1000ms_counter = SYSTICK_FREQUENCY / sim_warp - 1 +
+                                 (sim_warp > 1 ? 0 : cal_tick_adjust() + sync_slew_adjust());
+        clock_sec_ticks = hwclock_ticks();
         systick_1000ms_status = 1;
         if (!global_modify_mode || global_display_mode != 0)
             clock.sec++;
         clock_update(&clock);
 
-        if (global_already)
+        /* Not while warped, the next real-time store anchors the clock again */
+        if (global_already && sim_warp == 1 && clock.sec % 2 == 0)
         {
-            HibernateRTCMatchSet(0, HibernateRTCGet());
-            if (clock.sec % 2 == 0)
-            {
-                hibernation_data_store(&clock, &alarm, &timer);
-                // print_log();
-            }
+            hibernation_data_store(&clock, &alarm, &timer);
+            // print_log();
         }
     }
 
@@ -1032,38 +1511,40 @@ void SysTick_Handler(void)
         update_blink_mask((uint8_t *)&global_blink_mask, global_modify_ptr);
     }
 }
+/*
+    Corresponding to the startup_TM4C129.s vector table systick interrupt program name
+*/
+void SysTick_Handler(void)
+{
+    uint32_t t0 = isr_tick_enter();
+    PROF_CALL(PROF_SYSTICK, systick_service());
+    isr_exit(ISR_SYSTICK, t0);
+}
 
-/* Parse the command string received
+/* Parse the command string received, argv[] is malloc'ed
  *  0 - parse succeeded
- * -1 - parse failed
+ * -1 - empty line
+ * -2 - too many arguments or out of memory
  */
 int parse_command(char *cmd, int *argc, char *argv[])
 {
-    char buf[MAXLINE];
-    int len = -1, k;
+    int len;
     SKIP_BLANK(cmd);
-    while (len && *argc <= MAXARGS)
+    while (!IS_END(cmd))
     {
-        k = *argc;
+        if (*argc == MAXARGS)
+            return -2;
         len = 0;
         while (!IS_BLANK(cmd + len) && !IS_END(cmd + len))
             len++;
-        if (len)
-        {
-            argv[k] = (char *)malloc(len + 5);
-            strncpy(argv[k], cmd, len);
-            argv[k][len] = '\0';
-            (*argc)++;
-            cmd += len;
-            SKIP_BLANK(cmd);
-        }
-    }
-    if (*argc > MAXARGS)
-    {
-        sprintf(buf, "argc = %d\n", *argc);
-        UARTStringPut((byte *)buf);
-        UARTStringPut("Command parse error: too many arguments\n");
-        return -1;
+        argv[*argc] = (char *)malloc(len + 1);
+        if (!argv[*argc])
+            return -2;
+        strncpy(argv[*argc], cmd, len);
+        argv[*argc][len] = '\0';
+        (*argc)++;
+        cmd += len;
+        SKIP_BLANK(cmd);
     }
     if (!(*argc))
     {
@@ -1081,10 +1562,28 @@ int execute_command(int argc, char *argv[])
     if (!strcmp(argv[0], "?"))
     {
         UARTStringPut("Available commands:\n");
-        UARTStringPut("\tinit clock                       : intialize the clock to 00:00:00\n");
-        UARTStringPut("\tget <TIME/DATE/ALARM>            : get status\n");
-        UARTStringPut("\tset <TIME/ALARM/DATE> <xx:xx:xx> : set clock status\n");
-        UARTStringPut("\trun <TIME/DATE/STWATCH>          : run functions\n");
+        UARTStringPut("\tinit <CLOCK/STWATCH>             : intialize the clock to 00:00:00\n");
+        UARTStringPut("\tget <TIME/DATE/ALARM/LAPS/CDn/EEPROM/HIBERNATE> : get status\n");
+        UARTStringPut("\tset <TIME/ALARM/DATE/CDn> <xx:xx:xx> : set clock status\n");
+        UARTStringPut("\trun <TIME/DATE/STWATCH/CDn>      : run functions\n");
+        UARTStringPut("\tlap                              : record a stopwatch lap\n");
+        UARTStringPut("\ttone [ALARM/CDOWN/CDn/PLAY] [name] : list, select or play ringtones\n");
+        UARTStringPut("\ttone upload                      : send a RTTTL melody as tone 'user'\n");
+        UARTStringPut("\tstop [ALARM/CDOWN/CDn]           : dismiss the ringing\n");
+        UARTStringPut("\tsnooze [ALARM/CDOWN/CDn]         : snooze the ringing\n");
+        UARTStringPut("\tboot stats                       : time of every boot stage\n");
+        UARTStringPut("\tprof                             : print and reset the hot-path cycles\n");
+        UARTStringPut("\tisr                              : print and reset the ISR timing histograms\n");
+        UARTStringPut("\ti2c stats                        : I2C transactions, faults and latency\n");
+        UARTStringPut("\tsim warp <n> / sim press <button> : virtual time and scripted buttons\n");
+        UARTStringPut("\tbench [SAVE]                     : benchmark the core routines\n");
+        UARTStringPut("\tdisp <TRACE/DECODE/DUMP/STOP>    : trace and decode the display output\n");
+        UARTStringPut("\tfuzz [n]                         : feed mutated lines to the command parser\n");
+        UARTStringPut("\tcalcheck [from to]               : check the calendar against a reference\n");
+        UARTStringPut("\tcal [ref <sec>[.ms]/reset]       : calibrate the RTC and tick from host time\n");
+        UARTStringPut("\tsync [seq t2 t3]                 : NTP-style time sync with the host\n");
+        UARTStringPut("\tcpu [16/20/60/120/auto]          : system clock profile, loop rate\n");
+        UARTStringPut("\tshow <\"text\" [step ms]/stop>     : show or scroll a text on the display\n");
         return 0;
     }
     /* Execute INIT command */
@@ -1096,9 +1595,17 @@ int execute_command(int argc, char *argv[])
             UARTStringPut("Clock reset to 2000-1-1-00:00:00\n");
             return 0;
         }
+        else if (argc == 2 && !strcasecmp(argv[1], "stwatch"))
+        {
+            stwatch_stop();
+            stwatch_reset();
+            UARTStringPut("Stopwatch reset\n");
+            return 0;
+        }
         else
         {
-            UARTStringPut("Usage: init clock\n");
+            UARTStringPut("Usage: init clock   - reset the clock\n");
+            UARTStringPut("       init stwatch - reset the stopwatch and its laps\n");
             return -1;
         }
     }
@@ -1107,7 +1614,12 @@ int execute_command(int argc, char *argv[])
     {
         bool valid = (argc == 2) && (!strcasecmp(argv[1], "time") ||
                                      !strcasecmp(argv[1], "date") ||
-                                     !strcasecmp(argv[1], "alarm"));
+                                     !strcasecmp(argv[1], "alarm") ||
+                                     !strcasecmp(argv[1], "snooze") ||
+                                     !strcasecmp(argv[1], "laps") ||
+                                     !strcasecmp(argv[1], "eeprom") ||
+                                     !strcasecmp(argv[1], "hibernate") ||
+                                     cdown_find(argv[1]) >= 0);
         if (valid)
         {
             if (!strcasecmp(argv[1], "time"))
@@ -1115,6 +1627,31 @@ int execute_command(int argc, char *argv[])
                 clock_get_time(&clock, buf);
                 UARTStringPut((byte *)buf);
             }
+            else if (!strcasecmp(argv[1], "laps"))
+            {
+                stwatch_get_laps();
+            }
+            else if (!strcasecmp(argv[1], "eeprom"))
+            {
+                persist_get_stats();
+            }
+            else if (!strcasecmp(argv[1], "hibernate"))
+            {
+                sprintf(buf, "Boots %u, resets %u\n", hbn_last.boot_count, hbn_last.reset_count);
+                UARTStringPut((byte *)buf);
+                hbnrec_get_stats();
+            }
+            else if (cdown_find(argv[1]) >= 0)
+            {
+                cdown_get(cdown_find(argv[1]), buf);
+                UARTStringPut((byte *)buf);
+            }
+            else if (!strcasecmp(argv[1], "snooze"))
+            {
+                sprintf(buf, "Snooze %02d:%02d:%02d\n", ring_snooze_sec / 3600,
+                        ring_snooze_sec / 60 % 60, ring_snooze_sec % 60);
+                UARTStringPut((byte *)buf);
+            }
             else if (!strcasecmp(argv[1], "date"))
             {
                 clock_get_date(&clock, buf);
@@ -1132,6 +1669,11 @@ int execute_command(int argc, char *argv[])
             UARTStringPut("Usage: get time  - return clock time\n");
             UARTStringPut("       get date  - return clock date\n");
             UARTStringPut("       get alarm - return alarm status\n");
+            UARTStringPut("       get snooze - return snooze duration\n");
+            UARTStringPut("       get laps  - return stopwatch laps\n");
+            UARTStringPut("       get cd1   - return countdown cd1~cd3 status\n");
+            UARTStringPut("       get eeprom - return settings log usage and wear\n");
+            UARTStringPut("       get hibernate - return hibernate write statistics\n");
             return -1;
         }
     }
@@ -1141,7 +1683,9 @@ int execute_command(int argc, char *argv[])
         int xx, yy, zz;
         bool valid = (argc == 3) && (!strcasecmp(argv[1], "time") ||
                                      !strcasecmp(argv[1], "date") ||
-                                     !strcasecmp(argv[1], "alarm"));
+                                     !strcasecmp(argv[1], "alarm") ||
+                                     !strcasecmp(argv[1], "snooze") ||
+                                     cdown_find(argv[1]) >= 0);
         if (valid)
         {
             if (get_format_nums(argv[2], &xx, &yy, &zz) != 0)
@@ -1183,6 +1727,27 @@ int execute_command(int argc, char *argv[])
                 // global_display_mode = 2;
                 UARTStringPut("Alarm time set successfully\n");
             }
+            else if (!strcasecmp(argv[1], "snooze"))
+            {
+                if (xx < 0 || xx > 23 || yy < 0 || yy > 59 || zz < 0 || zz > 59 ||
+                    xx + yy + zz == 0)
+                {
+                    UARTStringPut("Invalid snooze duration\n");
+                    return -1;
+                }
+                ring_snooze_sec = (xx * 60 + yy) * 60 + zz;
+                UARTStringPut("Snooze duration set successfully\n");
+            }
+            else if (cdown_find(argv[1]) >= 0)
+            {
+                if (xx < 0 || xx > 99 || yy < 0 || yy > 59 || zz < 0 || zz > 59)
+                {
+                    UARTStringPut("Invalid countdown time\n");
+                    return -1;
+                }
+                cdown_set(cdown_find(argv[1]), ((xx * 60 + yy) * 60 + zz) * 1000);
+                UARTStringPut("Countdown time set successfully\n");
+            }
             return 0;
         }
         else
@@ -1190,6 +1755,8 @@ int execute_command(int argc, char *argv[])
             UARTStringPut("Usage: set date <year-month-day>       - set clock date\n");
             UARTStringPut("       set time <hh:mm:ss>/<hh-mm-ss>  - set clock time\n");
             UARTStringPut("       set alarm <hh:mm:ss>/<hh-mm-ss> - set alarm time\n");
+            UARTStringPut("       set snooze <hh:mm:ss>           - set snooze duration\n");
+            UARTStringPut("       set cd1 <hh:mm:ss>              - set countdown cd1~cd3\n");
             return -1;
         }
     }
@@ -1198,7 +1765,9 @@ int execute_command(int argc, char *argv[])
     {
         bool valid = (argc == 2) && (!strcasecmp(argv[1], "time") ||
                                      !strcasecmp(argv[1], "date") ||
-                                     !strcasecmp(argv[1], "cdown"));
+                                     !strcasecmp(argv[1], "cdown") ||
+                                     !strcasecmp(argv[1], "stwatch") ||
+                                     cdown_find(argv[1]) >= 0);
         if (valid)
         {
             if (!strcasecmp(argv[1], "time"))
@@ -1217,6 +1786,18 @@ int execute_command(int argc, char *argv[])
                 timer_enable(&timer);
                 // UARTStringPut("Display and start countdown\n");
             }
+            else if (!strcasecmp(argv[1], "stwatch"))
+            {
+                global_display_mode = DISPLAY_MODE_STWATCH;
+                stwatch_start();
+                UARTStringPut("Display and start stopwatch\n");
+            }
+            else if (cdown_find(argv[1]) >= 0)
+            {
+                global_display_mode = DISPLAY_MODE_CDOWN + cdown_find(argv[1]);
+                cdown_start(cdown_find(argv[1]));
+                UARTStringPut("Display and start countdown\n");
+            }
             global_modify_mode = 0;
             global_modify_ptr = 0;
             return 0;
@@ -1226,6 +1807,8 @@ int execute_command(int argc, char *argv[])
             UARTStringPut("Usage: run date  - display clock date\n");
             UARTStringPut("       run time  - display clock time\n");
             UARTStringPut("       run cdown - display and start timer countdown\n");
+            UARTStringPut("       run stwatch - display and start stopwatch\n");
+            UARTStringPut("       run cd1   - display and start countdown cd1~cd3\n");
             return -1;
         }
     }
@@ -1233,7 +1816,9 @@ int execute_command(int argc, char *argv[])
     else if (!strcasecmp(argv[0], "enable"))
     {
         bool valid = (argc == 2) && (!strcasecmp(argv[1], "alarm") ||
-                                     !strcasecmp(argv[1], "cdown"));
+                                     !strcasecmp(argv[1], "cdown") ||
+                                     !strcasecmp(argv[1], "stwatch") ||
+                                     cdown_find(argv[1]) >= 0);
         if (valid)
         {
             if (!strcasecmp(argv[1], "alarm"))
@@ -1246,12 +1831,24 @@ int execute_command(int argc, char *argv[])
                 timer_enable(&timer);
                 // UARTStringPut("Start countdown\n");
             }
+            else if (!strcasecmp(argv[1], "stwatch"))
+            {
+                stwatch_start();
+                UARTStringPut("Start stopwatch\n");
+            }
+            else if (cdown_find(argv[1]) >= 0)
+            {
+                cdown_start(cdown_find(argv[1]));
+                UARTStringPut("Start countdown\n");
+            }
             return 0;
         }
         else
         {
             UARTStringPut("Usage: enable alarm  - enable the alarm to go off\n");
             UARTStringPut("       enable cdown  - start timer countdown\n");
+            UARTStringPut("       enable stwatch - start stopwatch\n");
+            UARTStringPut("       enable cd1    - start countdown cd1~cd3\n");
             return -1;
         }
     }
@@ -1259,7 +1856,9 @@ int execute_command(int argc, char *argv[])
     else if (!strcasecmp(argv[0], "disable"))
     {
         bool valid = (argc == 2) && (!strcasecmp(argv[1], "alarm") ||
-                                     !strcasecmp(argv[1], "cdown"));
+                                     !strcasecmp(argv[1], "cdown") ||
+                                     !strcasecmp(argv[1], "stwatch") ||
+                                     cdown_find(argv[1]) >= 0);
         if (valid)
         {
             if (!strcasecmp(argv[1], "alarm"))
@@ -1269,7 +1868,17 @@ int execute_command(int argc, char *argv[])
             }
             else if (!strcasecmp(argv[1], "cdown"))
             {
-                timer.enable = false;
+                timer_pause(&timer);
+                UARTStringPut("Pause countdown\n");
+            }
+            else if (!strcasecmp(argv[1], "stwatch"))
+            {
+                stwatch_stop();
+                UARTStringPut("Stop stopwatch\n");
+            }
+            else if (cdown_find(argv[1]) >= 0)
+            {
+                cdown_stop(cdown_find(argv[1]));
                 UARTStringPut("Pause countdown\n");
             }
             return 0;
@@ -1278,8 +1887,399 @@ int execute_command(int argc, char *argv[])
         {
             UARTStringPut("Usage: disable alarm  - disable the alarm to go off\n");
             UARTStringPut("       disable cdown  - stop timer countdown\n");
+            UARTStringPut("       disable stwatch - stop stopwatch\n");
+            UARTStringPut("       disable cd1    - pause countdown cd1~cd3\n");
+            return -1;
+        }
+    }
+    /* Execute TONE command */
+    else if (!strcasecmp(argv[0], "tone"))
+    {
+        int i, src = (argc == 3) ? ring_find(argv[1]) : -1;
+        const tone_t *tone = (argc == 3) ? tone_find(argv[2]) : NULL;
+        if (argc == 1)
+        {
+            UARTStringPut("Tones:");
+            for (i = 0; i < TONE_NUM; i++)
+            {
+                UARTStringPut(" ");
+                UARTStringPut((byte *)tones[i].name);
+            }
+            if (tone_user.len)
+                UARTStringPut(" user");
+            UARTStringPut("\n");
+            for (i = 0; i < RING_SRC_NUM; i++)
+            {
+                sprintf(buf, "%-6s: %s\n", rings[i].name, rings[i].tone->name);
+                UARTStringPut((byte *)buf);
+            }
+            return 0;
+        }
+        if (argc == 2 && !strcasecmp(argv[1], "upload"))
+        {
+            tone_upload_begin();
+            UARTStringPut("Send RTTTL melody, end with Enter\n");
+            return 0;
+        }
+        if (tone && !strcasecmp(argv[1], "play"))
+        {
+            seq_play(tone, false);
+            return 0;
+        }
+        if (tone && src >= 0)
+        {
+            rings[src].tone = tone;
+            sprintf(buf, "Tone of %s set to %s\n", rings[src].name, tone->name);
+            UARTStringPut((byte *)buf);
+            return 0;
+        }
+        UARTStringPut("Usage: tone               - list tones and selections\n");
+        UARTStringPut("       tone alarm <name>  - select the alarm tone\n");
+        UARTStringPut("       tone cdown <name>  - select the countdown tone, also cd1~cd3\n");
+        UARTStringPut("       tone play <name>   - play a tone once\n");
+        UARTStringPut("       tone upload        - stream a RTTTL melody into tone 'user'\n");
+        return -1;
+    }
+    /* Execute LAP command */
+    else if (!strcasecmp(argv[0], "lap"))
+    {
+        if (argc != 1 || !stwatch.running)
+        {
+            UARTStringPut("Usage: lap - record a lap while the stopwatch runs\n");
+            return -1;
+        }
+        sprintf(buf, "Lap %d\n", stwatch_lap());
+        UARTStringPut((byte *)buf);
+        return 0;
+    }
+    /* Execute PROF command */
+    else if (!strcasecmp(argv[0], "prof"))
+    {
+        if (argc != 1)
+        {
+            UARTStringPut("Usage: prof - print and reset the cycles of the hot-path probes\n");
+            return -1;
+        }
+        prof_dump();
+        return 0;
+    }
+    /* Execute DISP command */
+    else if (!strcasecmp(argv[0], "disp"))
+    {
+        if (argc == 2 && !strcasecmp(argv[1], "trace"))
+        {
+            disptrace_start();
+            UARTStringPut("Tracing the display writes\n");
+            return 0;
+        }
+        else if (argc == 2 && !strcasecmp(argv[1], "stop"))
+        {
+            disptrace_stop();
+            return 0;
+        }
+        else if (argc == 2 && !strcasecmp(argv[1], "decode"))
+        {
+            disptrace_decode(global_flip);
+            return 0;
+        }
+        else if (argc == 2 && !strcasecmp(argv[1], "dump"))
+        {
+            disptrace_dump();
+            return 0;
+        }
+        UARTStringPut("Usage: disp trace  - start tracing the display writes\n");
+        UARTStringPut("       disp decode - characters, refresh, duty and ghosting of the trace\n");
+        UARTStringPut("       disp dump   - the trace records, for host/dispdec\n");
+        UARTStringPut("       disp stop   - stop tracing\n");
+        return -1;
+    }
+    /* Execute BENCH command */
+    else if (!strcasecmp(argv[0], "bench"))
+    {
+        if (argc == 1 || (argc == 2 && !strcasecmp(argv[1], "save")))
+        {
+            bench_pending = argc == 2 ? 2 : 1;
+            return 0;
+        }
+        UARTStringPut("Usage: bench      - time the core routines against the baseline of this MHz\n");
+        UARTStringPut("       bench save - also save the results as the new baseline\n");
+        return -1;
+    }
+    /* Execute FUZZ command */
+    else if (!strcasecmp(argv[0], "fuzz"))
+    {
+        int n = FUZZ_DEFAULT;
+        char *end = "";
+        if (argc == 2)
+            n = strtol(argv[1], &end, 10);
+        if (argc > 2 || *end || n < 1 || n > FUZZ_MAX)
+        {
+            UARTStringPut("Usage: fuzz [n] - parse n mutated command lines, 1~1000000\n");
+            return -1;
+        }
+        fuzz_pending = n;
+        return 0;
+    }
+    /* Execute CAL command */
+    else if (!strcasecmp(argv[0], "cal"))
+    {
+        if (argc == 1)
+        {
+            cal_get_stats();
+            return 0;
+        }
+        else if (argc == 2 && !strcasecmp(argv[1], "reset"))
+        {
+            cal_reset();
+            UARTStringPut("Calibration cleared, RTC trim back to nominal\n");
+            return 0;
+        }
+        else if (argc == 3 && !strcasecmp(argv[1], "ref") && isdigit((unsigned char)argv[2][0]))
+        {
+            char *end;
+            uint64_t ms = (uint64_t)strtoul(argv[2], &end, 10) * 1000;
+            int scale = 100;
+            /* Digits past the ms are dropped */
+            if (*end == '.')
+                for (end++; isdigit((unsigned char)*end); end++, scale /= 10)
+                    ms += (*end - '0') * scale;
+            if (!*end)
+            {
+                switch (cal_ref(ms))
+                {
+                case 1:
+                    UARTStringPut("Calibration applied\n");
+                    break;
+                case -1:
+                    UARTStringPut("Reference not after the last one, window restarted\n");
+                    break;
+                case -2:
+                    UARTStringPut("Fit too far off, not applied\n");
+                    break;
+                }
+                return 0;
+            }
+        }
+        UARTStringPut("Usage: cal                 - frequency errors and corrections in force\n");
+        UARTStringPut("       cal ref <sec>[.ms]  - host time reference, sent every minute or so\n");
+        UARTStringPut("       cal reset           - forget the calibration\n");
+        return -1;
+    }
+    /* Execute SYNC command */
+    else if (!strcasecmp(argv[0], "sync"))
+    {
+        char *end1 = "", *end2 = "", *end3 = "";
+        if (argc == 1 && sim_warp == 1 && !global_modify_mode)
+        {
+            sync_request();
+            return 0;
+        }
+        else if (argc == 4)
+        {
+            uint32_t seq = strtoul(argv[1], &end1, 10);
+            int64_t t2 = parse_us(argv[2], &end2), t3 = parse_us(argv[3], &end3);
+            if (!*end1 && !*end2 && !*end3 && t2 >= 0 && t3 >= 0)
+            {
+                if (sync_reply(seq, t2, t3) == -1)
+                    UARTStringPut("No sync request pending with this seq\n");
+                return 0;
+            }
+        }
+        UARTStringPut("Usage: sync                - send a time request, not while warped or editing\n");
+        UARTStringPut("       sync <seq> <t2> <t3> - host reply: receive and send time of the request, us\n");
+        return -1;
+    }
+    /* Execute CPU command */
+    else if (!strcasecmp(argv[0], "cpu"))
+    {
+        static const char *const names[CPU_PROFILE_NUM] = {"16", "20", "60", "120"};
+        int i;
+        if (argc == 1)
+        {
+            cpu_get_stats();
+            return 0;
+        }
+        if (argc == 2 && !strcasecmp(argv[1], "auto"))
+        {
+            cpu_pending = CPU_PROFILE_AUTO;
+            return 0;
+        }
+        for (i = 0; argc == 2 && i < CPU_PROFILE_NUM; i++)
+            if (!strcmp(argv[1], names[i]))
+            {
+                cpu_pending = i;
+                return 0;
+            }
+        UARTStringPut("Usage: cpu                - loop rate and time spent in every profile\n");
+        UARTStringPut("       cpu <16/20/60/120> - run the system clock at this MHz\n");
+        UARTStringPut("       cpu auto           - 120MHz for a while after a command or button, 16MHz idle\n");
+        return -1;
+    }
+    /* Execute SHOW command */
+    else if (!strcasecmp(argv[0], "show"))
+    {
+        static char text[MAXLINE];
+        bool quoted = argc > 1 && argv[1][0] == '"';
+        char *s = text, *end = "";
+        int i, len = 0, step = 0, ret;
+        if (argc == 2 && !strcasecmp(argv[1], "stop"))
+        {
+            text_stop();
+            return 0;
+        }
+        /* The parser splits on blanks, join the words back */
+        text[0] = '\0';
+        for (i = 1; i < argc; i++)
+        {
+            if (i > 1)
+                strcat(text, " ");
+            strcat(text, argv[i]);
+            len = strlen(text);
+            if (quoted && len > 1 && text[len - 1] == '"')
+            {
+                i++;
+                break;
+            }
+        }
+        if (quoted && len > 1 && text[len - 1] == '"')
+            text[len - 1] = '\0', s = text + 1;
+        else if (quoted)
+            i = -1;
+        if (i >= 1 && i < argc)
+            step = strtol(argv[i], &end, 10);
+        if (argc == 1 || i < 0 || i + 1 < argc || *end ||
+            (step && (step < TEXT_STEP_MIN || step > TEXT_STEP_MAX)))
+        {
+            UARTStringPut("Usage: show <text>             - show a text, scrolled if longer than 8 digits\n");
+            UARTStringPut("       show \"<text>\" [step ms] - scroll a step every 50~2000ms, 300 by default\n");
+            UARTStringPut("       show stop               - back to the clock\n");
+            return -1;
+        }
+        ret = text_show(s, step);
+        if (ret == -1)
+            UARTStringPut("Nothing to show\n");
+        else if (ret == -2)
+            UARTStringPut("Text too long, at most 64 digits\n");
+        else if (ret == -3)
+            UARTStringPut("No timer available\n");
+        return ret;
+    }
+    /* Execute CALCHECK command */
+    else if (!strcasecmp(argv[0], "calcheck"))
+    {
+        int from = 0, to = 9999;
+        char *end1 = "", *end2 = "";
+        if (argc == 3)
+        {
+            from = strtol(argv[1], &end1, 10);
+            to = strtol(argv[2], &end2, 10);
+        }
+        if ((argc != 1 && argc != 3) || *end1 || *end2 || from < 0 || to > 9999 || from > to)
+        {
+            UARTStringPut("Usage: calcheck [from to] - check the calendar over years 0~9999\n");
+            return -1;
+        }
+        calcheck_from = from, calcheck_to = to;
+        calcheck_pending = 1;
+        return 0;
+    }
+    /* Execute SIM command */
+    else if (!strcasecmp(argv[0], "sim"))
+    {
+        static const struct
+        {
+            const char *name;
+            int id;
+        } buttons[] = {{"toggle", BUTTON_ID_TOGGLE}, {"modify", BUTTON_ID_MODIFY},
+                       {"confirm", BUTTON_ID_CONFIRM}, {"add", BUTTON_ID_ADD},
+                       {"dec", BUTTON_ID_DEC}, {"enable", BUTTON_ID_ENABLE},
+                       {"flip", BUTTON_ID_FLIP}};
+        int i, warp;
+        char *end;
+
+        if (argc == 3 && !strcasecmp(argv[1], "warp"))
+        {
+            warp = strtol(argv[2], &end, 10);
+            if (!*end && warp >= 1 && warp <= SYSTICK_FREQUENCY)
+            {
+                sim_warp = warp;
+                sprintf(buf, "Clock runs %dx real time%s\n", warp,
+                        warp > 1 ? ", hibernate stores paused" : "");
+                UARTStringPut((byte *)buf);
+                return 0;
+            }
+        }
+        else if (argc == 3 && !strcasecmp(argv[1], "press"))
+        {
+            for (i = 0; i < sizeof(buttons) / sizeof(buttons[0]); i++)
+                if (!strcasecmp(argv[2], buttons[i].name))
+                {
+                    sim_buttons |= 1 << buttons[i].id;
+                    return 0;
+                }
+        }
+        UARTStringPut("Usage: sim warp <1~1000>   - run the clock faster than real time\n");
+        UARTStringPut("       sim press <TOGGLE/MODIFY/CONFIRM/ADD/DEC/ENABLE/FLIP> - press a button\n");
+        return -1;
+    }
+    /* Execute I2C command */
+    else if (!strcasecmp(argv[0], "i2c"))
+    {
+        if (argc != 2 || strcasecmp(argv[1], "stats"))
+        {
+            UARTStringPut("Usage: i2c stats - transactions, faults and latency of the I2C0 devices\n");
             return -1;
         }
+        I2C0_GetStats();
+        return 0;
+    }
+    /* Execute ISR command */
+    else if (!strcasecmp(argv[0], "isr"))
+    {
+        if (argc != 1)
+        {
+            UARTStringPut("Usage: isr - print and reset the ISR latency histograms and late ticks\n");
+            return -1;
+        }
+        isr_dump();
+        return 0;
+    }
+    /* Execute BOOT command */
+    else if (!strcasecmp(argv[0], "boot"))
+    {
+        if (argc != 2 || strcasecmp(argv[1], "stats"))
+        {
+            UARTStringPut("Usage: boot stats - time of every boot stage, this and the previous boot\n");
+            return -1;
+        }
+        boot_get_stats();
+        return 0;
+    }
+    /* Execute STOP and SNOOZE command */
+    else if (!strcasecmp(argv[0], "stop") || !strcasecmp(argv[0], "snooze"))
+    {
+        int src = (argc == 2) ? ring_find(argv[1]) : -1;
+        if (argc > 2 || (argc == 2 && src < 0))
+        {
+            sprintf(buf, "Usage: %s        - %s all ringing\n", argv[0],
+                    !strcasecmp(argv[0], "stop") ? "dismiss" : "snooze");
+            UARTStringPut((byte *)buf);
+            sprintf(buf, "       %s alarm  - only the alarm\n", argv[0]);
+            UARTStringPut((byte *)buf);
+            sprintf(buf, "       %s cdown  - only the countdown\n", argv[0]);
+            UARTStringPut((byte *)buf);
+            sprintf(buf, "       %s cd1    - only countdown cd1~cd3\n", argv[0]);
+            UARTStringPut((byte *)buf);
+            return -1;
+        }
+        if (!strcasecmp(argv[0], "stop"))
+        {
+            ring_stop(src);
+            UARTStringPut("Ringing stopped\n");
+        }
+        else
+            ring_snooze(src);
+        return 0;
     }
     else
     {
@@ -1291,31 +2291,55 @@ int execute_command(int argc, char *argv[])
 /*
     Corresponding to the startup_TM4C129.s vector table UART0_Handler interrupt program name
 */
-void UART0_Handler(void)
+/* Receive and execute a command line */
+static void uart0_service(void)
 {
-    char buf[MAXLINE], c[1];
-    static char *argv[16] = {NULL}; // max 16 parameters
-    int argc = 0, i;
+    char buf[MAXLINE], c;
+    static char *argv[MAXARGS] = {NULL};
+    int argc = 0, i, len = 0, ret;
     int32_t uart0_int_status;
+    uint64_t deadline;
 
     memset(buf, 0, sizeof(buf));
     uart0_int_status = UARTIntStatus(UART0_BASE, true); // Get the interrrupt status.
-    UARTIntClear(UART0_BASE, uart0_int_status);         // Clear the asserted interrupts
+    UARTIntClear(UART0_BASE, uart0_int_status & ~UART_INT_TX); // Clear the asserted interrupts, TX is sync_sent's
+
+    /* While uploading a melody, characters go straight to the RTTTL compiler */
+    if (tone_uploading())
+    {
+        while (UARTCharsAvail(UART0_BASE))
+            if (!tone_upload_feed(UARTCharGet(UART0_BASE)))
+                break;
+        return;
+    }
 
     while (UARTCharsAvail(UART0_BASE)) // Loop while there are characters in the receive FIFO.
     {
-        /* Read the next character from the UART and write it back to the UART. */
-        c[0] = UARTCharGet(UART0_BASE);
-        strcat(buf, c);
-        if (c[0] == '\r')
+        /* Read the next character, the rest of an overlong line is dropped */
+        c = UARTCharGet(UART0_BASE);
+        /* The LF of a CR LF before would end the line at once */
+        if (c == '\n' && !len)
+            continue;
+        if (len < MAXLINE - 1)
+            buf[len++] = c;
+        if (c == '\r')
+        {
+            uart_rx_ticks = hwclock_ticks();
+            cpu_active_ms = systick_ms;
             break;
-        /* wait for the line to come to the end */
-        if (!UARTCharsAvail(UART0_BASE))
-            delay_ms(5);
+        }
+        /* wait for the line to come to the end, polled so the end is
+         * seen within a character */
+        deadline = hwclock_ticks() + hwclock_ms_to_ticks(5);
+        while (!UARTCharsAvail(UART0_BASE) && hwclock_ticks() < deadline)
+            ;
     }
 
-    if (parse_command(buf, &argc, argv) != 0)
+    buf[len] = '\0';
+    if ((ret = parse_command(buf, &argc, argv)) != 0)
     {
+        if (ret == -2)
+            UARTStringPut("Command parse error: too many arguments\n");
         for (i = 0; i < argc; i++)
             free(argv[i]);
         return;
@@ -1338,6 +2362,18 @@ void UART0_Handler(void)
     GPIOPinWrite(GPIO_PORTN_BASE, GPIO_PIN_1, 0);
     GPIOPinWrite(GPIO_PORTN_BASE, GPIO_PIN_1, 0);
 }
+void UART0_Handler(void)
+{
+    uint32_t t0 = DWT_CYCLES();
+    if (UARTIntStatus(UART0_BASE, true) & UART_INT_TX)
+        sync_sent();
+    PROF_CALL(PROF_UART0, uart0_service());
+    /* A line right behind the one taken raises no receive timeout of its
+     * own once the interrupt is cleared, so it is served next */
+    if (UARTCharsAvail(UART0_BASE))
+        IntPendSet(INT_UART0);
+    isr_exit(ISR_UART0, t0);
+}
 
 /* Util functions */
 
@@ -1362,79 +2398,69 @@ int get_format_nums(char *buf, int *x, int *y, int *z)
     else
         return -1;
 
-    *x = strtol(buf, &buf, 0);
-    if (*buf != delim || !isdigit(*(buf + 1)))
+    /* Decimal only, "08" is not an octal error */
+    if (!isdigit((unsigned char)*buf))
+        return -1;
+    *x = strtol(buf, &buf, 10);
+    if (*buf != delim || !isdigit((unsigned char)*(buf + 1)))
         return -1;
     SKIP_CHAR(buf);
-    *y = strtol(buf, &buf, 0);
-    if (*buf != delim || !isdigit(*(buf + 1)))
+    *y = strtol(buf, &buf, 10);
+    if (*buf != delim || !isdigit((unsigned char)*(buf + 1)))
         return -1;
     SKIP_CHAR(buf);
-    *z = strtol(buf, &buf, 0);
+    *z = strtol(buf, &buf, 10);
     if (!IS_END(buf))
         return -1;
     return 0;
 }
 
+/* Unsigned decimal of up to 18 digits, -1 when there is none */
+int64_t parse_us(const char *s, char **end)
+{
+    int64_t v = 0;
+    int n = 0;
+    while (isdigit((unsigned char)*s) && n < 18)
+        v = v * 10 + (*s++ - '0'), n++;
+    *end = (char *)s;
+    return n ? v : -1;
+}
+
+/* Busy wait on a private wheel timer, safe to nest from an ISR */
 void delay_ms(int ms)
 {
-    inner_timer_start(INNERTIMER_GENERAL, ms);
-    while (inner_timer_status(INNERTIMER_GENERAL))
+    uint32_t start = systick_ms;
+    int h = twheel_alloc();
+    if (h < 0)
+    {
+        while (systick_ms - start < (uint32_t)ms)
+            ;
+        return;
+    }
+    twheel_start(h, ms, NULL, NULL);
+    while (twheel_pending(h))
         ;
+    twheel_free(h);
 }
 
 void update_blink_mask(uint8_t *mask, int ptr)
 {
+    /* Digits of the field being modified, counted from the right as
+     * in seg7_render, so the mask holds in either orientation */
+    static const uint8_t fields[4] = {0x00, 0xf0, 0x0c, 0x03};
     uint8_t tmp = *mask;
-    if (!global_flip)
-        switch (ptr)
-        {
-        case 0:
-            tmp = 0xff;
-            break;
-        case 1:
-            tmp ^= 0x0f;
-            tmp |= ~0x0f;
-            break;
-        case 2:
-            tmp ^= 0x30;
-            tmp |= ~0x30;
-            break;
-        case 3:
-            tmp ^= 0xc0;
-            tmp |= ~0xc0;
-            break;
-        default:
-            tmp = 0xff;
-        }
+    if (ptr > 0 && ptr < 4)
+        tmp = (tmp ^ fields[ptr]) | ~fields[ptr];
     else
-        switch (ptr)
-        {
-        case 0:
-            tmp = 0xff;
-            break;
-        case 1:
-            tmp ^= 0xf0;
-            tmp |= ~0xf0;
-            break;
-        case 2:
-            tmp ^= 0x0c;
-            tmp |= ~0x0c;
-            break;
-        case 3:
-            tmp ^= 0x03;
-            tmp |= ~0x03;
-            break;
-        default:
-            tmp = 0xff;
-        }
+        tmp = 0xff;
     *mask = tmp;
 }
 
 void led_show_info()
 {
     uint8_t leds = 0x00;
-    leds |= ((uint8_t)0x01 << global_display_mode) &
+    /* LED1~4 for the first four modes, LED5 stopwatch, LED6 cd1~cd3 */
+    leds |= ((uint8_t)0x01 << (global_display_mode < DISPLAY_MODE_CDOWN ? global_display_mode : 5)) &
             (global_blink_mask == 0xff ? 0xff : 0x00);
     leds |= alarm.enable ? 0x40 : 0x00;
     leds |= (timer.enable && systick_500ms_status ? 0x80 : 0x00);
@@ -1452,18 +2478,463 @@ void print_log()
         UARTStringPut((byte *)buf);
     }
 }
-/* Inner timer methods */
-void inner_timer_start(int timerId, int timeoutMs)
+
+/* Benchmarks: BENCH_ITERS calls of every routine, each timed on the DWT
+ * cycle counter. The fastest call is compared with the baseline saved
+ * in the EEPROM for the clock profile running, as the flash wait states
+ * differ between them; at a clock of no profile nothing is compared or
+ * saved. twheel_tick is timed by systick_service, a tick after the
+ * other. Output lines are comma separated:
+ *   bench,<name>,<iters>,<min>,<avg>,<max>,<baseline>,<delta %>,<status>
+ */
+#define BENCH_ITERS 100
+#define BENCH_TOLERANCE 10 /* % above the baseline reported as a regression */
+#define BENCH_TIME(stmt)               \
+    do                                 \
+    {                                  \
+        uint32_t t0 = DWT_CYCLES();    \
+        stmt;                          \
+        t = DWT_CYCLES() - t0;         \
+    } while (0)
+
+static const char *const bench_names[BENCH_NUM] = {
+    "clock_update", "clock_init", "clock_set_date", "get_format_nums",
+    "parse_get", "parse_set", "parse_run", "parse_tone",
+    "update_blink_mask", "istriggered", "Crc8CCITT", "Crc16", "Crc32", "twheel_tick"};
+static const char *const bench_lines[] = {
+    "get time", "set alarm 07:30:00", "run cd1", "tone alarm rise"};
+
+/* Cycles of one call of benchmark id, -1 times nothing */
+static uint32_t bench_call(int id)
+{
+    static dgtclock_t c;
+    static char line[MAXLINE];
+    static char *argv[MAXARGS + 1];
+    static uint8_t data[64];
+    uint32_t t = 0;
+    uint8_t mask = 0xff;
+    int argc = 0, x, y, z;
+
+    switch (id)
+    {
+    case -1:
+        BENCH_TIME((void)0);
+        break;
+    case 0: /* carry through every field */
+        clock_init(&c, 59, 59, 23, 31, MONTH_DEC, 1999);
+        c.sec++;
+        BENCH_TIME(clock_update(&c));
+        break;
+    case 1:
+        BENCH_TIME(clock_init(&c, 0, 0, 12, 15, MONTH_DEC, 2023));
+        break;
+    case 2:
+        BENCH_TIME(clock_set_date(&c, 29, MONTH_FEB, 2024));
+        break;
+    case 3:
+        strcpy(line, "2023-06-12");
+        BENCH_TIME(get_format_nums(line, &x, &y, &z));
+        break;
+    case 4:
+    case 5:
+    case 6:
+    case 7:
+        strcpy(line, bench_lines[id - 4]);
+        BENCH_TIME(parse_command(line, &argc, argv));
+        while (argc)
+            free(argv[--argc]);
+        break;
+    case 8:
+        BENCH_TIME(update_blink_mask(&mask, 2));
+        break;
+    case 9:
+        BENCH_TIME(x = istriggered(0xfe, 0xff, BUTTON_ID_TOGGLE));
+        break;
+    case 10:
+        BENCH_TIME(x = Crc8CCITT(0, data, sizeof(data)));
+        break;
+    case 11:
+        BENCH_TIME(x = Crc16(0, data, sizeof(data)));
+        break;
+    case 12:
+        BENCH_TIME(x = Crc32(0xffffffff, data, sizeof(data)));
+        break;
+    case 13: /* with the timer of delay_ms running */
+        delay_ms(1);
+        t = twheel_tick_cycles;
+        break;
+    }
+    return t;
+}
+void bench_run()
+{
+    char buf[MAXLINE];
+    uint32_t t, min, max, base, overhead = 0xffffffff;
+    uint64_t sum;
+    int id, i, delta, save = bench_pending == 2, regressions = 0, unsaved = 0;
+    int key = cpu_profile_of(ui32SysClock);
+    const char *status;
+
+    bench_pending = 0;
+    key = key < 0 ? -1 : PKEY_BENCH + key * BENCH_NUM;
+    for (i = 0; i < BENCH_ITERS; i++)
+        if ((t = bench_call(-1)) < overhead)
+            overhead = t;
+    sprintf(buf, "bench,clock,%u\n", ui32SysClock);
+    UARTStringPut((byte *)buf);
+    for (id = 0; id < BENCH_NUM; id++)
+    {
+        min = 0xffffffff, max = 0, sum = 0;
+        for (i = 0; i < BENCH_ITERS; i++)
+        {
+            t = bench_call(id);
+            t = t > overhead ? t - overhead : 0;
+            sum += t;
+            if (t < min)
+                min = t;
+            if (t > max)
+                max = t;
+        }
+        if (key < 0 || persist_get(key + id, &base))
+            base = 0;
+        delta = base ? (int)(((int64_t)min - base) * 100 / base) : 0;
+        if (!base)
+            status = "new";
+        else if (delta > BENCH_TOLERANCE)
+            status = "REGRESSION", regressions++;
+        else
+            status = "ok";
+        sprintf(buf, "bench,%s,%d,%u,%u,%u,%u,%d,%s\n", bench_names[id], BENCH_ITERS,
+                min, (uint32_t)(sum / BENCH_ITERS), max, base, delta, status);
+        UARTStringPut((byte *)buf);
+        if (save && (key < 0 || persist_set(key + id, min) < 0))
+            unsaved++;
+    }
+    sprintf(buf, "bench,summary,%d,%d,%s\n", BENCH_NUM, regressions,
+            !save ? "-" : unsaved ? "unsaved" : "saved");
+    UARTStringPut((byte *)buf);
+}
+
+/* Fuzzing of the command parser: lines of the corpus are mutated at
+ * random and run through parse_command and get_format_nums, the two
+ * routines that see raw UART bytes. execute_command is left out, it
+ * would set the clock and ring. Every input is timed and the results
+ * are checked against a plain reading of the input:
+ *   the arguments are the blank separated words of the line, in order
+ *   -1 comes back for no word, -2 for more than MAXARGS
+ *   get_format_nums takes exactly n<d>n<d>n, d the first of ':', '-'
+ *   and '/' found in the word, and gives back the numbers
+ * Output:
+ *   fuzz,<inputs>,<inputs/s>,<max cycles>,<slow>,<failures>
+ */
+#define FUZZ_SLOW_US 1000 /* an input parsed slower than this is slow */
+
+static const char *const fuzz_corpus[] = {
+    "get time", "get date", "set time 12:34:56", "set date 2024-02-29",
+    "set alarm 07:30:00", "set cd1 00:05:00", "set snooze 00:09:00",
+    "run stwatch", "run cd2", "tone alarm rise", "enable alarm",
+    "snooze cdown", "stop", "sim warp 100", "bench save", "i2c stats"};
+
+static uint32_t fuzz_state = 0x2545f491;
+
+static uint32_t fuzz_rand(void)
 {
-    inner_timers[timerId] = timeoutMs;
+    fuzz_state ^= fuzz_state << 13;
+    fuzz_state ^= fuzz_state >> 17;
+    fuzz_state ^= fuzz_state << 5;
+    return fuzz_state;
 }
-bool inner_timer_status(int timerId)
+/* Up to 8 random byte sets, inserts, deletes and tail repeats */
+static void fuzz_mutate(char *line)
 {
-    return !!inner_timers[timerId];
+    int n, len, pos;
+    strcpy(line, fuzz_corpus[fuzz_rand() % (sizeof(fuzz_corpus) / sizeof(fuzz_corpus[0]))]);
+    for (n = 1 + fuzz_rand() % 8; n; n--)
+    {
+        len = strlen(line);
+        pos = len ? fuzz_rand() % len : 0;
+        switch (fuzz_rand() % 4)
+        {
+        case 0:
+            if (len)
+                line[pos] = (char)fuzz_rand();
+            break;
+        case 1:
+            if (len < MAXLINE - 1)
+            {
+                memmove(line + pos + 1, line + pos, len - pos + 1);
+                line[pos] = (char)fuzz_rand();
+            }
+            break;
+        case 2:
+            if (len)
+                memmove(line + pos, line + pos + 1, len - pos);
+            break;
+        default:
+            if (2 * len - pos < MAXLINE)
+            {
+                memcpy(line + len, line + pos, len - pos);
+                line[2 * len - pos] = '\0';
+            }
+            break;
+        }
+    }
+}
+/* Next blank separated word of a line and its length, NULL at the end */
+static const char *fuzz_word(const char **s, int *len)
+{
+    const char *w;
+    while (!IS_END(*s) && IS_BLANK(*s))
+        (*s)++;
+    if (IS_END(*s))
+        return NULL;
+    for (w = *s; !IS_END(*s) && !IS_BLANK(*s); (*s)++)
+        ;
+    *len = *s - w;
+    return w;
+}
+/* Failures of parse_command on a line, returned ret with argc arguments */
+static int fuzz_check_parse(const char *line, int ret, int argc, char *argv[])
+{
+    const char *s = line, *w;
+    int words = 0, len, failures = 0;
+
+    while ((w = fuzz_word(&s, &len)) != NULL)
+    {
+        if (words < argc && (strlen(argv[words]) != len || memcmp(argv[words], w, len)))
+            failures++;
+        words++;
+    }
+    if (ret == 0 ? argc != words : ret == -1 ? words || argc : argc != MAXARGS || words <= MAXARGS)
+        failures++;
+    return failures;
+}
+/* Length of a number and its delimiter d at s, 0 if there is none;
+ * the value in *v, -1 past 9 digits */
+static int fuzz_number(const char *s, char d, int *v)
+{
+    int n;
+    for (n = 0, *v = 0; isdigit((unsigned char)s[n]); n++)
+        *v = n < 9 ? *v * 10 + s[n] - '0' : -1;
+    return n && s[n] == d ? n + (d != '\0') : 0;
 }
-void inner_timer_update()
+/* Failures of get_format_nums on a word, returned ret */
+static int fuzz_check_nums(const char *word, int ret, int x, int y, int z)
 {
+    char d = strchr(word, ':') ? ':' : strchr(word, '-') ? '-' : strchr(word, '/') ? '/' : 0;
+    int v[3], a, b, c = 0;
+
+    if (d && (a = fuzz_number(word, d, &v[0])) && (b = fuzz_number(word + a, d, &v[1])))
+        c = fuzz_number(word + a + b, '\0', &v[2]);
+    if (!c)
+        return ret != -1;
+    return ret != 0 || (v[0] >= 0 && x != v[0]) || (v[1] >= 0 && y != v[1]) ||
+           (v[2] >= 0 && z != v[2]);
+}
+void fuzz_run()
+{
+    static char line[MAXLINE], input[MAXLINE], slowest[MAXLINE];
+    static char *argv[MAXARGS];
+    char buf[MAXLINE];
+    uint32_t t0, t, max = 0, slow = 0, failures = 0, ms, start = systick_ms;
+    uint32_t limit = ui32SysClock / 1000000 * FUZZ_SLOW_US;
+    int n = fuzz_pending, i, k, argc, x, y, z, ret;
+
+    fuzz_pending = 0;
+    slowest[0] = '\0';
+    for (i = 0; i < n; i++)
+    {
+        fuzz_mutate(line);
+        strcpy(input, line);
+        argc = 0;
+        t0 = DWT_CYCLES();
+        ret = parse_command(line, &argc, argv);
+        for (k = 0; k < argc; k++)
+            get_format_nums(argv[k], &x, &y, &z);
+        t = DWT_CYCLES() - t0;
+
+        failures += fuzz_check_parse(input, ret, argc, argv);
+        for (k = 0; k < argc; k++)
+        {
+            x = y = z = -1;
+            ret = get_format_nums(argv[k], &x, &y, &z);
+            failures += fuzz_check_nums(argv[k], ret, x, y, z);
+            free(argv[k]);
+        }
+        if (t > limit)
+            slow++;
+        if (t > max)
+        {
+            max = t;
+            strcpy(slowest, input);
+        }
+    }
+    ms = systick_ms - start;
+    sprintf(buf, "fuzz,%d,%u,%u,%u,%u\n", n, ms ? (uint32_t)((uint64_t)n * 1000 / ms) : 0,
+            max, slow, failures);
+    UARTStringPut((byte *)buf);
+    /* Slowest input, control and 8-bit bytes shown as '.' */
+    for (k = 0; slowest[k] && k < 64; k++)
+        buf[k] = isprint((unsigned char)slowest[k]) ? slowest[k] : '.';
+    buf[k] = '\0';
+    UARTStringPut("fuzz,slowest,");
+    UARTStringPut((byte *)buf);
+    UARTStringPut("\n");
+}
+
+/* Calendar check of calcheck.c, a few years per pass of the main loop.
+ * Output: calcheck,<from>,<to>,<days>,<failures>,<days/s>
+ */
+#define CALCHECK_YEARS 4  /* years per pass of the main loop, a leap cycle */
+#define CALCHECK_REPORT 8 /* failures printed */
+
+static calcheck_t cal;
+static int cal_year;
+static uint32_t cal_days, cal_fails;
+static uint64_t cal_cycles;
+
+static void calcheck_fail(const char *what, int year, int month, int mday, int arg)
+{
+    char buf[80];
+    if (cal_fails++ >= CALCHECK_REPORT)
+        return;
+    sprintf(buf, "calcheck,fail,%s,%04d-%02d-%02d,%d\n", what, year, month + 1, mday, arg);
+    UARTStringPut((byte *)buf);
+}
+void calcheck_step()
+{
+    char buf[80];
+    uint32_t t0 = DWT_CYCLES();
+    int last;
+
+    if (calcheck_pending == 1)
+    {
+        calcheck_begin(&cal, calcheck_fail);
+        cal_year = calcheck_from;
+        cal_days = cal_fails = 0;
+        cal_cycles = 0;
+        calcheck_pending = 2;
+    }
+    last = cal_year + CALCHECK_YEARS - 1 < calcheck_to ? cal_year + CALCHECK_YEARS - 1 : calcheck_to;
+    cal_days += calcheck_years(&cal, cal_year, last);
+    cal_cycles += DWT_CYCLES() - t0;
+    cal_year = last + 1;
+    if (cal_year <= calcheck_to)
+        return;
+
+    calcheck_pending = 0;
+    sprintf(buf, "calcheck,%d,%d,%u,%u,%u\n", calcheck_from, calcheck_to, cal_days, cal_fails,
+            cal_cycles ? (uint32_t)((uint64_t)cal_days * ui32SysClock / cal_cycles) : 0);
+    UARTStringPut((byte *)buf);
+}
+
+/* System clock profiles. Every pass of the main loop is counted for
+ * the profile it ran at; switches happen here, between two passes. */
+static const uint32_t cpu_freqs[CPU_PROFILE_NUM] = {16000000, 20000000, 60000000, 120000000};
+static struct
+{
+    uint64_t ticks; /* hwclock ticks spent in the profile */
+    uint32_t loops, switches;
+} cpu_stats[CPU_PROFILE_NUM];
+static int cpu_profile = -1, cpu_mode = -1; /* mode CPU_PROFILE_AUTO or the fixed profile */
+static uint64_t cpu_since;
+static uint32_t cpu_switch_us;
+
+/* Profile of a system clock
+ * -1 - none */
+int cpu_profile_of(uint32_t hz)
+{
+    int i;
+    for (i = 0; i < CPU_PROFILE_NUM; i++)
+        if (cpu_freqs[i] == hz)
+            return i;
+    return -1;
+}
+static void cpu_account(void)
+{
+    uint64_t now = hwclock_ticks();
+    if (cpu_profile >= 0)
+        cpu_stats[cpu_profile].ticks += now - cpu_since;
+    cpu_since = now;
+}
+void cpu_service()
+{
+    int target, i, owed;
+    uint64_t t0;
+    char buf[64];
+    bool masked;
+
+    if (cpu_profile < 0)
+    {
+        cpu_profile = cpu_mode = cpu_profile_of(ui32SysClock);
+        cpu_since = hwclock_ticks();
+    }
+    if (cpu_pending >= 0)
+    {
+        cpu_mode = cpu_pending;
+        cpu_pending = -1;
+    }
+    target = cpu_mode;
+    if (cpu_mode == CPU_PROFILE_AUTO)
+    {
+        if (global_modify_mode)
+            cpu_active_ms = systick_ms;
+        target = systick_ms - cpu_active_ms < CPU_BURST_MS || bench_pending || fuzz_pending ||
+                         calcheck_pending
+                     ? CPU_PROFILE_NUM - 1
+                     : 0;
+    }
+    if (target >= 0 && target != cpu_profile)
+    {
+        cpu_account();
+        t0 = hwclock_ticks();
+        /* The ticks that fell due during the switch run here, late,
+         * before SysTick comes in at the new rate */
+        masked = IntMasterDisable();
+        owed = SysClock_Set(cpu_freqs[target]);
+        if (owed >= 0)
+            isr_tick_resync(owed);
+        for (i = 0; i < owed; i++)
+            systick_service();
+        if (!masked)
+            IntMasterEnable();
+        if (owed < 0)
+        {
+            sprintf(buf, "System clock %u MHz not available\n", cpu_freqs[target] / 1000000);
+            UARTStringPut((byte *)buf);
+            cpu_mode = cpu_profile;
+        }
+        else
+        {
+            cpu_switch_us = (uint32_t)((hwclock_ticks() - t0) / (HWCLOCK_FREQ / 1000000));
+            cpu_profile = target;
+            cpu_stats[target].switches++;
+        }
+        cpu_since = hwclock_ticks();
+    }
+    if (cpu_profile >= 0)
+        cpu_stats[cpu_profile].loops++;
+}
+/* Print the time and loop rate of every profile */
+void cpu_get_stats()
+{
+    char buf[80];
+    uint32_t ms;
     int i;
-    for (i = 0; i < 10; i++)
-        inner_timers[i] ? inner_timers[i]-- : 0;
-}
\ No newline at end of file
+
+    cpu_account();
+    sprintf(buf, "System clock %u MHz, %s, last switch %u us\n", ui32SysClock / 1000000,
+            cpu_mode == CPU_PROFILE_AUTO ? "auto" : "fixed", cpu_switch_us);
+    UARTStringPut((byte *)buf);
+    UARTStringPut("  MHz     time s     loops   loops/s  switches\n");
+    for (i = 0; i < CPU_PROFILE_NUM; i++)
+    {
+        ms = (uint32_t)(cpu_stats[i].ticks / (HWCLOCK_FREQ / 1000));
+        if (!ms)
+            continue;
+        sprintf(buf, "%5u %6u.%03u %9u %9u %9u\n", cpu_freqs[i] / 1000000, ms / 1000, ms % 1000,
+                cpu_stats[i].loops, (uint32_t)((uint64_t)cpu_stats[i].loops * 1000 / ms),
+                cpu_stats[i].switches);
+        UARTStringPut((byte *)buf);
+    }
+}
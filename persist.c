@@ -0,0 +1,269 @@
+/*
+ * Configuration log on the on-chip EEPROM.
+ *
+ * The EEPROM is split into two banks of fixed-size records. A changed
+ * value is appended to the active bank; when the bank is full the
+ * latest value of every key is copied to the other bank, which then
+ * becomes active. Every slot is therefore programmed once per lap of
+ * the whole EEPROM.
+ *
+ * Words are programmed one at a time with EEPROMProgramNonBlocking and
+ * the next one is started from the completion interrupt, so a save
+ * never waits for the EEPROM.
+ */
+
+#include "initialize.h"
+#include "stwatch.h"
+#include "persist.h"
+
+#define REC_WORDS (sizeof(plog_rec_t) / 4)
+#define REC_HEAD(key, gen) (((uint32_t)PLOG_MAGIC << 24) | ((key) << 16) | ((gen) & 0xffff))
+#define REC_KEY(head) (((head) >> 16) & 0xff)
+
+/* Latest value of every key */
+static uint32_t values[PKEY_NUM];
+static bool known[PKEY_NUM];
+
+/* Active bank */
+static int bank, bank_recs, next;
+static uint32_t gen, seq;
+
+/* Write queue, drained by FLASH_Handler */
+static struct
+{
+    uint32_t addr;
+    uint32_t data;
+} queue[PLOG_QUEUE];
+static volatile int q_head, q_tail;
+static volatile bool writing;
+
+/* Statistics of this boot */
+static uint32_t recs_written, words_written, write_errors;
+static bool ready;
+
+static uint32_t rec_addr(int b, int slot)
+{
+    return (b * bank_recs + slot) * sizeof(plog_rec_t);
+}
+/* true - record intact and of generation g */
+static bool rec_valid(const plog_rec_t *rec, uint32_t g)
+{
+    return (rec->head >> 24) == PLOG_MAGIC && (rec->head & 0xffff) == (g & 0xffff) &&
+           REC_KEY(rec->head) < PKEY_NUM && rec->check == ~(rec->head ^ rec->val ^ rec->seq);
+}
+static bool rec_read(int b, int slot, uint32_t g, plog_rec_t *rec)
+{
+    EEPROMRead((uint32_t *)rec, rec_addr(b, slot), sizeof(plog_rec_t));
+    return rec_valid(rec, g);
+}
+
+/* Start programming the word at the queue tail */
+static void plog_kick(void)
+{
+    if (q_tail != q_head)
+    {
+        writing = true;
+        EEPROMProgramNonBlocking(queue[q_tail].data, queue[q_tail].addr);
+    }
+    else
+        writing = false;
+}
+static int queue_free(void)
+{
+    return PLOG_QUEUE - 1 - (q_head - q_tail + PLOG_QUEUE) % PLOG_QUEUE;
+}
+/* Queue a record, the head word last */
+static void rec_push(int slot, int key, uint32_t val)
+{
+    uint32_t addr = rec_addr(bank, slot), head = REC_HEAD(key, gen);
+    uint32_t words[REC_WORDS];
+    int i;
+
+    words[1] = val;
+    words[2] = ++seq;
+    words[3] = ~(head ^ val ^ seq);
+    words[0] = head;
+    for (i = 1; i <= REC_WORDS; i++)
+    {
+        queue[q_head].addr = addr + (i % REC_WORDS) * 4;
+        queue[q_head].data = words[i % REC_WORDS];
+        q_head = (q_head + 1) % PLOG_QUEUE;
+    }
+    recs_written++;
+}
+/* Copy the latest values to the other bank and switch to it. The bank
+ * header goes last: until it is programmed the old bank stays current. */
+static void plog_compact(void)
+{
+    int k;
+    bank ^= 1;
+    gen++;
+    next = 1;
+    for (k = 1; k < PKEY_NUM; k++)
+        if (known[k])
+            rec_push(next++, k, values[k]);
+    rec_push(0, PKEY_BANK, gen);
+}
+
+/* Find the active bank and load the latest values
+ *  0 - log loaded
+ *  1 - no log found, a new one is started
+ * -1 - EEPROM failure
+ */
+int persist_init()
+{
+    plog_rec_t rec;
+    uint32_t g[2] = {0, 0};
+    int b, lo, hi, mid, slot, left = PKEY_NUM - 1;
+    bool masked;
+
+    /* Also completes a program cut short by a reset */
+    if (EEPROMInit() != EEPROM_INIT_OK)
+        return -1;
+    bank_recs = EEPROMSizeGet() / 2 / sizeof(plog_rec_t);
+
+    for (b = 0; b < 2; b++)
+    {
+        EEPROMRead((uint32_t *)&rec, rec_addr(b, 0), sizeof(plog_rec_t));
+        if (rec_valid(&rec, rec.val) && REC_KEY(rec.head) == PKEY_BANK)
+            g[b] = rec.val;
+    }
+    ready = true;
+    if (!g[0] && !g[1])
+    {
+        bank = 1;
+        gen = 0;
+        masked = IntMasterDisable();
+        plog_compact();
+        plog_kick();
+        if (!masked)
+            IntMasterEnable();
+        return 1;
+    }
+    bank = g[1] > g[0];
+    gen = g[bank];
+
+    /* Records are appended in order: binary search the first free slot */
+    lo = 1, hi = bank_recs;
+    while (lo < hi)
+    {
+        mid = (lo + hi) / 2;
+        if (rec_read(bank, mid, gen, &rec))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    next = lo;
+
+    /* Walk back from the newest record until every key is seen */
+    rec_read(bank, 0, gen, &rec);
+    seq = rec.seq;
+    for (slot = next - 1; slot > 0 && left; slot--)
+    {
+        rec_read(bank, slot, gen, &rec);
+        if (slot == next - 1)
+            seq = rec.seq;
+        if (!known[REC_KEY(rec.head)])
+        {
+            known[REC_KEY(rec.head)] = true;
+            values[REC_KEY(rec.head)] = rec.val;
+            left--;
+        }
+    }
+    return 0;
+}
+/* Latest value of a key
+ *  0 - found
+ * -1 - never stored
+ */
+int persist_get(int key, uint32_t *val)
+{
+    if (key <= PKEY_BANK || key >= PKEY_NUM || !known[key])
+        return -1;
+    *val = values[key];
+    return 0;
+}
+/* Store a value, only appended when it changed
+ *  0 - queued
+ *  1 - unchanged
+ * -1 - EEPROM unavailable or queue full, try again later
+ */
+int persist_set(int key, uint32_t val)
+{
+    bool masked;
+    int need = REC_WORDS;
+
+    if (!ready || key <= PKEY_BANK || key >= PKEY_NUM)
+        return -1;
+    if (known[key] && values[key] == val)
+        return 1;
+
+    masked = IntMasterDisable();
+    if (next >= bank_recs)
+        need += PKEY_NUM * REC_WORDS;
+    if (queue_free() < need)
+    {
+        if (!masked)
+            IntMasterEnable();
+        return -1;
+    }
+    known[key] = true;
+    values[key] = val;
+    if (next >= bank_recs)
+        plog_compact();
+    rec_push(next++, key, val);
+    if (!writing)
+        plog_kick();
+    if (!masked)
+        IntMasterEnable();
+    return 0;
+}
+bool persist_busy()
+{
+    return writing;
+}
+/* Print the usage of the log and the wear projection */
+void persist_get_stats()
+{
+    char buf[80];
+    uint32_t ms = (uint32_t)(hwclock_us() / 1000), per_day, years;
+    uint64_t life;
+
+    if (!ready)
+    {
+        UARTStringPut("EEPROM unavailable\n");
+        return;
+    }
+    sprintf(buf, "Bank %d gen %u, %d/%d records, %u in total\n",
+            bank, gen, next, bank_recs, seq);
+    UARTStringPut((uint8_t *)buf);
+    sprintf(buf, "This boot: %u records, %u words, %u errors, %d words queued\n",
+            recs_written, words_written, write_errors,
+            PLOG_QUEUE - 1 - queue_free());
+    UARTStringPut((uint8_t *)buf);
+
+    /* Every slot is programmed once per lap of both banks */
+    per_day = ms ? (uint32_t)((uint64_t)recs_written * 86400000 / ms) : 0;
+    life = (uint64_t)PLOG_ENDURANCE * 2 * bank_recs;
+    if (!per_day)
+    {
+        UARTStringPut("Writes per day: 0, endurance not limited\n");
+        return;
+    }
+    years = life > seq ? (uint32_t)((life - seq) / per_day / 365) : 0;
+    sprintf(buf, "Writes per day: %u, estimated endurance %u years\n", per_day, years);
+    UARTStringPut((uint8_t *)buf);
+}
+
+/* EEPROM program done, shares the flash vector */
+void FLASH_Handler(void)
+{
+    if (!EEPROMIntStatus(true))
+        return;
+    EEPROMIntClear(EEPROM_INT_PROGRAM);
+    if (EEPROMStatusGet() & EEPROM_RC_NOPERM)
+        write_errors++;
+    words_written++;
+    q_tail = (q_tail + 1) % PLOG_QUEUE;
+    plog_kick();
+}
@@ -0,0 +1,44 @@
+#ifndef _PERSIST_H
+#define _PERSIST_H
+
+#include "headers.h"
+
+/* Configuration keys kept in the EEPROM log */
+#define PKEY_BANK 0                          /* bank header, value is the generation */
+#define PKEY_ALARM 1                         /* [24] enable, [23:16] hour, [15:8] min, [7:0] sec */
+#define PKEY_FLIP 2                          /* global_flip */
+#define PKEY_SNOOZE 3                        /* snooze duration(s) */
+#define PKEY_CDOWN 4                         /* preset(ms) of cd1 ~ cd3 */
+#define PKEY_TONE (PKEY_CDOWN + CDOWN_NUM)   /* tone id of every ringing source */
+#define PKEY_BENCH (PKEY_TONE + RING_SRC_NUM) /* baseline cycles of every benchmark, per CPU profile */
+#define PKEY_CAL_RTC (PKEY_BENCH + CPU_PROFILE_NUM * BENCH_NUM) /* learned RTC error(ppb) */
+#define PKEY_CAL_TICK (PKEY_CAL_RTC + 1)      /* learned tick error(ppb) */
+#define PKEY_NUM (PKEY_CAL_TICK + 1)
+
+/* Log record, 4 words. The head word is programmed last, so a record
+ * cut short by a reset never validates. */
+typedef struct
+{
+    uint32_t head;  /* [31:24] PLOG_MAGIC, [23:16] key, [15:0] bank generation */
+    uint32_t val;
+    uint32_t seq;   /* records written over the life of the log */
+    uint32_t check; /* ~(head ^ val ^ seq) */
+} plog_rec_t;
+
+#define PLOG_MAGIC 0xa5
+
+/* Words waiting for the EEPROM, enough for a compaction and a few records */
+#define PLOG_QUEUE 320
+
+/* Rated write cycles of an EEPROM word */
+#define PLOG_ENDURANCE 500000
+
+int persist_init(void);
+int persist_get(int key, uint32_t *val);
+int persist_set(int key, uint32_t val);
+bool persist_busy(void);
+void persist_get_stats(void);
+
+void FLASH_Handler(void);
+
+#endif
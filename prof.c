@@ -0,0 +1,336 @@
+/*
+ * Profiling on the DWT cycle counter.
+ *
+ * Boot profiler: every boot stage is timed in cycles and kept in RAM;
+ * a byte per stage of the last HBN_BOOTLOG_NUM boots is also kept in
+ * the hibernate memory, after the state record.
+ *
+ * Hot-path probes: PROF_CALL times a statement and adds it to the
+ * count, total, min and max cycles of its probe. Probes nest, so the
+ * display probes include their I2C writes and the main loop probes
+ * include any ISR that preempted them.
+ *
+ * ISR histograms: the SysTick entry latency is the reload value minus
+ * the current value of SysTick at entry, the execution times come from
+ * the cycle counter. Ticks entered after ISR_LATE_US are late; a gap of
+ * more than a period and a half between two entries means ticks were
+ * lost. The UART0 interrupt has no hardware timestamp, only its
+ * execution time is kept.
+ */
+
+#include "initialize.h"
+#include "hbnrec.h"
+#include "stwatch.h"
+#include "prof.h"
+
+/* Words per boot in the hibernate log */
+#define BOOT_LOG_WORDS (BOOT_STAGE_NUM / 4)
+
+static const char *const boot_stage_names[BOOT_STAGE_NUM] = {
+    "clock", "gpio", "i2c", "uart", "hibernate", "pwm", "wakeup", "splash"};
+
+/* Cycles of every stage of this boot */
+static uint32_t boot_cycles[BOOT_STAGE_NUM];
+static uint32_t boot_last;
+static uint32_t boot_hwclock; /* cycle count at the hwclock start */
+
+/* Start the cycle counter from 0 */
+void dwt_init()
+{
+    HWREG(DEMCR) |= DEMCR_TRCENA;
+    HWREG(DWT_CYCCNT) = 0;
+    HWREG(DWT_CTRL) |= DWT_CTRL_CYCCNTENA;
+}
+
+/* ================================================================
+ * Boot profiler
+ * ================================================================ */
+/* End of a boot stage */
+void boot_mark(int stage)
+{
+    uint32_t now = DWT_CYCLES();
+    boot_cycles[stage] = now - boot_last;
+    boot_last = now;
+}
+static uint32_t boot_stage_us(int stage)
+{
+    return (uint32_t)((uint64_t)boot_cycles[stage] * 1000000 /
+                      (stage == BOOT_CLOCK ? BOOT_CLOCK_FREQ : ui32SysClock));
+}
+/* The hwclock starts now, boot_hwclock_us is the time before */
+void boot_hwclock_mark()
+{
+    boot_hwclock = DWT_CYCLES();
+}
+/* Microseconds from the cycle counter start in IO_initialize to the
+ * hwclock start: the clock stage, then Peripherals_Enable */
+uint32_t boot_hwclock_us()
+{
+    return boot_stage_us(BOOT_CLOCK) +
+           (uint32_t)((uint64_t)(boot_hwclock - boot_cycles[BOOT_CLOCK]) * 1000000 / ui32SysClock);
+}
+/* Microseconds in a byte: 4-bit exponent and 4-bit mantissa,
+ * within 6% up to half a second */
+static uint8_t us_pack(uint32_t us)
+{
+    int e = 1;
+    if (us < 16)
+        return us;
+    while ((us >> (e - 1)) >= 32 && e < 15)
+        e++;
+    if ((us >> (e - 1)) >= 32)
+        return 0xff;
+    return (e << 4) | ((us >> (e - 1)) - 16);
+}
+static uint32_t us_unpack(uint8_t b)
+{
+    int e = b >> 4;
+    return e ? (uint32_t)(16 + (b & 0x0f)) << (e - 1) : b;
+}
+/* Append this boot to the log in hibernate memory */
+void boot_save()
+{
+    uint32_t *log = pui32NVData + HBN_BOOTLOG, *boot;
+    uint32_t head, num;
+    bool masked = IntMasterDisable(); /* SysTick stores the same area */
+    int i;
+
+    head = log[0] & 0xff;
+    num = (log[0] >> 8) & 0xff;
+    if ((log[0] >> 16) != HBN_MAGIC || head >= HBN_BOOTLOG_NUM || num > HBN_BOOTLOG_NUM)
+        head = num = 0;
+    boot = log + 1 + head * BOOT_LOG_WORDS;
+    for (i = 0; i < BOOT_LOG_WORDS; i++)
+        boot[i] = 0;
+    for (i = 0; i < BOOT_STAGE_NUM; i++)
+        boot[i / 4] |= (uint32_t)us_pack(boot_stage_us(i)) << (i % 4 * 8);
+    if (num < HBN_BOOTLOG_NUM)
+        num++;
+    head = (head + 1) % HBN_BOOTLOG_NUM;
+    log[0] = ((uint32_t)HBN_MAGIC << 16) | (num << 8) | head;
+    hbnrec_write(pui32NVData);
+    if (!masked)
+        IntMasterEnable();
+}
+/* Print the stages of this boot and of the earlier boots logged */
+void boot_get_stats()
+{
+    const uint32_t *log = pui32NVData + HBN_BOOTLOG;
+    uint32_t head = log[0] & 0xff, num = (log[0] >> 8) & 0xff, total[HBN_BOOTLOG_NUM + 1];
+    char buf[80];
+    int i, k, len;
+
+    if ((log[0] >> 16) != HBN_MAGIC || head >= HBN_BOOTLOG_NUM || num > HBN_BOOTLOG_NUM)
+        num = 0;
+    /* The newest logged boot is this one */
+    len = sprintf(buf, "%-10s %10s", "stage(us)", "this boot");
+    for (k = 1; k < num; k++)
+        len += sprintf(buf + len, "   boot -%d", k);
+    UARTStringPut((uint8_t *)buf);
+    UARTStringPut("\n");
+    memset(total, 0, sizeof(total));
+    for (i = 0; i < BOOT_STAGE_NUM; i++)
+    {
+        len = sprintf(buf, "%-10s %10u", boot_stage_names[i], boot_stage_us(i));
+        total[0] += boot_stage_us(i);
+        for (k = 1; k < num; k++)
+        {
+            const uint32_t *boot = log + 1 + (head + 2 * HBN_BOOTLOG_NUM - 1 - k) % HBN_BOOTLOG_NUM * BOOT_LOG_WORDS;
+            uint32_t us = us_unpack((boot[i / 4] >> (i % 4 * 8)) & 0xff);
+            total[k] += us;
+            len += sprintf(buf + len, " %9u", us);
+        }
+        UARTStringPut((uint8_t *)buf);
+        UARTStringPut("\n");
+    }
+    len = sprintf(buf, "%-10s %10u", "total", total[0]);
+    for (k = 1; k < num; k++)
+        len += sprintf(buf + len, " %9u", total[k]);
+    UARTStringPut((uint8_t *)buf);
+    UARTStringPut("\n");
+}
+
+/* ================================================================
+ * Histograms
+ * ================================================================ */
+void prof_hist_add(prof_hist_t *h, uint32_t cycles)
+{
+    int k = 0;
+    while (k < PROF_HIST_BINS - 1 && (cycles >> (k + 1)))
+        k++;
+    h->bins[k]++;
+    h->count++;
+    if (cycles > h->max)
+        h->max = cycles;
+}
+void prof_hist_print(const char *name, const prof_hist_t *h)
+{
+    uint32_t per_us = ui32SysClock / 1000000;
+    char buf[80];
+    int k;
+
+    sprintf(buf, "%s: %u samples, max %u cycles (%u us)\n", name, h->count, h->max, h->max / per_us);
+    UARTStringPut((uint8_t *)buf);
+    for (k = 0; k < PROF_HIST_BINS; k++)
+    {
+        if (!h->bins[k])
+            continue;
+        if (k < PROF_HIST_BINS - 1)
+            sprintf(buf, "  < %8u cycles (%6u us) %8u\n",
+                    (uint32_t)2 << k, ((uint32_t)2 << k) / per_us, h->bins[k]);
+        else
+            sprintf(buf, "  >=%8u cycles (%6u us) %8u\n",
+                    (uint32_t)1 << k, ((uint32_t)1 << k) / per_us, h->bins[k]);
+        UARTStringPut((uint8_t *)buf);
+    }
+}
+
+/* ================================================================
+ * ISR histograms
+ * ================================================================ */
+static const char *const isr_names[ISR_HIST_NUM] = {"SysTick latency", "SysTick", "UART0"};
+
+/* Only touched by the ISRs, SysTick preempts UART0 but never updates
+ * its histogram */
+static prof_hist_t hists[ISR_HIST_NUM];
+static uint32_t ticks, ticks_late, ticks_missed, tick_last;
+static bool tick_seen;
+
+/* First thing in SysTick_Handler, returns the entry cycle count */
+uint32_t isr_tick_enter()
+{
+    uint32_t now = DWT_CYCLES(), period = SysTickPeriodGet();
+    uint32_t latency = period - 1 - SysTickValueGet();
+
+    prof_hist_add(&hists[ISR_SYSTICK_LATENCY], latency);
+    if (latency > ui32SysClock / 1000000 * ISR_LATE_US)
+        ticks_late++;
+    if (tick_seen && now - tick_last > period + period / 2)
+        ticks_missed += (now - tick_last + period / 2) / period - 1;
+    ticks++;
+    tick_seen = true;
+    tick_last = now;
+    return now;
+}
+/* After a switch of the system clock, with interrupts masked: the ticks
+ * run late by the caller are counted, the next tick starts the count of
+ * missed ones again */
+void isr_tick_resync(uint32_t late)
+{
+    ticks += late;
+    ticks_late += late;
+    tick_seen = false;
+}
+/* Last thing in a handler */
+void isr_exit(int hist, uint32_t t0)
+{
+    prof_hist_add(&hists[hist], DWT_CYCLES() - t0);
+}
+/* Print the histograms and tick counters, then reset them */
+void isr_dump()
+{
+    static prof_hist_t snap[ISR_HIST_NUM];
+    uint32_t snap_ticks, snap_late, snap_missed;
+    bool masked = IntMasterDisable();
+    char buf[80];
+    int i;
+
+    memcpy(snap, hists, sizeof(hists));
+    memset(hists, 0, sizeof(hists));
+    snap_ticks = ticks, snap_late = ticks_late, snap_missed = ticks_missed;
+    ticks = ticks_late = ticks_missed = 0;
+    if (!masked)
+        IntMasterEnable();
+
+    sprintf(buf, "Ticks: %u, late (> %u us): %u, missed: %u\n",
+            snap_ticks, ISR_LATE_US, snap_late, snap_missed);
+    UARTStringPut((uint8_t *)buf);
+    for (i = 0; i < ISR_HIST_NUM; i++)
+        prof_hist_print(isr_names[i], &snap[i]);
+}
+
+/* ================================================================
+ * Hot-path probes
+ * ================================================================ */
+#if PROF_PROBES
+typedef struct
+{
+    uint32_t count;
+    uint64_t total;
+    uint32_t min, max;
+} prof_probe_t;
+
+static const char *const prof_names[PROF_NUM] = {
+    "systick", "uart0", "i2c write", "i2c read", "events", "leds",
+    "disp time", "disp date", "disp alarm", "disp timer", "disp stwatch", "disp cdown", "disp text",
+    "disp frame"};
+
+static prof_probe_t probes[PROF_NUM];
+static uint64_t prof_since; /* hwclock_us of the last reset */
+
+/* Probes are shared by the main loop and the ISRs */
+void prof_add(int id, uint32_t cycles)
+{
+    prof_probe_t *p = &probes[id];
+    bool masked = IntMasterDisable();
+    if (!p->count || cycles < p->min)
+        p->min = cycles;
+    if (cycles > p->max)
+        p->max = cycles;
+    p->count++;
+    p->total += cycles;
+    if (!masked)
+        IntMasterEnable();
+}
+/* Print the probes since the last dump and reset them */
+void prof_dump()
+{
+    static prof_probe_t snap[PROF_NUM];
+    const prof_probe_t *p;
+    char buf[80];
+    uint64_t now = hwclock_us(), elapsed;
+    uint32_t per_us = ui32SysClock / 1000000;
+    bool masked = IntMasterDisable();
+    int i;
+
+    memcpy(snap, probes, sizeof(probes));
+    memset(probes, 0, sizeof(probes));
+    elapsed = now - prof_since;
+    prof_since = now;
+    if (!masked)
+        IntMasterEnable();
+
+    sprintf(buf, "Cycles over the last %u ms at %u MHz\n", (uint32_t)(elapsed / 1000), per_us);
+    UARTStringPut((uint8_t *)buf);
+    UARTStringPut("probe           count      avg      min      max  total ms   cpu%\n");
+    for (i = 0; i < PROF_NUM; i++)
+    {
+        uint32_t permille;
+        p = &snap[i];
+        permille = elapsed ? (uint32_t)(p->total * 1000 / (elapsed * per_us)) : 0;
+        if (!p->count)
+            continue;
+        sprintf(buf, "%-12s %8u %8u %8u %8u %9u %3u.%u\n", prof_names[i], p->count,
+                (uint32_t)(p->total / p->count), p->min, p->max,
+                (uint32_t)(p->total / per_us / 1000), permille / 10, permille % 10);
+        UARTStringPut((uint8_t *)buf);
+    }
+    /* Scan time of a frame and the frame rate */
+    p = &snap[PROF_DISP_FRAME];
+    if (p->count && elapsed)
+    {
+        sprintf(buf, "frame %u us avg, %u us min, %u us max, %u frames/s\n",
+                (uint32_t)(p->total / p->count / per_us), p->min / per_us, p->max / per_us,
+                (uint32_t)(p->count * 1000000ULL / elapsed));
+        UARTStringPut((uint8_t *)buf);
+    }
+}
+#else
+void prof_add(int id, uint32_t cycles)
+{
+}
+void prof_dump()
+{
+    UARTStringPut("Probes compiled out, build with PROF_PROBES 1\n");
+}
+#endif
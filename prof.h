@@ -0,0 +1,97 @@
+#ifndef _PROF_H
+#define _PROF_H
+
+#include "headers.h"
+
+/* Cortex-M4 DWT cycle counter */
+#define DEMCR 0xe000edfc
+#define DEMCR_TRCENA 0x01000000
+#define DWT_CTRL 0xe0001000
+#define DWT_CTRL_CYCCNTENA 0x00000001
+#define DWT_CYCCNT 0xe0001004
+#define DWT_CYCLES() HWREG(DWT_CYCCNT)
+
+/* Boot stages, each timed from the end of the previous one */
+#define BOOT_CLOCK 0     /* SysCtlClockFreqSet */
+#define BOOT_GPIO 1      /* peripherals enable, SysTick, S800_GPIO_Init */
+#define BOOT_I2C 2       /* S800_I2C0_Init */
+#define BOOT_UART 3      /* S800_UART_Init */
+#define BOOT_HIBERNATE 4 /* Hibernation_Init */
+#define BOOT_PWM 5       /* interrupts, PWM_Init and the rest of IO_initialize */
+#define BOOT_WAKEUP 6    /* hibernation_wakeup_init, config_restore */
+#define BOOT_SPLASH 7    /* start_up */
+#define BOOT_STAGE_NUM 8
+
+/* Clock the CPU runs on until SysCtlClockFreqSet, PIOSC */
+#define BOOT_CLOCK_FREQ 16000000
+
+/* Hot-path probes; 0 compiles every probe out */
+#ifndef PROF_PROBES
+#define PROF_PROBES 1
+#endif
+
+#define PROF_SYSTICK 0
+#define PROF_UART0 1
+#define PROF_I2C_WRITE 2
+#define PROF_I2C_READ 3
+#define PROF_EVENTS 4 /* events_catch */
+#define PROF_LEDS 5   /* led_show_info */
+#define PROF_DISP_TIME 6
+#define PROF_DISP_DATE 7
+#define PROF_DISP_ALARM 8
+#define PROF_DISP_TIMER 9
+#define PROF_DISP_STWATCH 10
+#define PROF_DISP_CDOWN 11
+#define PROF_DISP_TEXT 12
+#define PROF_DISP_FRAME 13 /* seg7_render, one scan of any page */
+#define PROF_NUM 14
+
+/* Time a statement into a probe, e.g. PROF_CALL(PROF_LEDS, led_show_info()) */
+#if PROF_PROBES
+#define PROF_CALL(id, stmt)                               \
+    do                                                    \
+    {                                                     \
+        uint32_t prof_t0 = DWT_CYCLES();                  \
+        stmt;                                             \
+        prof_add((id), DWT_CYCLES() - prof_t0);           \
+    } while (0)
+#else
+#define PROF_CALL(id, stmt) stmt
+#endif
+
+/* Log2 histogram of cycles, bin k counts [2^k, 2^(k+1)) and the last
+ * bin everything above */
+#define PROF_HIST_BINS 24
+
+typedef struct
+{
+    uint32_t count, max;
+    uint32_t bins[PROF_HIST_BINS];
+} prof_hist_t;
+
+/* ISR timing histograms */
+#define ISR_SYSTICK_LATENCY 0 /* tick to SysTick_Handler entry */
+#define ISR_SYSTICK 1         /* SysTick_Handler execution */
+#define ISR_UART0 2           /* UART0_Handler execution */
+#define ISR_HIST_NUM 3
+#define ISR_LATE_US 100 /* a tick entered later than this is late */
+
+void dwt_init(void);
+void boot_mark(int stage);
+void boot_hwclock_mark(void);
+uint32_t boot_hwclock_us(void);
+void boot_save(void);
+void boot_get_stats(void);
+
+void prof_add(int id, uint32_t cycles);
+void prof_dump(void);
+
+void prof_hist_add(prof_hist_t *h, uint32_t cycles);
+void prof_hist_print(const char *name, const prof_hist_t *h);
+
+uint32_t isr_tick_enter(void);
+void isr_tick_resync(uint32_t late);
+void isr_exit(int hist, uint32_t t0);
+void isr_dump(void);
+
+#endif
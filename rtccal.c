@@ -0,0 +1,233 @@
+/*
+ * RTC trim calibration from host time references.
+ *
+ * The host sends its time over the serial port now and then. Every
+ * reference is kept with the hibernate RTC and the SysTick count read
+ * at the same moment, and a least-squares line through the last
+ * CAL_WINDOW samples gives the rate of either clock against the host.
+ * SysTick is read through the hwclock, both run from the PLL.
+ *
+ * The RTC error is programmed into the RTC trim, in steps of about
+ * 0.477 ppm, which keeps the time across resets. The clock shown runs
+ * from SysTick, its error is cancelled in software: the error of every
+ * second is added up in ns, and once it reaches a tick the next second
+ * is made a tick longer or shorter.
+ *
+ * The trim changes the rate the RTC is read at, so the window restarts
+ * from the last sample whenever a new trim is programmed, and the raw
+ * error is the fitted one plus the trim in force.
+ */
+
+#include "initialize.h"
+#include "stwatch.h"
+#include "rtccal.h"
+
+volatile int32_t cal_rtc_ppb, cal_tick_ppb;
+
+static cal_sample_t window[CAL_WINDOW];
+static int win_head, win_len;
+
+/* Fit of the last sample */
+static struct
+{
+    bool valid, applied;
+    int32_t rtc_ppb, tick_ppb; /* raw errors */
+    double rms_ms;             /* RTC residual */
+    uint32_t span_s;
+} fit;
+
+static const cal_sample_t *sample_at(int i)
+{
+    return &window[(win_head - win_len + i + CAL_WINDOW) % CAL_WINDOW];
+}
+/* Error of the trim in force, positive slows the RTC down */
+static double trim_ppb(uint32_t trim)
+{
+    return ((double)trim - CAL_TRIM_NOMINAL) * CAL_TRIM_STEP_PPB;
+}
+/* Both clocks at this moment */
+static void sample_now(cal_sample_t *s)
+{
+    bool masked = IntMasterDisable();
+    do
+    {
+        s->rtc_sec = HibernateRTCGet();
+        s->rtc_ss = HibernateRTCSSGet();
+    } while (s->rtc_sec != HibernateRTCGet());
+    s->ticks = hwclock_ticks();
+    if (!masked)
+        IntMasterEnable();
+}
+/* An error in ppb, rounded; past a rate error of 100% only the
+ * references can be wrong, so it is held there */
+static int32_t fit_ppb(double ppb)
+{
+    if (ppb > 1e9)
+        ppb = 1e9;
+    if (ppb < -1e9)
+        ppb = -1e9;
+    return (int32_t)floor(ppb + 0.5);
+}
+/* Least-squares slope of (local - reference) over reference, both in
+ * ms from the first sample, so the slope is the rate error itself */
+static double fit_slope(bool rtc, double *rms)
+{
+    static double x[CAL_WINDOW], d[CAL_WINDOW];
+    const cal_sample_t *s0 = sample_at(0);
+    double mx = 0, md = 0, sxx = 0, sxd = 0, slope, r, ss = 0;
+    int i;
+
+    for (i = 0; i < win_len; i++)
+    {
+        const cal_sample_t *s = sample_at(i);
+        double local;
+        x[i] = (double)(s->ref_ms - s0->ref_ms);
+        if (rtc)
+            local = (double)(s->rtc_sec - s0->rtc_sec) * 1000 +
+                    ((double)s->rtc_ss - s0->rtc_ss) * 1000 / 32768;
+        else
+            local = (double)(s->ticks - s0->ticks) * 1000 / HWCLOCK_FREQ;
+        d[i] = local - x[i];
+        mx += x[i], md += d[i];
+    }
+    mx /= win_len, md /= win_len;
+    for (i = 0; i < win_len; i++)
+    {
+        sxx += (x[i] - mx) * (x[i] - mx);
+        sxd += (x[i] - mx) * (d[i] - md);
+    }
+    slope = sxx > 0 ? sxd / sxx : 0;
+    for (i = 0; i < win_len; i++)
+    {
+        r = d[i] - md - slope * (x[i] - mx);
+        ss += r * r;
+    }
+    if (rms)
+        *rms = sqrt(ss / win_len);
+    return slope;
+}
+
+/* Add a host reference and fit the window
+ *  1 - fit applied
+ *  0 - collecting
+ * -1 - reference not after the last one, window restarted
+ * -2 - fit out of CAL_MAX_PPM, not applied
+ */
+int cal_ref(uint64_t ref_ms)
+{
+    cal_sample_t s;
+    double rtc, tick;
+    bool restart = win_len && ref_ms <= sample_at(win_len - 1)->ref_ms;
+
+    sample_now(&s);
+    s.ref_ms = ref_ms;
+    if (restart)
+    {
+        fit.valid = false;
+        win_len = 0;
+    }
+    window[win_head] = s;
+    win_head = (win_head + 1) % CAL_WINDOW;
+    if (win_len < CAL_WINDOW)
+        win_len++;
+    if (win_len == 1)
+        return restart ? -1 : 0;
+
+    rtc = fit_slope(true, &fit.rms_ms) * 1e9 + trim_ppb(HibernateRTCTrimGet());
+    tick = fit_slope(false, NULL) * 1e9;
+    fit.span_s = (uint32_t)((ref_ms - sample_at(0)->ref_ms) / 1000);
+    fit.rtc_ppb = fit_ppb(rtc);
+    fit.tick_ppb = fit_ppb(tick);
+    fit.valid = true;
+    fit.applied = false;
+    if (win_len < CAL_MIN_SAMPLES || fit.span_s < CAL_MIN_SPAN_S)
+        return 0;
+    if (fabs(rtc) > CAL_MAX_PPM * 1e3 || fabs(tick) > CAL_MAX_PPM * 1e3)
+        return -2;
+
+    cal_rtc_ppb = fit.rtc_ppb;
+    cal_tick_ppb = fit.tick_ppb;
+    fit.applied = true;
+    cal_apply();
+    return 1;
+}
+/* Program the trim for cal_rtc_ppb */
+void cal_apply()
+{
+    double steps = floor(cal_rtc_ppb / CAL_TRIM_STEP_PPB + 0.5);
+    uint32_t trim;
+
+    if (steps < CAL_TRIM_MIN - CAL_TRIM_NOMINAL)
+        steps = CAL_TRIM_MIN - CAL_TRIM_NOMINAL;
+    if (steps > CAL_TRIM_MAX - CAL_TRIM_NOMINAL)
+        steps = CAL_TRIM_MAX - CAL_TRIM_NOMINAL;
+    trim = (uint32_t)(CAL_TRIM_NOMINAL + (int32_t)steps);
+    if (trim == HibernateRTCTrimGet())
+        return;
+    HibernateRTCTrimSet(trim);
+    /* The RTC rate changed, keep the last sample as the new start */
+    if (win_len > 1)
+        win_len = 1;
+}
+/* Forget the learned errors and the window */
+void cal_reset()
+{
+    cal_rtc_ppb = cal_tick_ppb = 0;
+    win_len = 0;
+    fit.valid = false;
+    cal_apply();
+}
+/* Called at the end of every clock second, returns the ticks to add
+ * to the next one: the clock is ahead by cal_tick_ppb ns a second */
+int cal_tick_adjust()
+{
+    static int32_t ahead_ns;
+    ahead_ns += cal_tick_ppb;
+    if (ahead_ns >= 1000000)
+    {
+        ahead_ns -= 1000000;
+        return 1;
+    }
+    if (ahead_ns <= -1000000)
+    {
+        ahead_ns += 1000000;
+        return -1;
+    }
+    return 0;
+}
+
+/* ppb as a signed ppm string */
+static char *ppm_str(char *buf, double ppb)
+{
+    int32_t v = fit_ppb(ppb);
+    uint32_t a = v < 0 ? -v : v;
+    sprintf(buf, "%c%u.%03u", v < 0 ? '-' : '+', a / 1000, a % 1000);
+    return buf;
+}
+/* Print the errors and the corrections in force */
+void cal_get_stats()
+{
+    char buf[160], p1[16], p2[16], p3[16];
+    uint32_t trim = HibernateRTCTrimGet();
+    uint32_t rms_us = fit.rms_ms < 4e6 ? (uint32_t)(fit.rms_ms * 1000) : UINT32_MAX;
+
+    if (fit.valid)
+    {
+        sprintf(buf, "Window: %d samples over %u s, fit rms %u us, RTC %s ppm, tick %s ppm%s\n",
+                win_len, fit.span_s, rms_us, ppm_str(p1, fit.rtc_ppb),
+                ppm_str(p2, fit.tick_ppb), fit.applied ? ", applied" : ", collecting");
+        UARTStringPut((uint8_t *)buf);
+    }
+    else
+    {
+        sprintf(buf, "Window: %d samples, send references with: cal ref <sec>[.ms]\n", win_len);
+        UARTStringPut((uint8_t *)buf);
+    }
+    sprintf(buf, "RTC: error %s ppm, trim 0x%04x (%s ppm), left %s ppm\n",
+            ppm_str(p1, cal_rtc_ppb), trim, ppm_str(p2, -trim_ppb(trim)),
+            ppm_str(p3, cal_rtc_ppb - trim_ppb(trim)));
+    UARTStringPut((uint8_t *)buf);
+    sprintf(buf, "Tick: error %s ppm, software correction %s ppm\n",
+            ppm_str(p1, cal_tick_ppb), ppm_str(p2, -cal_tick_ppb));
+    UARTStringPut((uint8_t *)buf);
+}
@@ -0,0 +1,39 @@
+#ifndef _RTCCAL_H
+#define _RTCCAL_H
+
+#include "headers.h"
+
+/* Reference samples in the sliding window of the fit */
+#define CAL_WINDOW 16
+
+/* A fit is applied from this many samples over this span */
+#define CAL_MIN_SAMPLES 4
+#define CAL_MIN_SPAN_S 300
+
+/* Fits further off than this are taken for a bad reference */
+#define CAL_MAX_PPM 1000
+
+/* RTC trim, loaded into the 32768 predivider every 64s: 0x7fff is
+ * nominal and every step up slows the RTC by 1e9 / (64 * 32768) ppb */
+#define CAL_TRIM_NOMINAL 0x7fff
+#define CAL_TRIM_MIN 0x7f00
+#define CAL_TRIM_MAX 0x80ff
+#define CAL_TRIM_STEP_PPB 476.837
+
+typedef struct
+{
+    uint64_t ref_ms;          /* host reference */
+    uint64_t ticks;           /* hwclock */
+    uint32_t rtc_sec, rtc_ss; /* hibernate RTC seconds and 1/32768 */
+} cal_sample_t;
+
+/* Learned frequency errors, fast is positive */
+extern volatile int32_t cal_rtc_ppb, cal_tick_ppb;
+
+int cal_ref(uint64_t ref_ms);
+void cal_apply(void);
+void cal_reset(void);
+int cal_tick_adjust(void);
+void cal_get_stats(void);
+
+#endif
@@ -0,0 +1,215 @@
+/*
+ * Stopwatch and countdowns timed from a free-running GPTM.
+ *
+ * Timer0 counts up at the system clock in full-width periodic mode.
+ * The TM4C1294 has no wide timers, so the upper 32 bits are kept by
+ * the Timer0A timeout interrupt, once every 2^32 ticks (~214s at 20MHz).
+ * Nothing here needs per-millisecond work.
+ *
+ * The system clock can change at run time, so hwclock ticks are kept
+ * at the fixed HWCLOCK_FREQ: the Timer0 count since the last change of
+ * the system clock is scaled by HWCLOCK_FREQ / ui32SysClock.
+ */
+
+#include "initialize.h"
+#include "stwatch.h"
+
+/* Upper half of the 64-bit Timer0 count */
+volatile uint32_t hwclock_wraps;
+
+/* hwclock at the last change of the system clock, the Timer0 count
+ * then and the ratio of HWCLOCK_FREQ to the system clock */
+static uint64_t hw_base, hw_raw0;
+static uint32_t hw_mul = 1, hw_div = 1;
+
+stwatch_t stwatch;
+cdown_t cdowns[CDOWN_NUM];
+
+/* ================================================================
+ * Time base
+ * ================================================================ */
+/* Timer0 count, 64 bits */
+static uint64_t timer0_count(void)
+{
+    uint32_t hi, lo, pending;
+    do
+    {
+        hi = hwclock_wraps;
+        lo = TimerValueGet(TIMER0_BASE, TIMER_A);
+        pending = TimerIntStatus(TIMER0_BASE, false) & TIMER_TIMA_TIMEOUT;
+    } while (hi != hwclock_wraps);
+    /* Wrapped but timeout not served yet, e.g. read inside an ISR */
+    if (pending && lo < 0x80000000)
+        hi++;
+    return ((uint64_t)hi << 32) | lo;
+}
+uint64_t hwclock_ticks()
+{
+    uint64_t n = timer0_count() - hw_raw0;
+    return hw_base + (hw_div == 1 ? n * hw_mul : n * hw_mul / hw_div);
+}
+/* Go on from now at the rate of the current system clock, called with
+ * interrupts masked after a change of ui32SysClock */
+void hwclock_rebase(uint64_t now)
+{
+    uint32_t a = HWCLOCK_FREQ, b = ui32SysClock, t;
+    while (b)
+        t = a % b, a = b, b = t;
+    hw_mul = HWCLOCK_FREQ / a;
+    hw_div = ui32SysClock / a;
+    hw_base = now;
+    hw_raw0 = timer0_count();
+}
+uint64_t hwclock_us()
+{
+    return hwclock_ticks() / (HWCLOCK_FREQ / 1000000);
+}
+uint64_t hwclock_ms_to_ticks(uint32_t ms)
+{
+    return (uint64_t)ms * (HWCLOCK_FREQ / 1000);
+}
+uint32_t hwclock_ticks_to_ms(uint64_t ticks)
+{
+    return (uint32_t)(ticks / (HWCLOCK_FREQ / 1000));
+}
+/* Count one wrap of the lower 32 bits */
+void TIMER0A_Handler(void)
+{
+    TimerIntClear(TIMER0_BASE, TIMER_TIMA_TIMEOUT);
+    hwclock_wraps++;
+}
+
+/* ================================================================
+ * Stopwatch methods
+ * ================================================================ */
+void stwatch_start()
+{
+    if (stwatch.running)
+        return;
+    stwatch.start = hwclock_ticks();
+    stwatch.running = true;
+}
+void stwatch_stop()
+{
+    if (!stwatch.running)
+        return;
+    stwatch.acc += hwclock_ticks() - stwatch.start;
+    stwatch.running = false;
+}
+void stwatch_reset()
+{
+    stwatch.acc = 0;
+    stwatch.start = hwclock_ticks();
+    stwatch.lap_total = 0;
+}
+/* Elapsed ticks */
+uint64_t stwatch_elapsed()
+{
+    if (stwatch.running)
+        return stwatch.acc + hwclock_ticks() - stwatch.start;
+    return stwatch.acc;
+}
+/* Record a lap, return lap number */
+int stwatch_lap()
+{
+    stwatch.laps[stwatch.lap_total % STW_LAP_NUM] = stwatch_elapsed();
+    return ++stwatch.lap_total;
+}
+/* Print the laps kept in lap memory */
+void stwatch_get_laps()
+{
+    int i, first;
+    uint64_t us, split;
+    uint32_t tpu = HWCLOCK_FREQ / 1000000;
+    char buf[80];
+
+    if (!stwatch.lap_total)
+    {
+        UARTStringPut("No lap recorded\n");
+        return;
+    }
+    first = stwatch.lap_total > STW_LAP_NUM ? stwatch.lap_total - STW_LAP_NUM : 0;
+    for (i = first; i < stwatch.lap_total; i++)
+    {
+        us = stwatch.laps[i % STW_LAP_NUM] / tpu;
+        split = (i > first) ? us - stwatch.laps[(i - 1) % STW_LAP_NUM] / tpu : us;
+        sprintf(buf, "Lap %2d  %lu.%06lus  split %lu.%06lus\n", i + 1,
+                (unsigned long)(us / 1000000), (unsigned long)(us % 1000000),
+                (unsigned long)(split / 1000000), (unsigned long)(split % 1000000));
+        UARTStringPut((uint8_t *)buf);
+    }
+}
+
+/* ================================================================
+ * Countdown methods
+ *   Each countdown keeps an absolute deadline on the time base, the
+ *   remaining time is only computed when displayed or queried.
+ * ================================================================ */
+void cdown_set(int id, uint32_t ms)
+{
+    cdowns[id].enable = false;
+    cdowns[id].preset = hwclock_ms_to_ticks(ms);
+    cdowns[id].remain = cdowns[id].preset;
+}
+void cdown_start(int id)
+{
+    if (cdowns[id].enable || !cdowns[id].remain)
+        return;
+    cdowns[id].deadline = hwclock_ticks() + cdowns[id].remain;
+    cdowns[id].enable = true;
+}
+void cdown_stop(int id)
+{
+    uint64_t now = hwclock_ticks();
+    if (!cdowns[id].enable)
+        return;
+    cdowns[id].remain = now >= cdowns[id].deadline ? 0 : cdowns[id].deadline - now;
+    cdowns[id].enable = false;
+}
+uint32_t cdown_remain_ms(int id)
+{
+    uint64_t now;
+    if (!cdowns[id].enable)
+        return hwclock_ticks_to_ms(cdowns[id].remain);
+    now = hwclock_ticks();
+    return now >= cdowns[id].deadline ? 0 : hwclock_ticks_to_ms(cdowns[id].deadline - now);
+}
+/* Check expiry, a single compare per running countdown
+ * return: id of the expired countdown, reloaded with its preset
+ *         -1 - none expired
+ */
+int cdown_poll()
+{
+    int i;
+    uint64_t now = hwclock_ticks();
+    for (i = 0; i < CDOWN_NUM; i++)
+    {
+        if (cdowns[i].enable && now >= cdowns[i].deadline)
+        {
+            cdowns[i].enable = false;
+            cdowns[i].remain = cdowns[i].preset;
+            return i;
+        }
+    }
+    return -1;
+}
+/* Find countdown id by name "cd1" ~ "cdN"
+ * -1 - not found
+ */
+int cdown_find(const char *name)
+{
+    if (tolower(name[0]) != 'c' || tolower(name[1]) != 'd' ||
+        name[2] < '1' || name[2] >= '1' + CDOWN_NUM || name[3])
+        return -1;
+    return name[2] - '1';
+}
+/* Get countdown status */
+void cdown_get(int id, char *buf)
+{
+    uint32_t ms = cdown_remain_ms(id), preset = hwclock_ticks_to_ms(cdowns[id].preset);
+    sprintf(buf, "Cd%d %02lu:%02lu:%02lu.%03lu / %02lu:%02lu:%02lu\nRunning: %s\n", id + 1,
+            (unsigned long)(ms / 3600000), (unsigned long)(ms / 60000 % 60),
+            (unsigned long)(ms / 1000 % 60), (unsigned long)(ms % 1000),
+            (unsigned long)(preset / 3600000), (unsigned long)(preset / 60000 % 60),
+            (unsigned long)(preset / 1000 % 60), cdowns[id].enable ? "True" : "False");
+}
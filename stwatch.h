@@ -0,0 +1,58 @@
+#ifndef _STWATCH_H
+#define _STWATCH_H
+
+#include "headers.h"
+
+/* Lap memory depth of the stopwatch */
+#define STW_LAP_NUM 16
+
+/* Stopwatch type */
+typedef struct
+{
+    uint64_t start;               /* hwclock tick when started */
+    uint64_t acc;                 /* ticks accumulated before last start */
+    bool running;
+    uint64_t laps[STW_LAP_NUM];   /* lap ring buffer, elapsed ticks at lap */
+    int lap_total;                /* laps recorded since reset */
+} stwatch_t;
+
+/* Hardware-timed countdown type */
+typedef struct
+{
+    uint64_t preset;   /* countdown length in ticks */
+    uint64_t deadline; /* hwclock tick of expiry while running */
+    uint64_t remain;   /* remaining ticks while paused */
+    bool enable;
+} cdown_t;
+
+extern stwatch_t stwatch;
+extern cdown_t cdowns[CDOWN_NUM];
+
+/* Free-running time base, ticks at HWCLOCK_FREQ whatever the system clock */
+#define HWCLOCK_FREQ 120000000
+uint64_t hwclock_ticks(void);
+void hwclock_rebase(uint64_t now);
+uint64_t hwclock_us(void);
+uint64_t hwclock_ms_to_ticks(uint32_t ms);
+uint32_t hwclock_ticks_to_ms(uint64_t ticks);
+
+/* Stopwatch methods */
+void stwatch_start(void);
+void stwatch_stop(void);
+void stwatch_reset(void);
+int stwatch_lap(void);
+uint64_t stwatch_elapsed(void);
+void stwatch_get_laps(void);
+
+/* Countdown methods */
+void cdown_set(int id, uint32_t ms);
+void cdown_start(int id);
+void cdown_stop(int id);
+uint32_t cdown_remain_ms(int id);
+int cdown_poll(void);
+void cdown_get(int id, char *buf);
+int cdown_find(const char *name);
+
+void TIMER0A_Handler(void);
+
+#endif
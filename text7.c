@@ -0,0 +1,167 @@
+/*
+ * Seven-segment font and text.
+ *
+ * The glyphs are listed once in text7.h and expanded at compile time
+ * into font7 / font7_flip in flash, for printable ASCII. The flipped
+ * glyphs are the same lists through SEG7_FLIP, so the two orientations
+ * cannot drift apart.
+ *
+ * Every display page fills a digit vector and goes through
+ * seg7_render, which turns the display over by tables: the glyphs from
+ * font7_flip, the digits selected from the other end and the decimal
+ * points moved a digit to the right, where a point upside down sits.
+ *
+ * A text is shown over the display mode by the main loop, one scan per
+ * pass. Text that fits is held for TEXT_HOLD_MS, longer text scrolls a
+ * digit to the left every step, holding at both ends. The steps are
+ * taken by a twheel timer, so the rate does not depend on how fast the
+ * main loop scans; the timer starts on the first scan, so a text given
+ * during the boot splash is not used up behind it.
+ */
+
+#include "initialize.h"
+#include "prof.h"
+#include "twheel.h"
+#include "text7.h"
+
+const uint8_t font7[FONT7_NUM] = {FONT7_ASCII(SEG7_SAME)};
+const uint8_t font7_flip[FONT7_NUM] = {FONT7_ASCII(SEG7_FLIP)};
+
+/* Glyphs and digit selects, upright and turned over */
+static const uint8_t *const fonts[2] = {font7, font7_flip};
+static const uint8_t selects[2][8] = {{0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01},
+                                      {0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80}};
+
+/* One scan of n digits
+ * digits - ASCII, digits[0] the rightmost as read
+ *   dots - bit i lights the decimal point of digits[i]
+ *    lit - bit i set shows digits[i], clear blanks it for blinking
+ */
+static void seg7_scan(const char *digits, int n, uint8_t dots, uint8_t lit, bool flip)
+{
+    const uint8_t *font = fonts[flip], *sel = selects[flip];
+    uint8_t c;
+    int i;
+
+    dots >>= flip;
+    for (i = 0; i < n; i++)
+    {
+        c = (uint8_t)digits[i] - FONT7_FIRST;
+        I2C0_WriteByte(TCA6424_I2CADDR, TCA6424_OUTPUT_PORT2, 0x00);
+        I2C0_WriteByte(TCA6424_I2CADDR, TCA6424_OUTPUT_PORT1,
+                       (c < FONT7_NUM ? font[c] : 0x00) | (dots >> i & 1 ? 0x80 : 0x00));
+        I2C0_WriteByte(TCA6424_I2CADDR, TCA6424_OUTPUT_PORT2, lit >> i & 1 ? sel[i] : 0x00);
+        Delay(1000);
+    }
+}
+/* The scan, timed as a frame for prof */
+void seg7_render(const char *digits, int n, uint8_t dots, uint8_t lit, bool flip)
+{
+    PROF_CALL(PROF_DISP_FRAME, seg7_scan(digits, n, dots, lit, flip));
+}
+
+/* Characters, bit 7 set for a decimal point after it */
+static uint8_t cells[TEXT_MAX];
+static volatile int text_len, text_pos; /* text_len 0 - nothing shown */
+static volatile bool text_started;
+static uint32_t text_step;
+static int text_timer;
+
+/* Next scroll position, from SysTick_Handler */
+static void text_next(void *arg)
+{
+    if (text_pos + TEXT_DIGITS < text_len)
+    {
+        text_pos++;
+        twheel_start(text_timer, text_pos + TEXT_DIGITS < text_len ? text_step : TEXT_HOLD_MS,
+                     text_next, NULL);
+    }
+    else
+        text_len = 0;
+}
+
+/* Show a text, step_ms 0 for TEXT_STEP_MS
+ *  0 - ok
+ * -1 - nothing to show
+ * -2 - longer than TEXT_MAX digits
+ * -3 - no timer
+ */
+int text_show(const char *s, uint32_t step_ms)
+{
+    uint8_t c;
+    int n = 0;
+    bool masked;
+
+    text_stop();
+    if (!text_timer && (text_timer = twheel_alloc()) <= 0)
+    {
+        text_timer = 0;
+        return -3;
+    }
+    for (; *s; s++)
+    {
+        c = (uint8_t)*s;
+        if (c < FONT7_FIRST || c >= FONT7_FIRST + FONT7_NUM)
+            c = ' ';
+        if (c == '.' && n && !(cells[n - 1] & 0x80))
+        {
+            cells[n - 1] |= 0x80;
+            continue;
+        }
+        if (n == TEXT_MAX)
+            return -2;
+        cells[n++] = c;
+    }
+    if (!n)
+        return -1;
+
+    masked = IntMasterDisable();
+    text_step = step_ms ? step_ms : TEXT_STEP_MS;
+    text_pos = 0;
+    text_started = false;
+    text_len = n;
+    if (!masked)
+        IntMasterEnable();
+    return 0;
+}
+void text_stop()
+{
+    bool masked = IntMasterDisable();
+    twheel_cancel(text_timer);
+    text_len = 0;
+    if (!masked)
+        IntMasterEnable();
+}
+bool text_active()
+{
+    return text_len > 0;
+}
+
+/* Cell at a digit of the window, blank outside the text */
+static uint8_t text_cell(int p)
+{
+    p += text_pos;
+    return p >= 0 && p < text_len ? cells[p] : ' ';
+}
+/* One scan of the window */
+void text_display(bool flip)
+{
+    char digits[TEXT_DIGITS];
+    uint8_t c, dots = 0x00;
+    int p, i;
+
+    if (!text_started)
+    {
+        text_started = true;
+        twheel_start(text_timer, TEXT_HOLD_MS, text_next, NULL);
+    }
+    for (p = 0; p < TEXT_DIGITS; p++)
+    {
+        c = text_cell(p);
+        i = TEXT_DIGITS - 1 - p;
+        digits[i] = c & 0x7f;
+        if (c & 0x80)
+            dots |= 1 << i;
+    }
+    seg7_render(digits, TEXT_DIGITS, dots, 0xff, flip);
+}
@@ -0,0 +1,58 @@
+#ifndef _TEXT7_H
+#define _TEXT7_H
+
+#include "headers.h"
+
+/* Segments of a glyph: bit 0~6 - a~g, bit 7 - decimal point.
+ * Turned upside down, a/d, b/e and c/f swap places. */
+#define SEG7_SAME(s) (s)
+#define SEG7_FLIP(s) ((((s) & 0x07) << 3) | (((s) & 0x38) >> 3) | ((s) & 0xc0))
+
+/* Glyphs, F is SEG7_SAME or SEG7_FLIP */
+#define FONT7_NUMERALS(F)                                                  \
+    F(0x3f), F(0x06), F(0x5b), F(0x4f), F(0x66), F(0x6d), F(0x7d), F(0x07), \
+        F(0x7f), F(0x6f)
+#define FONT7_UPPER(F)                                                     \
+    F(0x77), F(0x7c), F(0x39), F(0x5e), F(0x79), F(0x71), F(0x3d), F(0x76), \
+        F(0x30), F(0x1e), F(0x75), F(0x38), F(0x15), F(0x37), F(0x3f),       \
+        F(0x73), F(0x6b), F(0x33), F(0x6d), F(0x78), F(0x3e), F(0x3e),       \
+        F(0x2a), F(0x76), F(0x6e), F(0x5b)
+#define FONT7_LOWER(F)                                                     \
+    F(0x5f), F(0x7c), F(0x58), F(0x5e), F(0x7b), F(0x71), F(0x6f), F(0x74), \
+        F(0x10), F(0x0c), F(0x75), F(0x30), F(0x14), F(0x54), F(0x5c),       \
+        F(0x73), F(0x67), F(0x50), F(0x6d), F(0x78), F(0x1c), F(0x1c),       \
+        F(0x14), F(0x76), F(0x6e), F(0x5b)
+/* ASCII 0x20 ~ 0x7f, what has no shape left blank */
+#define FONT7_ASCII(F)                                                     \
+    F(0x00), F(0x86), F(0x22), F(0x7e), F(0x6d), F(0xd2), F(0x46), F(0x20), \
+        F(0x39), F(0x0f), F(0x21), F(0x70), F(0x10), F(0x40), F(0x80),       \
+        F(0x52), FONT7_NUMERALS(F), F(0x09), F(0x0d), F(0x61), F(0x48),      \
+        F(0x43), F(0xd3), F(0x5f), FONT7_UPPER(F), F(0x39), F(0x64),         \
+        F(0x0f), F(0x23), F(0x08), F(0x02), FONT7_LOWER(F), F(0x46),         \
+        F(0x06), F(0x70), F(0x01), F(0x00)
+
+#define FONT7_FIRST 0x20
+#define FONT7_NUM 96
+
+/* ASCII from FONT7_FIRST */
+extern const uint8_t font7[FONT7_NUM];
+extern const uint8_t font7_flip[FONT7_NUM];
+
+/* One scan of the display, digits counted from the right, timed by
+ * the PROF_DISP_FRAME probe */
+void seg7_render(const char *digits, int n, uint8_t dots, uint8_t lit, bool flip);
+
+/* Text shown over the display */
+#define TEXT_MAX 64         /* cells, a '.' shares the cell before it */
+#define TEXT_DIGITS 8
+#define TEXT_STEP_MS 300    /* scroll step by default */
+#define TEXT_STEP_MIN 50
+#define TEXT_STEP_MAX 2000
+#define TEXT_HOLD_MS 2000   /* first and last position of a scroll, or a text that fits */
+
+int text_show(const char *s, uint32_t step_ms);
+void text_stop(void);
+bool text_active(void);
+void text_display(bool flip);
+
+#endif
@@ -0,0 +1,321 @@
+/*
+ * Music sequencer.
+ *
+ * Melodies are tables of packed 2-byte notes. The PWM period of every
+ * pitch is computed again whenever the PWM clock changes. Timer1A runs
+ * one-shot for the length of each note, and its ISR walks a pointer into the table;
+ * nothing is copied to RAM. Melodies can also be compiled from RTTTL
+ * text streamed over the serial port.
+ */
+
+#include "initialize.h"
+#include "tone.h"
+
+/* Frequency(Hz) of each pitch index */
+static const uint16_t pitch_hz[PITCH_NUM] = {
+    0,
+    261, 277, 294, 311, 330, 349, 370, 392, 415, 440, 466, 494,
+    523, 554, 587, 622, 659, 698, 740, 784, 831, 880, 932, 988,
+    1047, 1109, 1175, 1245, 1319, 1397, 1480, 1568, 1661, 1760, 1865, 1976,
+    2093, 2217, 2349, 2489, 2637, 2794, 2960, 3136, 3322, 3520, 3729, 3951};
+
+/* PWMGenPeriodSet value of each pitch index at the PWM clock in use */
+static uint32_t pitch_period[PITCH_NUM];
+
+static const pnote_t scale_notes[] = {
+    PNOTE(N_C4, 400), PNOTE(N_D4, 400), PNOTE(N_E4, 400), PNOTE(N_F4, 400), PNOTE(N_G4, 400),
+    PNOTE(N_A4, 400), PNOTE(N_B4, 400), PNOTE(N_C5, 400), PNOTE(N_D5, 400), PNOTE(N_E5, 400),
+    PNOTE(N_F5, 400), PNOTE(N_G5, 400), PNOTE(N_A5, 400), PNOTE(N_B5, 400)};
+static const pnote_t rise_notes[] = {
+    PNOTE(N_C4, 400), PNOTE(N_D4, 400), PNOTE(N_E4, 400), PNOTE(N_F4, 400),
+    PNOTE(N_G4, 400), PNOTE(N_A4, 400), PNOTE(N_B4, 400)};
+static const pnote_t quick_notes[] = {
+    PNOTE(N_C4, 100), PNOTE(N_D4, 100), PNOTE(N_E4, 100), PNOTE(N_F4, 100),
+    PNOTE(N_G4, 100), PNOTE(N_A4, 100), PNOTE(N_B4, 100)};
+static const pnote_t beep_notes[] = {
+    PNOTE(N_A5, 150), PNOTE(PITCH_REST, 100), PNOTE(N_A5, 150), PNOTE(PITCH_REST, 100),
+    PNOTE(N_A5, 150), PNOTE(PITCH_REST, 100), PNOTE(N_A5, 150), PNOTE(PITCH_REST, 600)};
+static const pnote_t chime_notes[] = {
+    PNOTE(N_E5, 500), PNOTE(N_C5, 500), PNOTE(N_D5, 500), PNOTE(N_G4, 900), PNOTE(PITCH_REST, 100),
+    PNOTE(N_G4, 500), PNOTE(N_D5, 500), PNOTE(N_E5, 500), PNOTE(N_C5, 900), PNOTE(PITCH_REST, 500)};
+
+/* Indexed by TONE_* */
+const tone_t tones[TONE_NUM] = {
+    {"scale", scale_notes, sizeof(scale_notes) / sizeof(pnote_t)},
+    {"rise", rise_notes, sizeof(rise_notes) / sizeof(pnote_t)},
+    {"quick", quick_notes, sizeof(quick_notes) / sizeof(pnote_t)},
+    {"beep", beep_notes, sizeof(beep_notes) / sizeof(pnote_t)},
+    {"chime", chime_notes, sizeof(chime_notes) / sizeof(pnote_t)},
+};
+
+/* Uploaded melody, and the upload in progress compiled aside so a bad
+ * or broken off upload keeps the last good one */
+static pnote_t upload_notes[TONE_UPLOAD_MAX];
+static pnote_t upload_stage[TONE_UPLOAD_MAX];
+tone_t tone_user = {"user", upload_notes, 0};
+static bool uploading, upload_text; /* upload_text - the RTTTL has begun */
+
+/* Sequencer state, owned by TIMER1A_Handler while playing */
+static const pnote_t *seq_pos, *seq_begin, *seq_end;
+static bool seq_loop;
+static volatile bool seq_busy;
+
+/* Sound the note under seq_pos and time it with Timer1 */
+static void seq_next(void)
+{
+    uint32_t period;
+    if (seq_pos == seq_end)
+    {
+        if (!seq_loop)
+        {
+            PWMOutputState(PWM0_BASE, PWM_OUT_7_BIT, false);
+            seq_busy = false;
+            return;
+        }
+        seq_pos = seq_begin;
+    }
+    period = pitch_period[PNOTE_PITCH(*seq_pos)];
+    if (period)
+    {
+        PWMGenPeriodSet(PWM0_BASE, PWM_GEN_3, period);
+        PWMPulseWidthSet(PWM0_BASE, PWM_OUT_7, period >> 2);
+        PWMOutputState(PWM0_BASE, PWM_OUT_7_BIT, true);
+    }
+    else
+        PWMOutputState(PWM0_BASE, PWM_OUT_7_BIT, false);
+    TimerLoadSet(TIMER1_BASE, TIMER_A, PNOTE_MS(*seq_pos) * (ui32SysClock / 1000));
+    TimerEnable(TIMER1_BASE, TIMER_A);
+    seq_pos++;
+}
+
+/* Periods of the pitches for a new PWM clock */
+void seq_set_clock(uint32_t pwm_clock)
+{
+    int i;
+    for (i = 1; i < PITCH_NUM; i++)
+        pitch_period[i] = pwm_clock / pitch_hz[i];
+}
+/* Start playing a melody, replacing the current one */
+void seq_play(const tone_t *tone, bool loop)
+{
+    seq_stop();
+    if (!tone->len)
+        return;
+    seq_begin = seq_pos = tone->notes;
+    seq_end = tone->notes + tone->len;
+    seq_loop = loop;
+    seq_busy = true;
+    seq_next();
+}
+void seq_stop()
+{
+    TimerDisable(TIMER1_BASE, TIMER_A);
+    TimerIntClear(TIMER1_BASE, TIMER_TIMA_TIMEOUT);
+    PWMOutputState(PWM0_BASE, PWM_OUT_7_BIT, false);
+    seq_busy = false;
+}
+bool seq_playing()
+{
+    return seq_busy;
+}
+/* Find tone by name
+ * NULL - not found
+ */
+const tone_t *tone_find(const char *name)
+{
+    int i;
+    for (i = 0; i < TONE_NUM; i++)
+        if (!strcasecmp(name, tones[i].name))
+            return &tones[i];
+    if (!strcasecmp(name, tone_user.name) && tone_user.len)
+        return &tone_user;
+    return NULL;
+}
+
+/* ================================================================
+ * RTTTL compiler
+ *   "name:d=4,o=5,b=120:8c,8d,e,2p,c6,8a#.,..."
+ *   Text is consumed one character at a time and only the current
+ *   token is held, so melodies of any length can be streamed.
+ * ================================================================ */
+static struct
+{
+    pnote_t *out;
+    int max, len;
+    int section; /* 0 - name, 1 - defaults, 2 - notes */
+    int dur, oct, bpm;
+    char tok[8];
+    int toklen;
+    int error;
+} rt;
+
+void rtttl_begin(pnote_t *out, int max)
+{
+    rt.out = out;
+    rt.max = max;
+    rt.len = rt.section = rt.toklen = rt.error = 0;
+    rt.dur = 4, rt.oct = 6, rt.bpm = 63; /* RTTTL defaults */
+}
+/* Compile one token of the current section */
+static int rtttl_token(void)
+{
+    /* Semitones of a, b, c, ..., g */
+    static const int semitone[7] = {9, 11, 0, 2, 4, 5, 7};
+    char *s = rt.tok;
+    int dur = 0, oct = rt.oct, pitch = PITCH_REST, ms;
+    bool dotted = false, rest = false;
+
+    rt.tok[rt.toklen] = '\0';
+    rt.toklen = 0;
+    if (rt.section == 1)
+    {
+        if (s[1] != '=' || !isdigit(s[2]))
+            return -1;
+        dur = atoi(s + 2);
+        if (tolower(s[0]) == 'd' && dur > 0 && dur <= 32)
+            rt.dur = dur;
+        else if (tolower(s[0]) == 'o' && dur >= 4 && dur <= 7)
+            rt.oct = dur;
+        else if (tolower(s[0]) == 'b' && dur > 0 && dur <= 900)
+            rt.bpm = dur;
+        else
+            return -1;
+        return 0;
+    }
+
+    /* [duration] note [#] [.] [octave] [.] */
+    while (isdigit(*s))
+        dur = dur * 10 + *s++ - '0';
+    if (!dur)
+        dur = rt.dur;
+    if (tolower(*s) >= 'a' && tolower(*s) <= 'g')
+        pitch = semitone[tolower(*s) - 'a'];
+    else if (tolower(*s) == 'p')
+        rest = true;
+    else
+        return -1;
+    s++;
+    if (*s == '#')
+        pitch++, s++;
+    if (*s == '.')
+        dotted = true, s++;
+    if (isdigit(*s))
+        oct = *s++ - '0';
+    if (*s == '.')
+        dotted = true, s++;
+    if (*s || dur > 32 || oct < 4 || oct > 7)
+        return -1;
+    pitch = rest ? PITCH_REST : PITCH_IDX(oct, pitch);
+    if (pitch >= PITCH_NUM || rt.len >= rt.max)
+        return -1;
+
+    /* A whole note lasts four beats */
+    ms = 240000 / rt.bpm / dur;
+    if (dotted)
+        ms += ms / 2;
+    if (ms > PNOTE_MAX_MS)
+        ms = PNOTE_MAX_MS;
+    if (ms < 10)
+        ms = 10;
+    rt.out[rt.len++] = PNOTE(pitch, ms);
+    return 0;
+}
+/* return:  0 - accepted
+ *         -1 - syntax error, the rest of the text is ignored
+ */
+int rtttl_feed(char c)
+{
+    if (rt.error)
+        return -1;
+    if (IS_BLANK(&c))
+        return 0;
+    if (rt.section == 0)
+    {
+        if (c == ':')
+            rt.section = 1;
+        return 0;
+    }
+    if (c == ',' || c == ':')
+    {
+        if (rt.toklen && rtttl_token() != 0)
+            rt.error = 1;
+        if (c == ':' && rt.section++ == 2)
+            rt.error = 1;
+        return rt.error ? -1 : 0;
+    }
+    if (rt.toklen >= (int)sizeof(rt.tok) - 1)
+    {
+        rt.error = 1;
+        return -1;
+    }
+    rt.tok[rt.toklen++] = c;
+    return 0;
+}
+/* Finish the text
+ * return: number of notes compiled
+ *         -1 - syntax error
+ */
+int rtttl_end()
+{
+    if (!rt.error && rt.section == 2 && rt.toklen && rtttl_token() != 0)
+        rt.error = 1;
+    if (rt.error || rt.section != 2)
+        return -1;
+    return rt.len;
+}
+
+/* ================================================================
+ * Serial upload
+ *   After "tone upload" every received character goes to the RTTTL
+ *   compiler until the end of the line. Line ends and blanks before the
+ *   text are skipped, as the LF of a CR LF after the command. tone_user
+ *   only changes once the whole text has compiled.
+ * ================================================================ */
+void tone_upload_begin()
+{
+    rtttl_begin(upload_stage, TONE_UPLOAD_MAX);
+    uploading = true;
+    upload_text = false;
+}
+bool tone_uploading()
+{
+    return uploading;
+}
+/* return: false when the upload is over */
+bool tone_upload_feed(char c)
+{
+    char buf[48];
+    int n;
+    if (!upload_text && IS_BLANK(&c))
+        return true;
+    if (c != '\r' && c != '\n')
+    {
+        upload_text = true;
+        rtttl_feed(c);
+        return true;
+    }
+    uploading = false;
+    n = rtttl_end();
+    if (n <= 0)
+    {
+        UARTStringPut("Tone upload failed: invalid RTTTL\n");
+        return false;
+    }
+    /* The sequencer must not walk the notes while they are replaced, a
+     * ringing starts again on the new melody */
+    if (seq_begin == upload_notes)
+        seq_stop();
+    memcpy(upload_notes, upload_stage, n * sizeof(pnote_t));
+    tone_user.len = n;
+    sprintf(buf, "Tone user uploaded, %d notes\n", n);
+    UARTStringPut((uint8_t *)buf);
+    return false;
+}
+
+/* Current note is over */
+void TIMER1A_Handler(void)
+{
+    TimerIntClear(TIMER1_BASE, TIMER_TIMA_TIMEOUT);
+    if (seq_busy)
+        seq_next();
+}
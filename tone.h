@@ -0,0 +1,77 @@
+#ifndef _TONE_H
+#define _TONE_H
+
+#include "headers.h"
+
+/* Packed note, 2 bytes
+ *   [15:8] pitch index into pitch_period[], 0 - rest
+ *   [7:0]  duration code, length in 10ms units
+ */
+typedef uint16_t pnote_t;
+
+#define PNOTE(pitch, ms) ((pnote_t)(((pitch) << 8) | ((ms) / 10)))
+#define PNOTE_PITCH(n) ((n) >> 8)
+#define PNOTE_MS(n) (((n) & 0xff) * 10)
+#define PNOTE_MAX_MS 2550
+
+/* Chromatic pitch index, C4 ~ B7 */
+#define PITCH_REST 0
+#define PITCH_IDX(octave, semitone) (((octave) - 4) * 12 + (semitone) + 1)
+#define PITCH_NUM (PITCH_IDX(7, 11) + 1)
+
+#define N_C4 PITCH_IDX(4, 0)
+#define N_D4 PITCH_IDX(4, 2)
+#define N_E4 PITCH_IDX(4, 4)
+#define N_F4 PITCH_IDX(4, 5)
+#define N_G4 PITCH_IDX(4, 7)
+#define N_A4 PITCH_IDX(4, 9)
+#define N_B4 PITCH_IDX(4, 11)
+#define N_C5 PITCH_IDX(5, 0)
+#define N_D5 PITCH_IDX(5, 2)
+#define N_E5 PITCH_IDX(5, 4)
+#define N_F5 PITCH_IDX(5, 5)
+#define N_G5 PITCH_IDX(5, 7)
+#define N_A5 PITCH_IDX(5, 9)
+#define N_B5 PITCH_IDX(5, 11)
+
+/* Named melody */
+typedef struct
+{
+    const char *name;
+    const pnote_t *notes;
+    uint16_t len;
+} tone_t;
+
+/* Define tone id */
+#define TONE_SCALE 0
+#define TONE_RISE 1
+#define TONE_QUICK 2
+#define TONE_BEEP 3
+#define TONE_CHIME 4
+#define TONE_NUM 5
+
+/* Notes reserved for an uploaded melody */
+#define TONE_UPLOAD_MAX 128
+
+extern const tone_t tones[TONE_NUM];
+extern tone_t tone_user;
+
+void seq_play(const tone_t *tone, bool loop);
+void seq_stop(void);
+void seq_set_clock(uint32_t pwm_clock);
+bool seq_playing(void);
+const tone_t *tone_find(const char *name);
+
+/* RTTTL compiler, fed one character at a time */
+void rtttl_begin(pnote_t *out, int max);
+int rtttl_feed(char c);
+int rtttl_end(void);
+
+/* Serial upload into tone_user */
+void tone_upload_begin(void);
+bool tone_uploading(void);
+bool tone_upload_feed(char c);
+
+void TIMER1A_Handler(void);
+
+#endif
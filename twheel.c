@@ -0,0 +1,185 @@
+/*
+ * Hierarchical timer wheel driven by the 1ms SysTick.
+ *
+ * Handles come from a static pool and are numbered from 1, 0 is the
+ * empty link. Start, cancel and the per-tick work are O(1); timers of
+ * the upper levels are moved down once every 256ms / 16384ms.
+ */
+
+#include "initialize.h"
+#include "twheel.h"
+
+/* Wheel node type */
+typedef struct
+{
+    uint32_t expires; /* absolute tick of expiry */
+    twheel_cb_t cb;
+    void *arg;
+    uint16_t next;    /* links in the slot list */
+    uint16_t prev;
+    uint16_t slot;    /* slot the node is linked in */
+    uint8_t pending;  /* started and not yet expired */
+    uint8_t used;     /* allocated from the pool */
+} tnode_t;
+
+static tnode_t nodes[TWHEEL_POOL + 1];
+static uint16_t slots[TWHEEL_SLOTS];
+
+/* Free list, nodes never used yet are taken from fresh */
+static uint16_t free_top, fresh = 1;
+
+/* Last processed tick */
+static volatile uint32_t twheel_now;
+static int active;
+
+/* Pick the slot for a node by its distance to now, and link it */
+static void twheel_link(int h)
+{
+    uint32_t exp = nodes[h].expires, delta = exp - twheel_now;
+    int slot;
+    if (delta < TWHEEL_L0_SIZE)
+        slot = exp & (TWHEEL_L0_SIZE - 1);
+    else if (delta < (1 << (TWHEEL_L0_BITS + TWHEEL_LN_BITS)))
+        slot = TWHEEL_L0_SIZE + ((exp >> TWHEEL_L0_BITS) & (TWHEEL_LN_SIZE - 1));
+    else
+    {
+        /* Beyond the wheel: park in the farthest slot, re-cascaded later */
+        if (delta >= (1 << (TWHEEL_L0_BITS + 2 * TWHEEL_LN_BITS)))
+            exp = twheel_now + (1 << (TWHEEL_L0_BITS + 2 * TWHEEL_LN_BITS)) - 1;
+        slot = TWHEEL_L0_SIZE + TWHEEL_LN_SIZE +
+               ((exp >> (TWHEEL_L0_BITS + TWHEEL_LN_BITS)) & (TWHEEL_LN_SIZE - 1));
+    }
+    nodes[h].slot = slot;
+    nodes[h].prev = 0;
+    nodes[h].next = slots[slot];
+    if (slots[slot])
+        nodes[slots[slot]].prev = h;
+    slots[slot] = h;
+}
+static void twheel_unlink(int h)
+{
+    if (nodes[h].prev)
+        nodes[nodes[h].prev].next = nodes[h].next;
+    else
+        slots[nodes[h].slot] = nodes[h].next;
+    if (nodes[h].next)
+        nodes[nodes[h].next].prev = nodes[h].prev;
+}
+/* Move every node of an upper slot down */
+static void twheel_cascade(int slot)
+{
+    int h = slots[slot], next;
+    slots[slot] = 0;
+    for (; h; h = next)
+    {
+        next = nodes[h].next;
+        twheel_link(h);
+    }
+}
+
+/* Allocate a handle
+ * -1 - pool exhausted
+ */
+int twheel_alloc()
+{
+    int h = -1;
+    bool masked = IntMasterDisable();
+    if (free_top)
+    {
+        h = free_top;
+        free_top = nodes[h].next;
+    }
+    else if (fresh <= TWHEEL_POOL)
+        h = fresh++;
+    if (h > 0)
+    {
+        nodes[h].used = 1;
+        nodes[h].pending = 0;
+    }
+    if (!masked)
+        IntMasterEnable();
+    return h;
+}
+void twheel_free(int h)
+{
+    bool masked;
+    if (h <= 0 || !nodes[h].used)
+        return;
+    masked = IntMasterDisable();
+    if (nodes[h].pending)
+    {
+        twheel_unlink(h);
+        active--;
+    }
+    nodes[h].used = nodes[h].pending = 0;
+    nodes[h].next = free_top;
+    free_top = h;
+    if (!masked)
+        IntMasterEnable();
+}
+/* (Re)start a timer, cb may be NULL for polling with twheel_pending() */
+void twheel_start(int h, uint32_t ms, twheel_cb_t cb, void *arg)
+{
+    bool masked;
+    if (h <= 0 || !nodes[h].used)
+        return;
+    masked = IntMasterDisable();
+    if (nodes[h].pending)
+        twheel_unlink(h);
+    else
+        active++;
+    nodes[h].expires = twheel_now + (ms ? ms : 1);
+    nodes[h].cb = cb;
+    nodes[h].arg = arg;
+    nodes[h].pending = 1;
+    twheel_link(h);
+    if (!masked)
+        IntMasterEnable();
+}
+void twheel_cancel(int h)
+{
+    bool masked;
+    if (h <= 0 || !nodes[h].pending)
+        return;
+    masked = IntMasterDisable();
+    twheel_unlink(h);
+    nodes[h].pending = 0;
+    active--;
+    if (!masked)
+        IntMasterEnable();
+}
+bool twheel_pending(int h)
+{
+    return h > 0 && nodes[h].pending;
+}
+/* Number of running timers */
+int twheel_active()
+{
+    return active;
+}
+/* Advance the wheel by 1ms, called from SysTick_Handler */
+void twheel_tick()
+{
+    int h, idx;
+    uint32_t now = ++twheel_now;
+
+    idx = now & (TWHEEL_L0_SIZE - 1);
+    if (!idx)
+    {
+        int idx1 = (now >> TWHEEL_L0_BITS) & (TWHEEL_LN_SIZE - 1);
+        if (!idx1)
+            twheel_cascade(TWHEEL_L0_SIZE + TWHEEL_LN_SIZE +
+                           ((now >> (TWHEEL_L0_BITS + TWHEEL_LN_BITS)) & (TWHEEL_LN_SIZE - 1)));
+        twheel_cascade(TWHEEL_L0_SIZE + idx1);
+    }
+
+    /* Take one node at a time, callbacks may start or cancel others */
+    while ((h = slots[idx]) != 0)
+    {
+        twheel_unlink(h);
+        nodes[h].pending = 0;
+        active--;
+        if (nodes[h].cb)
+            nodes[h].cb(nodes[h].arg);
+    }
+}
@@ -0,0 +1,28 @@
+#ifndef _TWHEEL_H
+#define _TWHEEL_H
+
+#include "headers.h"
+
+/* Timer handles available in the static pool */
+#define TWHEEL_POOL 256
+
+/* Wheel geometry: 256 slots of 1ms, then two levels of 64 slots,
+ * covering 2^20ms (~17min) before a timer has to be re-cascaded */
+#define TWHEEL_L0_BITS 8
+#define TWHEEL_LN_BITS 6
+#define TWHEEL_L0_SIZE (1 << TWHEEL_L0_BITS)
+#define TWHEEL_LN_SIZE (1 << TWHEEL_LN_BITS)
+#define TWHEEL_SLOTS (TWHEEL_L0_SIZE + 2 * TWHEEL_LN_SIZE)
+
+/* Expiry callback, run from SysTick_Handler */
+typedef void (*twheel_cb_t)(void *arg);
+
+int twheel_alloc(void);
+void twheel_free(int h);
+void twheel_start(int h, uint32_t ms, twheel_cb_t cb, void *arg);
+void twheel_cancel(int h);
+bool twheel_pending(int h);
+int twheel_active(void);
+void twheel_tick(void);
+
+#endif